@@ -1,8 +1,6 @@
 #include "common.h"
 #include "globalVars.h"
 
-// Tokenizer
-#include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include <boost/numeric/conversion/cast.hpp>
@@ -76,15 +74,18 @@ namespace ukb {
 	}
 
 
+	// trims in place, so that l keeps its buffer
+
 	void trim_spaces(std::string &l) {
 
-		std::string res("");
 		std::string::size_type start = l.find_first_not_of(" \t\r");
-		std::string::size_type end = l.find_last_not_of(" \t\r");
-		if (start != std::string::npos) {
-			res = l.substr(start, end - start + 1);
+		if (start == std::string::npos) {
+			l.clear();
+			return;
 		}
-		l.swap(res);
+		std::string::size_type end = l.find_last_not_of(" \t\r");
+		l.erase(end + 1);
+		l.erase(0, start);
 	}
 
 	std::istream & read_line_noblank(std::istream & is, std::string & line, size_t & l_n) {
@@ -96,18 +97,16 @@ namespace ukb {
 		return is;
 	}
 
+	// id and ctx are overwritten (not reallocated) when reading
+	// contexts in a loop
+
 	std::istream & read_ukb_ctx(std::istream & is, size_t & l_n, std::string & id, std::string & ctx) {
-		std::string line;
 		id.clear();
 		ctx.clear();
-		if(read_line_noblank(is, line, l_n)) {
-			// first line is id
-			boost::char_separator<char> sep(" \t");
-			std::vector<std::string> v;
-			boost::tokenizer<boost::char_separator<char> > tok_id(line, sep);
-			copy(tok_id.begin(), tok_id.end(), back_inserter(v));
-			if (v.size() == 0) return is; // blank line or EOF
-			id = v[0];
+		if(read_line_noblank(is, id, l_n)) {
+			// first line is id (its first token, the line has no leading blanks)
+			std::string::size_type id_end = id.find_first_of(" \t");
+			if (id_end != std::string::npos) id.erase(id_end);
 			// next comes the context
 			read_line_noblank(is, ctx, l_n);
 		}
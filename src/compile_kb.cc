@@ -73,7 +73,7 @@ void set_source_rels(const string & str,
 
 void print_iquery_v(Kb::boost_graph_t & g, Kb::vertex_descriptor u, float w = 0, int sp = 0) {
 
-	string hw(g[u].name);
+	string hw(Kb::instance().get_vertex_name(u));
 
 	for (int i = 0; i < sp; ++i)
 		cout << "  ";
@@ -143,7 +143,7 @@ void show_neighbours(string & str) {
 			}
 		} else {
 			graph_traits<Kb::boost_graph_t>::in_edge_iterator iit , iend;
-			tie(iit, iend) = in_edges(u, g);
+			tie(iit, iend) = kb.in_neighbors(u);
 			for(;iit != iend; ++iit) {
 				print_iquery_v(g, source(*iit, g), g[*iit].weight, 2);
 			}
@@ -238,6 +238,7 @@ int main(int argc, char *argv[]) {
 	bool opt_iquery = false;
 	bool opt_dump = false;
 	bool opt_textdump = false;
+	bool opt_precompute = false;
 
 	// subgraph options
 	string subg_init;
@@ -247,6 +248,8 @@ int main(int argc, char *argv[]) {
 	string kb_file;
 	string query_vertex;
 	string sPathV;
+	string reorder_method;
+	vector<string> delta_files;
 
 	glVars::kb::v1_kb = false; // Use v2 format
 	glVars::kb::filter_src = false; // by default, don't filter relations by src
@@ -263,6 +266,7 @@ int main(int argc, char *argv[]) {
 	const char desc_header[] = "compile_kb: create a serialized image of the KB\n"
 		"Usage:\n"
 		"compile_kb -o output.bin [-f \"src1, src2\"] kb_file.txt kb_file.txt ... -> Create a KB image reading relations textfiles.\n"
+		"compile_kb -o output.bin --merge-delta delta.txt kb_file.bin -> Create a KB image adding the relations in delta.txt to kb_file.bin.\n"
 		"compile_kb -t kb_file.bin > graph.txt   -> Dump text file of graph.\n"
 		"compile_kb -i kb_file.bin -> Get info of a previously compiled KB.\n"
 		"compile_kb -q concept-id kb_file.bin -> Query a node on a previously compiled KB.\n"
@@ -287,6 +291,10 @@ int main(int argc, char *argv[]) {
 		("minput", "Do not die when dealing with malformed input.")
 		("nopos", "Don't filter words by Part of Speech when reading dict.")
 		("note", value<string>(), "Add a comment to the graph.")
+		("reorder", value<string>(), "Renumber the vertices for better memory locality. Values are rcm, degree, bfs and rabbit.")
+		("threads", value<size_t>(), "Number of threads parsing the input files. Zero means one per core. Default is 1.")
+		("merge-delta", value<vector<string> >(), "Add the relations of this text file to the (binary) input graph, and write the resulting graph. Can be repeated.")
+		("precompute", "Store the out-degree coefficients and the static PageRank in the binfile, so that ukb does not compute them at startup.")
 		;
 
 	options_description po_desc_query("Options for querying over binary graphs");
@@ -422,6 +430,29 @@ int main(int argc, char *argv[]) {
 		if (vm.count("output")) {
 			fullname_out = vm["output"].as<string>();
 		}
+
+		if (vm.count("threads")) {
+			size_t nt = vm["threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			glVars::kb::threads = nt;
+		}
+
+		if (vm.count("merge-delta")) {
+			delta_files = vm["merge-delta"].as<vector<string> >();
+		}
+
+		if (vm.count("precompute")) {
+			opt_precompute = true;
+		}
+
+		if (vm.count("reorder")) {
+			reorder_method = vm["reorder"].as<string>();
+			if (reorder_method != "rcm" && reorder_method != "degree" &&
+				reorder_method != "bfs" && reorder_method != "rabbit") {
+				cerr << "Error: invalid --reorder value " << reorder_method << "\n";
+				exit(-1);
+			}
+		}
 	}
 	catch(std::exception& e) {
 		cerr << e.what() << "\n";
@@ -512,14 +543,28 @@ int main(int argc, char *argv[]) {
 			cerr << "--serialize_dict error: graph missing.\n";
 			exit(-1);
 		}
-		Kb::create_from_binfile(kb_file);
-		WDict::instance().write_wdict_binfile(fullname_out);
+		try {
+			Kb::create_from_binfile(kb_file);
+			WDict::instance().write_wdict_binfile(fullname_out);
+		} catch(std::exception& e) {
+			cerr << e.what() << "\n";
+			exit(-1);
+		}
 		exit(0);
 	}
 
 	try {
-		// If first input file is "-", open std::cin
-		if (kb_file == "-") {
+		if (delta_files.size()) {
+			// input file is a binary graph
+			Kb::create_from_binfile(kb_file);
+			for(size_t i = 0; i < delta_files.size(); ++i) {
+				if (glVars::verbose)
+					cerr << "Adding relations of " << delta_files[i] << endl;
+				Kb::instance().read_from_txt(delta_files[i], src_allowed);
+			}
+			Kb::instance().merge_delta();
+		} else if (kb_file == "-") {
+			// If first input file is "-", open std::cin
 			cmdline += " <STDIN>";
 			Kb::create_from_txt(std::cin, src_allowed );
 		} else {
@@ -531,10 +576,29 @@ int main(int argc, char *argv[]) {
 	}
 
 
+	Kb::instance().add_comment(cmdline);
+
+	if (reorder_method.size()) {
+		if (glVars::verbose)
+			cerr << "Reordering vertices (" << reorder_method << ")" << endl;
+		Kb::instance().reorder_vertices(reorder_method);
+		Kb::instance().add_comment("vertex order: " + reorder_method);
+	}
+
+	if (opt_precompute) {
+		if (glVars::verbose)
+			cerr << "Precomputing PageRank data" << endl;
+		Kb::instance().precompute_prank();
+	}
+
 	if (glVars::verbose)
 		cerr << "Writing binary file: "<< fullname_out<< endl;
-	Kb::instance().add_comment(cmdline);
-	Kb::instance().write_to_binfile(fullname_out);
+	try {
+		Kb::instance().write_to_binfile(fullname_out);
+	} catch(std::exception& e) {
+		cerr << e.what() << "\n";
+		exit(-1);
+	}
 	if (glVars::verbose)
 		cerr << "Wrote " << num_vertices(Kb::instance().graph()) << " vertices and " << num_edges(Kb::instance().graph()) << " edges" << endl;
 
@@ -4,8 +4,6 @@
 #include "kbGraph.h"
 #include "wdict.h"
 
-// Tokenizer
-#include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include<boost/tuple/tuple.hpp> // for "tie"
@@ -49,8 +47,7 @@ namespace ukb {
 	}
 
 	void CWord::empty_synsets() {
-		std::vector<std::string>().swap(m_syns);
-		std::vector<std::pair<Kb::vertex_descriptor, float> >().swap(m_V);
+		vertex_vector_t().swap(m_V);
 		std::vector<float>().swap(m_ranks);
 		m_linkw_factor = 1;
 		m_disamb = false;
@@ -61,7 +58,6 @@ namespace ukb {
 		m_id.swap(o.m_id);
 		m_pos.swap(o.m_pos);
 		std::swap(m_weight, o.m_weight);
-		m_syns.swap(o.m_syns);
 		m_V.swap(o.m_V);
 		m_ranks.swap(o.m_ranks);
 		std::swap(m_linkw_factor, o.m_linkw_factor);
@@ -69,6 +65,10 @@ namespace ukb {
 		std::swap(m_disamb, o.m_disamb);
 	}
 
+	// glVars::rnd::urng is shared among threads
+
+	static thr::mutex urng_mutex;
+
 	size_t CWord::link_dict_concepts(const string & lemma, const string & pos) {
 
 		size_t new_c = 0;
@@ -87,6 +87,7 @@ namespace ukb {
 
 		if(glVars::dict::use_shuffle) {
 			// Shuffle index vector
+			thr::scoped_lock lock(urng_mutex);
 			boost::random_number_generator<boost::mt19937, long int> rand_dist(glVars::rnd::urng);
 			std::random_shuffle(sidxV.begin(), sidxV.end(), rand_dist);
 		}
@@ -95,9 +96,7 @@ namespace ukb {
 			size_t idx = sidxV[i];
 			Kb::vertex_descriptor syn_v = entries.get_entry(idx);
 			if (!syns_S.insert(syn_v).second) continue; // Synset previously there
-			const string & syn_str = entries.get_entry_str(idx);
 			float syn_freq = entries.get_freq(idx);
-			m_syns.push_back(syn_str);
 			m_V.push_back(make_pair(syn_v, syn_freq));
 			new_c++;
 		}
@@ -106,13 +105,13 @@ namespace ukb {
 
 		// (Re)calculate m_linkw_factor
 		float wlink = 0.0;
-		for(vector<pair<Kb::vertex_descriptor, float> >::iterator it = m_V.begin(), end = m_V.end();
+		for(vertex_vector_t::iterator it = m_V.begin(), end = m_V.end();
 			it != end; ++it) wlink += it->second;
 		if (wlink == 0) return 0;
 		m_linkw_factor = 1.0 / wlink;
 
 		// Update ranks
-		vector<float>(m_syns.size(), 0.0).swap(m_ranks);
+		vector<float>(m_V.size(), 0.0).swap(m_ranks);
 		return new_c;
 	}
 
@@ -128,7 +127,6 @@ namespace ukb {
 			if (!P) {
 				throw std::logic_error("CWord concept " + m_w + " not in KB");
 			}
-			m_syns.push_back(m_w);
 			m_V.push_back(make_pair(u, 1.0f));
 			m_ranks.push_back(0.0f);
 			m_linkw_factor = 1.0;
@@ -143,7 +141,7 @@ namespace ukb {
 			// empty CWord
 			empty_synsets();
 		}
-		m_disamb = (1 == m_syns.size()); // monosemous words are disambiguated
+		m_disamb = (1 == m_V.size()); // monosemous words are disambiguated
 	}
 
 	void CWord::attach_lemma(const string & lemma, const string & pos) {
@@ -162,8 +160,7 @@ namespace ukb {
 
 	size_t CWord::set_concepts(map<string, float> & C) {
 
-		std::vector<std::string> syns;
-		std::vector<std::pair<Kb::vertex_descriptor, float> > V;
+		vertex_vector_t V;
 		Kb::vertex_descriptor u;
 		bool P;
 		float total_w = 0.0f;
@@ -178,7 +175,6 @@ namespace ukb {
 				continue;
 			}
 			N++;
-			syns.push_back(it->first);
 			V.push_back(make_pair(u, it->second));
 			total_w += it->second;
 		}
@@ -189,7 +185,6 @@ namespace ukb {
 
 		// Update concepts
 		m_linkw_factor = 1.0 / total_w;
-		m_syns.swap(syns);
 		m_V.swap(V);
 		vector<float>(N, 0.0).swap(m_ranks);
 		m_disamb = (N == 1); // monosemous words are disambiguated
@@ -202,7 +197,6 @@ namespace ukb {
 			m_id = cw_.m_id;
 			m_weight = cw_.m_weight;
 			m_pos = cw_.m_pos;
-			m_syns = cw_.m_syns;
 			m_V = cw_.m_V;
 			m_ranks = cw_.m_ranks;
 			m_disamb = cw_.m_disamb;
@@ -227,8 +221,8 @@ namespace ukb {
 			o << m_pos;
 		o << "#" << m_id << "#" << m_type;
 		o << "#" << lexical_cast<string>(m_weight) << "#" << lexical_cast<string>(m_linkw_factor) << "\t";
-		for(size_t i = 0; i < m_syns.size(); i++) {
-			o << "[" << m_syns[i] << ", " << m_V[i].first << ", " << m_V[i].second << "] ";
+		for(size_t i = 0; i < m_V.size(); i++) {
+			o << "[" << syn(i) << ", " << m_V[i].first << ", " << m_V[i].second << "] ";
 		}
 		return o;
 	}
@@ -246,14 +240,14 @@ namespace ukb {
 
 	void CWord::disamb_cword() {
 
-		size_t n = m_syns.size();
+		size_t n = m_V.size();
 		if (!n) return;
 		if (n == 1) {
 			m_disamb = true; // Monosemous words are disambiguated
 			return;
 		}
 
-		vector<string> syns(n);
+		vertex_vector_t V(n);
 		vector<float> ranks(n);
 		vector<int> idx(n);
 
@@ -262,11 +256,11 @@ namespace ukb {
 		sort(idx.begin(), idx.end(), CWSort(m_ranks));
 
 		for(size_t i=0; i < n; ++i) {
-			syns[i]  = m_syns[idx[i]];
+			V[i]     = m_V[idx[i]];
 			ranks[i] = m_ranks[idx[i]];
 		}
 		if(ranks[0] == ranks[n-1]) return; // If all ranks have same value the word is not disambiguated
-		syns.swap(m_syns);
+		V.swap(m_V);
 		ranks.swap(m_ranks);
 		m_disamb = true;
 	}
@@ -289,30 +283,32 @@ namespace ukb {
 	}
 
 	ostream & cw_aw_print_best(ostream & o,
-							   const vector<string> & syns,
+							   const CWord::vertex_vector_t & V,
 							   const vector<float> & ranks) {
-		size_t n = syns.size();
-		o << " " << syns[0];
+		Kb & kb = Kb::instance();
+		size_t n = V.size();
+		o << " " << kb.get_vertex_name(V[0].first);
 		for(size_t i = 1; i != n; ++i) {
 			if (ranks[i] != ranks[0]) break;
-			o << " " << syns[i];
+			o << " " << kb.get_vertex_name(V[i].first);
 		}
 		return o;
 	}
 
 	ostream & cw_aw_print_all(ostream & o,
-							  const vector<string> & syns,
+							  const CWord::vertex_vector_t & V,
 							  const vector<float> & ranks) {
+		Kb & kb = Kb::instance();
 		float norm_factor = 1.0;
 		if (glVars::output::norm_ranks) {
 			float rsum = 0.0;
-			for(size_t i = 0; i != syns.size(); ++i) {
+			for(size_t i = 0; i != V.size(); ++i) {
 				rsum += ranks[i];
 			}
 			if (rsum) norm_factor *= 1.0 / rsum;
 		}
-		for(size_t i = 0; i != syns.size(); ++i) {
-			o << " " << syns[i] << "/" << ranks[i]*norm_factor;
+		for(size_t i = 0; i != V.size(); ++i) {
+			o << " " << kb.get_vertex_name(V[i].first) << "/" << ranks[i]*norm_factor;
 		}
 		return o;
 	}
@@ -320,8 +316,8 @@ namespace ukb {
 	ostream & CWord::print_cword(ostream & o, const std::string &id) const {
 
 		o << id << " ";
-		if(!glVars::output::allranks) cw_aw_print_best(o, m_syns, m_ranks);
-		else cw_aw_print_all(o, m_syns, m_ranks);
+		if(!glVars::output::allranks) cw_aw_print_best(o, m_V, m_ranks);
+		else cw_aw_print_all(o, m_V, m_ranks);
 		o << " !! " << m_w << "\n";
 		return o;
 	}
@@ -332,14 +328,8 @@ namespace ukb {
 	CSentence::CSentence(const std::string & id, const std::string & ctx_str) :
 		m_tgtN(0), m_weight(0.0), m_w_factor(0.0f), m_id(id) {
 		if (m_id.empty()) throw std::runtime_error(string("empty id"));
-		vector<string> ctx;
-		vector<CWord> V;
-		char_separator<char> sep(" \t");
-		tokenizer<char_separator<char> > tok_ctx(ctx_str, sep);
-		copy(tok_ctx.begin(), tok_ctx.end(), back_inserter(ctx));
-		if (ctx.size() == 0) return;
 		try {
-			push_ctx(ctx);
+			push_ctx(ctx_str);
 		} catch (ukb::wdict_error & e) {
 			throw e;
 		} catch (std::exception & e) {
@@ -347,6 +337,29 @@ namespace ukb {
 		}
 	}
 
+	// Tokens of a context string, i.e., the spans of the string between
+	// blanks. Tokens are not copied.
+
+	struct ctx_tokenizer_t {
+
+		ctx_tokenizer_t(const string & str) : m_p(str.data()), m_end(str.data() + str.size()) {}
+
+		// get next token [b, b + n)
+		bool next(const char * & b, size_t & n) {
+			while (m_p != m_end && is_blank(*m_p)) ++m_p;
+			if (m_p == m_end) return false;
+			b = m_p;
+			while (m_p != m_end && !is_blank(*m_p)) ++m_p;
+			n = m_p - b;
+			return true;
+		}
+
+		static bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+		const char * m_p;
+		const char * m_end;
+	};
+
 	struct ctw_parse_t {
 		string lemma;
 		string pos;
@@ -358,57 +371,114 @@ namespace ukb {
 
 	};
 
-	ctw_parse_t parse_ctw(const string & word) {
+	// Parse context word [word, word + len), with fields separated by
+	// '#'. res is overwritten, so it can be reused among words.
 
-		ctw_parse_t res;
+	static void parse_ctw(const char * word, size_t len, ctw_parse_t & res) {
 
-		char_separator<char> wsep("#", "", keep_empty_tokens);
-		tokenizer<char_separator<char> > wtok(word, wsep);
-		tokenizer<char_separator<char> >::iterator it = wtok.begin();
-		tokenizer<char_separator<char> >::iterator end = wtok.end();
-		if (it == end) return res; // empty line
-		vector<string> fields;
-		copy(it, end, back_inserter(fields));
-		size_t m = fields.size();
+		const char * fields[6];  // fields[i], fields[i + 1] - 1 is the i-th field
+		const char * end = word + len;
+		size_t m = 0;
+		fields[m++] = word;
+		for(const char * p = word; p != end; ++p) {
+			if (*p != '#') continue;
+			if (m == 5) throw std::logic_error(string(word, len) + " : too few fields.");
+			fields[m++] = p + 1;
+		}
+		fields[m] = end + 1;
 		if (m != 4 && m != 5) {
-			throw std::logic_error(word + " : too few fields.");
+			throw std::logic_error(string(word, len) + " : too few fields.");
 		}
-		res.lemma = fields[0];
-		res.pos = fields[1];
-		if (!glVars::input::filter_pos || !res.pos.size()) res.pos = std::string("#");
-		res.id = fields[2];
+		res.lemma.assign(fields[0], fields[1] - 1);
+		res.pos.assign(fields[1], fields[2] - 1);
+		if (!glVars::input::filter_pos || !res.pos.size()) res.pos.assign(1, '#');
+		res.id.assign(fields[2], fields[3] - 1);
+		res.w = 1.0;
 		try {
-			res.dist = lexical_cast<int>(fields[3]);
+			res.dist = lexical_cast<int>(string(fields[3], fields[4] - 1));
 			if (m == 5)
-				res.w = lexical_cast<float>(fields[4]);
+				res.w = lexical_cast<float>(string(fields[4], fields[5] - 1));
 		} catch (boost::bad_lexical_cast &) {
-			throw std::logic_error(word + " : Parsing error.");
+			throw std::logic_error(string(word, len) + " : Parsing error.");
 		}
 
 		if (res.w < 0.0) {
-			throw std::logic_error(word + " : Negative weight.");
+			throw std::logic_error(string(word, len) + " : Negative weight.");
 		}
-		return res;
 	}
 
+	// Index of the unique CWords of a CSentence, for finding repeated
+	// words (two CWords are the same word if they have the same wpos). It is
+	// an open addressing hash table (linear probing) of positions in the
+	// CWord vector, so no keys are copied.
+
+	class cw_index_t {
+
+	public:
+
+		static const size_t no_cw = size_t(-1);
+
+		explicit cw_index_t(const vector<CWord> & V) : m_V(V), m_slots(16, no_cw) {}
+
+		// position of cw in V, or no_cw
+		size_t find(const CWord & cw) const { return m_slots[find_slot(cw)]; }
+
+		// index V.back(), which is not in the index
+		void push_back() {
+			if (2 * m_V.size() > m_slots.size()) {
+				vector<size_t>(2 * m_slots.size(), no_cw).swap(m_slots);
+				for(size_t i = 0; i + 1 < m_V.size(); ++i)
+					m_slots[find_slot(m_V[i])] = i;
+			}
+			m_slots[find_slot(m_V.back())] = m_V.size() - 1;
+		}
+
+	private:
+
+		size_t find_slot(const CWord & cw) const {
+			size_t mask = m_slots.size() - 1;
+			size_t i = hash(cw) & mask;
+			while(m_slots[i] != no_cw && !same_wpos(m_V[m_slots[i]], cw))
+				i = (i + 1) & mask;
+			return i;
+		}
+
+		static bool same_wpos(const CWord & a, const CWord & b) {
+			if (a.is_synset() != b.is_synset() || a.word() != b.word()) return false;
+			return a.is_synset() || a.pos() == b.pos();
+		}
+
+		static size_t hash(const CWord & cw) {
+			boost::uint64_t h = vertex_names_t::hash(cw.word().data(), cw.word().size());
+			if (!cw.is_synset())
+				h = h * 31 + vertex_names_t::hash(cw.pos().data(), cw.pos().size());
+			return h;
+		}
+
+		const vector<CWord> & m_V;
+		vector<size_t> m_slots;
+	};
+
+	const size_t cw_index_t::no_cw;
 
 	// NOTE: destroys new_cw
 	void CSentence::push_cw(CWord & new_cw,
-							 map<string, size_t > & CW,
+							 cw_index_t & CW,
 							 bool is_nopv) {
-		map<string, size_t >::iterator cwit;
-		bool P;
-		string id = new_cw.id();
 		CWord::cwtype type = new_cw.type();
 		bool is_tgtword = new_cw.is_tgtword();
 		float w = new_cw.m_weight;
 
-		tie(cwit, P) = CW.insert(make_pair(new_cw.wpos(), m_vuniq.size()));
-		if (P) {
+		size_t idx = CW.find(new_cw);
+		const string * id = &new_cw.m_id;
+		if (idx == cw_index_t::no_cw) {
+			idx = m_vuniq.size();
 			m_vuniq.push_back(CWord());
 			m_vuniq.back().swap(new_cw);
+			id = &m_vuniq.back().m_id;
+			CW.push_back();
 		} else {
-			CWord & old = m_vuniq[cwit->second];
+			CWord & old = m_vuniq[idx];
 			// check type compatibility
 			bool old_is_nopv = old.type() == CWord::cw_tgtword_nopv || old.type() == CWord::cw_ctxword_nopv;
 			if ((is_nopv && !old_is_nopv) ||
@@ -419,22 +489,28 @@ namespace ukb {
 				old.m_type = type;
 			old.m_weight += w; // aggregate weights
 		}
-		m_tokens.push_back(cwtoken_t(id, type, cwit->second));
+		m_tokens.push_back(cwtoken_t(*id, type, idx));
 		if (is_tgtword) m_tgtN++;
 		m_weight += w;
 	}
 
-	void CSentence::push_ctx(const vector<string> & ctx) {
+	void CSentence::push_ctx(const string & ctx_str) {
 
-		map<string, size_t > CW; // words inserted so far
+		cw_index_t CW(m_vuniq); // words inserted so far
 		bool last_is_nopv = false;
 		CWord last_nopv;
 		map<string, float> nopv_concepts;
-		vector<string>::const_iterator end = ctx.end();
-		for(vector<string>::const_iterator it = ctx.begin();
-			it != end or last_is_nopv; ++it) {
+		ctx_tokenizer_t tok(ctx_str);
+		ctw_parse_t ctwp;
+		const char * word = 0;
+		size_t word_n = 0;
+		bool advance = true; // whether to go to the next token
+		for(bool has_word = tok.next(word, word_n);
+			has_word or last_is_nopv;
+			has_word = advance ? tok.next(word, word_n) : has_word) {
+			advance = true;
 			try {
-				if (it == end) {
+				if (!has_word) {
 					// last check to fill last nopv
 					last_is_nopv = false;
 					if (last_nopv.set_concepts(nopv_concepts)) { // false means no concepts attached
@@ -443,13 +519,13 @@ namespace ukb {
 					}
 					break;
 				}
-				ctw_parse_t ctwp = parse_ctw(*it);
+				parse_ctw(word, word_n, ctwp);
 				if (ctwp.lemma.size() == 0) {
-					throw std::logic_error(*it + " has no lemma.");
+					throw std::logic_error(string(word, word_n) + " has no lemma.");
 				}
 				CWord::cwtype cw_type = cast_int_cwtype(ctwp.dist);
 				if (cw_type == CWord::cw_error) {
-					throw std::logic_error(*it + " fourth field is invalid.");
+					throw std::logic_error(string(word, word_n) + " fourth field is invalid.");
 				}
 				if(!glVars::input::weight)
 					ctwp.w = 1.0;
@@ -465,9 +541,9 @@ namespace ukb {
 					// new elem is not concept, so push last nopv
 					if (last_nopv.set_concepts(nopv_concepts)) {
 						map<string, float>().swap(nopv_concepts);
-						--it; // if push_cw throws, make sure current word is processed again
+						advance = false; // if push_cw throws, make sure current word is processed again
 						push_cw(last_nopv, CW, true);
-						++it; // did not throw anyway
+						advance = true; // did not throw anyway
 					}
 				}
 
@@ -482,7 +558,7 @@ namespace ukb {
 				if (!new_cw.size()) {
 					if (glVars::debug::warning)
 						// No synset for that word.
-						cerr << "W:" << *it << " can't be mapped to KB.\n";
+						cerr << "W:" << string(word, word_n) << " can't be mapped to KB.\n";
 					continue;
 				}
 				push_cw(new_cw, CW, false);
@@ -575,35 +651,32 @@ namespace ukb {
 	// Can not be used when glVars::prank::poslightw is set
 
 
-	size_t update_pv_cw(const vector<pair<Kb::vertex_descriptor, float> > & m_V,
+	size_t update_pv_cw(const CWord::vertex_vector_t & m_V,
 						float factor,
-						vector<float> & pv) {
+						sparse_vector_t & pv) {
 
 		// Sum edge weights
 
 		size_t inserted = 0;
 		// Uppdate PV
-		for(vector<pair<Kb::vertex_descriptor, float> >::const_iterator it = m_V.begin(), end = m_V.end();
+		for(CWord::vertex_vector_t::const_iterator it = m_V.begin(), end = m_V.end();
 			it != end; ++it) {
 			inserted++;
-			pv[it->first] += it->second * factor;
+			pv.push_back(make_pair(it->first, it->second * factor));
 		}
 		return inserted;
 	}
 
 	// Get personalization vector giving an csentence. onlyC variant.
+	//
+	// The PV is sparse, as only the synsets of the context words get some
+	// value.
 
 	int pv_from_cs_onlyC(const CSentence & cs,
-						 vector<float> & pv,
+						 sparse_vector_t & pv,
 						 CSentence::const_iterator exclude_word_it) {
 
-		Kb & kb = ukb::Kb::instance();
-
-		if (kb.size() == pv.size()) {
-			std::fill(pv.begin(), pv.end(), 0.0);
-		} else {
-			vector<float> (kb.size(), 0.0).swap(pv);
-		}
+		pv.clear();
 
 		Kb::vertex_descriptor u;
 		int inserted_i = 0;
@@ -616,7 +689,7 @@ namespace ukb {
 			float cw_w = cw.get_weight() * cs.weigth_factor();
 			if (cw.type() == CWord::cw_concept) {
 				u = cw.V_vector().at(0).first;
-				pv[u] += cw_w;
+				pv.push_back(make_pair(u, cw_w));
 				inserted_i++;
 			} else {
 				inserted_i += update_pv_cw(cw.V_vector(),
@@ -624,6 +697,7 @@ namespace ukb {
 										   pv);
 			}
 		}
+		sort_sparse_vector(pv);
 		return inserted_i;
 	}
 
@@ -639,6 +713,13 @@ namespace ukb {
 		return calculate_kb_ppr_by_word(cs, cs.uend(), ranks);
 	}
 
+	bool calculate_kb_ppr(const CSentence & cs,
+						  vector<float> & ranks,
+						  PrankWorkspace & ws) {
+
+		return calculate_kb_ppr_by_word(cs, cs.uend(), ranks, ws);
+	}
+
 	// given a word (pointed by tgtw_it),
 	// 1. put a ppv in the synsets of the rest of words.
 	// 2. Pagerank
@@ -650,12 +731,21 @@ namespace ukb {
 								  CSentence::const_iterator tgtw_it,
 								  vector<float> & ranks) {
 
+		PrankWorkspace ws;
+		return calculate_kb_ppr_by_word(cs, tgtw_it, ranks, ws);
+	}
+
+	bool calculate_kb_ppr_by_word(const CSentence & cs,
+								  CSentence::const_iterator tgtw_it,
+								  vector<float> & ranks,
+								  PrankWorkspace & ws) {
+
 		Kb & kb = ukb::Kb::instance();
-		vector<float> pv;
+		sparse_vector_t & pv = ws.spv;
 		int aux = pv_from_cs_onlyC(cs, pv, tgtw_it);
 		// Execute PageRank
 		if (aux) {
-			kb.pageRank_ppv(pv, ranks);
+			kb.pageRank_ppv(pv, ranks, ws);
 			if (glVars::csentence::disamb_minus_static) {
 				const vector<float> & staticV = kb.static_prank();
 				for(size_t i = 0, n = staticV.size();
@@ -667,6 +757,47 @@ namespace ukb {
 		return aux;
 	}
 
+	// batched version of calculate_kb_ppr_by_word
+
+	void calculate_kb_ppr_by_words(const CSentence & cs,
+								   const vector<CSentence::const_iterator> & tgtws,
+								   vector<vector<float> > & ranks,
+								   vector<int> & ok) {
+
+		Kb & kb = ukb::Kb::instance();
+		size_t n = tgtws.size();
+		vector<int>(n, 0).swap(ok);
+		vector<vector<float> >(n).swap(ranks);
+
+		vector<sparse_vector_t> pvs;
+		vector<size_t> idx; // pvs[j] corresponds to tgtws[idx[j]]
+		for(size_t i = 0; i < n; ++i) {
+			pvs.push_back(sparse_vector_t());
+			ok[i] = pv_from_cs_onlyC(cs, pvs.back(), tgtws[i]);
+			if (ok[i]) {
+				idx.push_back(i);
+			} else {
+				pvs.pop_back();
+			}
+		}
+		if (!pvs.size()) return;
+
+		vector<vector<float> > pv_ranks;
+		kb.pageRank_ppv_batch(pvs, pv_ranks);
+		vector<sparse_vector_t>().swap(pvs);
+		for(size_t j = 0; j < idx.size(); ++j) {
+			vector<float> & r = ranks[idx[j]];
+			r.swap(pv_ranks[j]);
+			if (glVars::csentence::disamb_minus_static) {
+				const vector<float> & staticV = kb.static_prank();
+				for(size_t i = 0, m = staticV.size();
+					i != m; ++i) {
+					r[i] = staticV[i] - r[i];
+				}
+			}
+		}
+	}
+
 	//
 	// Given a previously disambiguated CSentence (all synsets of words
 	// have a rank), calculate a kb prgaRank where PPV is formed by
@@ -679,7 +810,6 @@ namespace ukb {
 		if (!cs.has_tgtwords()) return false; // no target words
 
 		Kb & kb = ukb::Kb::instance();
-		bool aux;
 
 		// Initialize result vector
 		vector<float> (kb.size(), 0.0).swap(res);
@@ -692,12 +822,8 @@ namespace ukb {
 		float K = 0.0;
 		for(; cw_it != cw_end; ++cw_it) {
 			for(size_t i = 0; i != cw_it->size(); ++i) {
-				Kb::vertex_descriptor u;
-				tie(u, aux) = kb.get_vertex_by_name(cw_it->syn(i));
-				if (aux) {
-					ppv[u] = cw_it->rank(i);
-					K += cw_it->rank(i);
-				}
+				ppv[cw_it->vertex(i)] = cw_it->rank(i);
+				K += cw_it->rank(i);
 			}
 		}
 
@@ -12,6 +12,7 @@
 namespace ukb {
 
 	class CSentence; // forward declaration
+	class cw_index_t; // see csentence.cc
 
 	class CWord {
 
@@ -45,12 +46,17 @@ namespace ukb {
 			cw_error
 		};
 
-		typedef std::vector<std::string>::const_iterator const_iterator;
-		typedef std::vector<std::string>::iterator iterator;
-		typedef std::vector<std::string>::reference reference;
-		typedef std::vector<std::string>::const_reference const_reference;
-		typedef std::vector<std::string>::value_type value_type;
-		typedef std::vector<std::string>::size_type size_type;
+		// The concepts of the CWord are KB vertices (with their link
+		// weights). Concept names are only needed for output, and are
+		// taken from the KB then (see syn).
+
+		typedef std::vector<std::pair<Kb::vertex_descriptor, float> > vertex_vector_t;
+		typedef vertex_vector_t::const_iterator const_iterator;
+		typedef vertex_vector_t::iterator iterator;
+		typedef vertex_vector_t::reference reference;
+		typedef vertex_vector_t::const_reference const_reference;
+		typedef vertex_vector_t::value_type value_type;
+		typedef vertex_vector_t::size_type size_type;
 
 		explicit CWord() : m_weight(1.0), m_linkw_factor(1.0), m_type(cw_error), m_disamb(false) {};
 		CWord(const std::string & w_, const std::string & id, const std::string & pos, cwtype type, float wght_ = 1.0);
@@ -66,17 +72,19 @@ namespace ukb {
 		// set concepts attached to the cword (used in tgt_noppv type cwords)
 		size_t set_concepts(std::map<std::string, float> & C);
 
-		iterator begin() {return m_syns.begin();}
-		iterator end() {return m_syns.end();}
-		const_iterator begin() const {return m_syns.begin();}
-		const_iterator end() const {return m_syns.end();}
+		iterator begin() {return m_V.begin();}
+		iterator end() {return m_V.end();}
+		const_iterator begin() const {return m_V.begin();}
+		const_iterator end() const {return m_V.end();}
 
-		size_type size() const {return m_syns.size(); }
+		size_type size() const {return m_V.size(); }
 
-		const std::string & syn(size_t i) const { return m_syns[i];}
+		Kb::vertex_descriptor vertex(size_t i) const { return m_V[i].first; }
+		std::string syn(size_t i) const { return Kb::instance().get_vertex_name(m_V[i].first); }
 		float rank(size_t i) const { return m_ranks[i];}
 
-		std::string word() const { return m_w; }
+		const std::string & word() const { return m_w; }
+		const std::string & pos() const { return m_pos; }
 
 		std::string wpos() const;
 
@@ -88,19 +96,17 @@ namespace ukb {
 
 		bool is_tgtword() const;
 		bool is_disambiguated() const { return m_disamb; }
-		bool is_monosemous() const { return (1 == m_syns.size()); }
+		bool is_monosemous() const { return (1 == m_V.size()); }
 		bool is_synset() const { return m_type == cw_concept; }
 
-		bool has_concept(const std::string & str);
-
 		cwtype type() const { return m_type; }
 
 		void empty_synsets();
-		const std::vector<std::pair<Kb::vertex_descriptor, float> > & V_vector() const { return m_V; }
+		const vertex_vector_t & V_vector() const { return m_V; }
 
 		template <typename Map>
 		void rank_synsets(Map rankMap, bool use_prior) {
-			size_t n = m_syns.size();
+			size_t n = m_V.size();
 			size_t i;
 			if (!n) return; // No synsets
 			if (rankMap.size() == 0) return; // No ranks
@@ -115,11 +121,11 @@ namespace ukb {
 		void rank_synsets(G & g, Map rankMap) {
 			typename G::vertex_t u;
 			bool P;
-			size_t n = m_syns.size();
+			size_t n = m_V.size();
 			size_t i;
 			if (!n) return; // No synsets
 			for(i = 0; i != n; ++i) {
-				boost::tie(u, P) = g.get_vertex_by_name(m_syns[i]);
+				boost::tie(u, P) = g.get_vertex_by_kb_vertex(m_V[i].first);
 				m_ranks[i] = P ? rankMap[u] : 0.0f;
 			}
 		}
@@ -147,8 +153,7 @@ namespace ukb {
 		std::string m_id;
 		std::string m_pos; // 'n', 'v', 'a', 'r' or 0 (no pos)
 		float m_weight;     // Initial weight for PPV
-		std::vector<std::string> m_syns;
-		std::vector<std::pair<Kb::vertex_descriptor, float> > m_V;
+		vertex_vector_t m_V;
 		std::vector<float> m_ranks;
 		float m_linkw_factor; // 1 / (sum of all link weights)
 		cwtype m_type;
@@ -190,9 +195,9 @@ namespace ukb {
 		std::ostream & debug(std::ostream & o) const;
 	private:
 
-		void push_ctx(const std::vector<std::string> & ctx);
+		void push_ctx(const std::string & ctx_str);
 		void push_cw(CWord & new_cw,
-					 std::map<std::string, size_t > & CW,
+					 cw_index_t & CW,
 					 bool is_nopv);
 
 		struct cwtoken_t {
@@ -218,6 +223,27 @@ namespace ukb {
 								  CSentence::const_iterator tgtw_it,
 								  std::vector<float> & ranks);
 
+	// Same as above, reusing the buffers of ws (see PrankWorkspace)
+
+	bool calculate_kb_ppr(const CSentence & cs,
+						  std::vector<float> & res,
+						  PrankWorkspace & ws);
+
+	bool calculate_kb_ppr_by_word(const CSentence & cs,
+								  CSentence::const_iterator tgtw_it,
+								  std::vector<float> & ranks,
+								  PrankWorkspace & ws);
+
+	// Same as calculate_kb_ppr_by_word, but for several target words at
+	// once. All PPVs are computed in a single batched PageRank run.
+	// ranks[i] holds the ranks of tgtws[i], and ok[i] is zero if no ranks
+	// could be computed for it.
+
+	void calculate_kb_ppr_by_words(const CSentence & cs,
+								   const std::vector<CSentence::const_iterator> & tgtws,
+								   std::vector<std::vector<float> > & ranks,
+								   std::vector<int> & ok);
+
 	int calculate_kb_ppr_by_word_and_disamb(CSentence & cs);
 
 	bool calculate_kb_ppv_csentence(CSentence & cs, std::vector<float> & res);
@@ -229,7 +255,7 @@ namespace ukb {
 	// Functions for calculating initial PV given a CSentence
 
 	int pv_from_cs_onlyC(const CSentence & cs,
-						 std::vector<float> & pv,
+						 sparse_vector_t & pv,
 						 CSentence::const_iterator exclude_word_it);
 
 }
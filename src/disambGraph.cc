@@ -1,7 +1,6 @@
 #include "disambGraph.h"
 #include "common.h"
 #include "kbGraph.h"
-#include "dfsa.h"
 #include "csentence.h"
 #include "prank.h"
 #include "globalVars.h"
@@ -16,12 +15,7 @@
 #include <map>
 #include <iterator>
 #include <ostream>
-
-
-// graphviz
-
-#include <boost/graph/graphviz.hpp>
-#include <boost/graph/filtered_graph.hpp>
+#include <algorithm>
 
 // bfs
 
@@ -47,39 +41,27 @@ namespace ukb {
 	// Disamb fill functions
 
 
-	DisambGraph::DisambGraph() {
+	DisambGraph::DisambGraph() : m_merged(0) {
 	}
 
-	void DisambGraph::add_dgraph_edge(Dis_vertex_t u, Dis_vertex_t v, float w) {
+	// Just append the edge. Repeated edges are merged when freezing the
+	// graph (see freeze).
 
-		Dis_edge_t e;
-		bool existP;
+	void DisambGraph::add_dgraph_edge(Dis_vertex_t u, Dis_vertex_t v, float w) {
 
 		if (u == v)
 			throw runtime_error("Can't insert self loop !");
-
-		map<Kb::vertex_descriptor, Dis_vertex_t>::iterator it;
-
-		tie(e, existP) = edge(u, v, g);
-		if(!existP) {
-			// new edge
-			tie(e, existP) = add_edge(u, v, g);
-			put(edge_weight, g, e, w);
-		} else {
-			// edge already there. Increase freq.
-			put(edge_weight, g, e, get(edge_weight, g, e) + w);
-		}
+		if (v < u) std::swap(u, v);
+		m_E.push_back(edge_t(u, v, w));
 	}
 
-	Dis_vertex_t DisambGraph::add_dgraph_vertex(const string & str) {
+	Dis_vertex_t DisambGraph::add_dgraph_vertex(Kb::vertex_descriptor u) {
 
-		boost::unordered_map<string, Dis_vertex_t>::iterator map_it;
+		boost::unordered_map<Kb::vertex_descriptor, Dis_vertex_t>::iterator map_it;
 		bool insertedP;
-		tie(map_it, insertedP) = synsetMap.insert(make_pair(str, Dis_vertex_t()));
+		tie(map_it, insertedP) = kbMap.insert(make_pair(u, Dis_vertex_t(m_kbv.size())));
 		if (insertedP) {
-			Dis_vertex_t v = add_vertex(g);
-			put(vertex_name, g, v, str);
-			map_it->second = v;
+			m_kbv.push_back(u);
 		}
 		return map_it->second;
 	}
@@ -93,23 +75,26 @@ namespace ukb {
 		//     deb++;
 		//   }
 
-		vector<string> path_str;
+		vector<Kb::vertex_descriptor> path_kb;
 		Kb::vertex_descriptor pred;
-		Kb & kb = ukb::Kb::instance();
 
 		pred = parents[tgt];
 		while(tgt != pred) {
-			path_str.push_back(kb.get_vertex_name(tgt));
+			path_kb.push_back(tgt);
 			tgt = pred;
 			pred = parents[tgt];
 		}
 		if (tgt != src) return;
-		path_str.push_back(kb.get_vertex_name(src));
+		path_kb.push_back(src);
+		fill_graph(path_kb);
+	}
+
+	void DisambGraph::fill_graph(const vector<Kb::vertex_descriptor> & path_kb) {
 
 		vector<Dis_vertex_t> path_v;
 		size_t length = 0;
-		for(vector<string>::iterator v_it = path_str.begin();
-			v_it != path_str.end();
+		for(vector<Kb::vertex_descriptor>::const_iterator v_it = path_kb.begin();
+			v_it != path_kb.end();
 			++v_it) {
 			Dis_vertex_t u = add_dgraph_vertex(*v_it);
 			path_v.push_back(u);
@@ -130,15 +115,11 @@ namespace ukb {
 	}
 
 
-	void DisambGraph::fill_graph(const set<Kb::edge_descriptor> & E) {
-		Kb & kb = Kb::instance();
-		for(set<Kb::edge_descriptor>::const_iterator it = E.begin(), end = E.end();
-			it != end; ++it) {
-			Kb::vertex_descriptor uu = kb.edge_source(*it);
-			Kb::vertex_descriptor vv = kb.edge_target(*it);
-			if (uu == vv) continue;
-			Dis_vertex_t u = add_dgraph_vertex(kb.get_vertex_name(uu));
-			Dis_vertex_t v = add_dgraph_vertex(kb.get_vertex_name(vv));
+	void DisambGraph::fill_graph(const kb_edges_t & E, size_t k) {
+		for(size_t i = E.offset[k]; i < E.offset[k + 1]; ++i) {
+			if (E.U[i] == E.V[i]) continue;
+			Dis_vertex_t u = add_dgraph_vertex(E.U[i]);
+			Dis_vertex_t v = add_dgraph_vertex(E.V[i]);
 			add_dgraph_edge(u, v, 1.0);
 		}
 	}
@@ -148,107 +129,175 @@ namespace ukb {
 
 
 	pair<Dis_vertex_t, bool> DisambGraph::get_vertex_by_name(const std::string & str) const {
-		boost::unordered_map<string, Dis_vertex_t>::const_iterator it = synsetMap.find(str);
-		if (it == synsetMap.end()) return make_pair(Dis_vertex_t(), false);
+		Kb::vertex_descriptor u;
+		bool P;
+		tie(u, P) = Kb::instance().get_vertex_by_name(str);
+		if (!P) return make_pair(Dis_vertex_t(), false);
+		return get_vertex_by_kb_vertex(u);
+	}
+
+	pair<Dis_vertex_t, bool> DisambGraph::get_vertex_by_kb_vertex(Kb::vertex_descriptor u) const {
+		boost::unordered_map<Kb::vertex_descriptor, Dis_vertex_t>::const_iterator it = kbMap.find(u);
+		if (it == kbMap.end()) return make_pair(Dis_vertex_t(), false);
 		return make_pair(it->second, true);
 	}
 
+	////////////////////////////////////////////////////////////////////////////////
+	// CSR
+
+	// Sort the edges and add up the weights of repeated ones, which keeps
+	// the order in which they were added, and build the CSR.
+
+	void DisambGraph::freeze() const {
+
+		size_t N = m_kbv.size();
+		if (m_merged == m_E.size() && m_rowstart.size() == N + 1) return;
+
+		if (m_merged != m_E.size()) {
+			std::stable_sort(m_E.begin(), m_E.end());
+			vector<edge_t>::iterator out = m_E.begin();
+			vector<edge_t>::const_iterator it = m_E.begin();
+			vector<edge_t>::const_iterator end = m_E.end();
+			while(it != end) {
+				edge_t e = *it;
+				for(++it; it != end && it->u == e.u && it->v == e.v; ++it) {
+					e.w += it->w;
+				}
+				*out++ = e;
+			}
+			m_E.erase(out, m_E.end());
+			m_merged = m_E.size();
+		}
+
+		vector<kb_index_t>(N + 1, 0).swap(m_rowstart);
+		vector<kb_index_t>(2 * m_E.size()).swap(m_column);
+		vector<kb_edge_t>(2 * m_E.size()).swap(m_weight);
+		for(vector<edge_t>::const_iterator it = m_E.begin(), end = m_E.end(); it != end; ++it) {
+			++m_rowstart[it->u + 1];
+			++m_rowstart[it->v + 1];
+		}
+		for(size_t v = 0; v < N; ++v) m_rowstart[v + 1] += m_rowstart[v];
+		// edges are sorted, so every row gets its neighbors in order
+		vector<kb_index_t> pos(m_rowstart.begin(), m_rowstart.end() - 1);
+		for(vector<edge_t>::const_iterator it = m_E.begin(), end = m_E.end(); it != end; ++it) {
+			kb_index_t i = pos[it->u]++;
+			m_column[i] = it->v;
+			m_weight[i].weight = it->w;
+			i = pos[it->v]++;
+			m_column[i] = it->u;
+			m_weight[i].weight = it->w;
+		}
+	}
+
+	sym_csr_t DisambGraph::csr() const {
+		freeze();
+		sym_csr_t csr;
+		csr.n = m_kbv.size();
+		csr.rowstart = &m_rowstart[0];
+		if (m_column.size()) {
+			csr.column = &m_column[0];
+			csr.prop = &m_weight[0];
+		}
+		return csr;
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 	// Reset edge weights
 
 	void DisambGraph::reset_edge_weights() {
-		graph_traits<DisambG>::edge_iterator it, end;
-		tie(it, end) = edges(g);
-		for(;it != end; ++it)
-			put(edge_weight, g, *it, 1.0);
+		freeze();
+		for(vector<edge_t>::iterator it = m_E.begin(), end = m_E.end(); it != end; ++it)
+			it->w = 1.0;
+		std::fill(m_weight.begin(), m_weight.end(), kb_edge_t(1.0));
 	}
 
 	////////////////////////////////////////////////////////////////
 	// Global functions
 
-	void fill_disamb_synset_bfs(const string & src_str,
-								vector<CWord>::const_iterator s_it,
-								vector<CWord>::const_iterator s_end,
-								DisambGraph & dgraph) {
-
-		//bfs from src
-		std::vector<Kb::vertex_descriptor> parents;
-		Kb & kb = ukb::Kb::instance();
-		bool existP;
-		Kb::vertex_descriptor src, tgt;
+	// The paths from every synset to the synsets of the following words are
+	// computed at once (see Kb::bfs_multi and Kb::dijkstra_multi), and then
+	// added to the dgraph in the same order as if each synset had its own
+	// search.
 
-		tie(src, existP) = kb.get_vertex_by_name(src_str);
-		assert(existP);
+	typedef boost::unordered_map<Kb::vertex_descriptor, size_t> dgraph_srcmap_t;
 
-		kb.bfs(src, parents);
+	// sources are the synsets of every word but the last, and their targets
+	// the synsets of the following words
 
-		// insert src vertex in dgraph (fixes a bug)
-		dgraph.add_dgraph_vertex(src_str);
+	static void dgraph_sources(const CSentence & cs,
+							   vector<Kb::vertex_descriptor> & sources,
+							   vector<vector<Kb::vertex_descriptor> > & targets,
+							   dgraph_srcmap_t & srcMap) {
 
-		//fill disamb graph
-
-		for(;s_it != s_end; ++s_it) {
-			vector<string>::const_iterator tg_it = s_it->begin();
-			vector<string>::const_iterator tg_end = s_it->end();
-			for(;tg_it != tg_end; ++tg_it) {
-				tie(tgt, existP) = kb.get_vertex_by_name(*tg_it);
-				assert(existP);
-				dgraph.fill_graph(src, tgt, parents);
+		vector<CWord>::const_iterator cw_it = cs.ubegin();
+		vector<CWord>::const_iterator cw_end = cs.uend();
+		for(; cw_it != cw_end; ++cw_it) {
+			vector<CWord>::const_iterator next_it = cw_it + 1;
+			if (next_it == cw_end) break; // no following words
+			for(CWord::const_iterator sset_it = cw_it->begin(), sset_end = cw_it->end();
+				sset_it != sset_end; ++sset_it) {
+				dgraph_srcmap_t::iterator map_it;
+				bool insertedP;
+				tie(map_it, insertedP) = srcMap.insert(make_pair(sset_it->first, sources.size()));
+				if (insertedP) {
+					sources.push_back(sset_it->first);
+					targets.push_back(vector<Kb::vertex_descriptor>());
+				}
+				vector<Kb::vertex_descriptor> & T = targets[map_it->second];
+				for(vector<CWord>::const_iterator tw_it = next_it; tw_it != cw_end; ++tw_it) {
+					for(CWord::const_iterator tg_it = tw_it->begin(), tg_end = tw_it->end();
+						tg_it != tg_end; ++tg_it) {
+						T.push_back(tg_it->first);
+					}
+				}
 			}
 		}
-
 	}
 
-	void fill_disamb_synset_dijkstra(const string & src_str,
-									 vector<CWord>::const_iterator s_it,
-									 vector<CWord>::const_iterator s_end,
-									 DisambGraph & dgraph) {
-
-		std::vector<Kb::vertex_descriptor> parents;
-		Kb & kb = ukb::Kb::instance();
-		bool existP;
-		Kb::vertex_descriptor src, tgt;
-
-		tie(src, existP) = kb.get_vertex_by_name(src_str);
-		assert(existP);
-
-		kb.dijkstra(src, parents);
-
-		// insert src vertex in dgraph (fixes a bug)
-		dgraph.add_dgraph_vertex(src_str);
+	static void fill_dgraph_paths(const CSentence & cs,
+								  const vector<vector<Kb::vertex_descriptor> > & targets,
+								  dgraph_srcmap_t & srcMap,
+								  const kb_paths_t & paths,
+								  DisambGraph & dgraph) {
 
-		//fill disamb graph
+		// next path of each source
+		vector<size_t> path_k(targets.size());
+		for(size_t i = 0, k = 0; i < targets.size(); ++i) {
+			path_k[i] = k;
+			k += targets[i].size();
+		}
 
-		for(;s_it != s_end; ++s_it) {
-			vector<string>::const_iterator tg_it = s_it->begin();
-			vector<string>::const_iterator tg_end = s_it->end();
-			for(;tg_it != tg_end; ++tg_it) {
-				tie(tgt, existP) = kb.get_vertex_by_name(*tg_it);
-				assert(existP);
-				dgraph.fill_graph(src, tgt, parents);
+		vector<Kb::vertex_descriptor> path;
+		vector<CWord>::const_iterator cw_end = cs.uend();
+		for(vector<CWord>::const_iterator cw_it = cs.ubegin(); cw_it != cw_end; ++cw_it) {
+			vector<CWord>::const_iterator next_it = cw_it + 1;
+			for(CWord::const_iterator sset_it = cw_it->begin(), sset_end = cw_it->end();
+				sset_it != sset_end; ++sset_it) {
+				// insert src vertex in dgraph (fixes a bug)
+				dgraph.add_dgraph_vertex(sset_it->first);
+				if (next_it == cw_end) continue;
+				size_t & k = path_k[srcMap[sset_it->first]];
+				for(vector<CWord>::const_iterator tw_it = next_it; tw_it != cw_end; ++tw_it) {
+					for(size_t n = tw_it->size(); n; --n, ++k) {
+						if (paths.begin(k) == paths.end(k)) continue; // not reachable
+						path.assign(paths.begin(k), paths.end(k));
+						dgraph.fill_graph(path);
+					}
+				}
 			}
 		}
-
 	}
 
-
 	void build_dgraph_bfs(const CSentence &cs, DisambGraph & dgraph) {
 
-		vector<CWord>::const_iterator cw_it = cs.ubegin();
-		vector<CWord>::const_iterator cw_end = cs.uend();
+		vector<Kb::vertex_descriptor> sources;
+		vector<vector<Kb::vertex_descriptor> > targets;
+		dgraph_srcmap_t srcMap; // source -> index in sources
 
-		//if (cw_it == cw_end) return;
-		//cw_end--;
-		while(cw_it != cw_end) {
-			vector<string>::const_iterator sset_it = cw_it->begin();
-			vector<string>::const_iterator sset_end = cw_it->end();
-			++cw_it; // point to next word
-			for(;sset_it != sset_end; ++sset_it) {
-				//tie(src_v, existP) = kb.get_vertex_by_name(*sset_it);
-				//assert(existP);
-				fill_disamb_synset_bfs(*sset_it, cw_it, cw_end, dgraph);
-			}
-		}
+		dgraph_sources(cs, sources, targets, srcMap);
+		kb_paths_t paths;
+		Kb::instance().bfs_multi(sources, targets, paths);
+		fill_dgraph_paths(cs, targets, srcMap, paths, dgraph);
 	}
 
 	// fill dgraph with ppv ranks
@@ -261,104 +310,67 @@ namespace ukb {
 		// First, update kb's edge weights
 		ukb::Kb::instance().ppv_weights(ppv_ranks);
 
-		vector<CWord>::const_iterator cw_it = cs.ubegin();
-		vector<CWord>::const_iterator cw_end = cs.uend();
+		vector<Kb::vertex_descriptor> sources;
+		vector<vector<Kb::vertex_descriptor> > targets;
+		dgraph_srcmap_t srcMap; // source -> index in sources
 
-		//if (cw_it == cw_end) return;
-		//cw_end--;
-		while(cw_it != cw_end) {
-			vector<string>::const_iterator sset_it = cw_it->begin();
-			vector<string>::const_iterator sset_end = cw_it->end();
-			++cw_it; // point to next word
-			for(;sset_it != sset_end; ++sset_it) {
-				//tie(src_v, existP) = kb.get_vertex_by_name(*sset_it);
-				//assert(existP);
-				fill_disamb_synset_dijkstra(*sset_it, cw_it, cw_end, dgraph);
-			}
-		}
+		dgraph_sources(cs, sources, targets, srcMap);
+		kb_paths_t paths;
+		vector<dijkstra_workspace_t> ws(std::max(glVars::dGraph::threads, size_t(1)));
+		Kb::instance().dijkstra_multi(sources, targets, paths, ws);
+		fill_dgraph_paths(cs, targets, srcMap, paths, dgraph);
 	}
 
-	// dfs visitor (should be in kbgraph but ...)
-
-	// implements as dfs with max depth. Here is the main idea (taken form a mail
-	// in boost.users mailing list), due to David Abrahams:
-
-	// It should be pretty easy to see how to a different visitor adaptor, sort of
-	// like time_stamper, which increments a depth count when you discover a
-	// vertex and decrements when you finish it.
-
-	// Then you create a graph adaptor that refers to the depth count, and returns
-	// an empty range for out_edges when the depth reaches your limit.  This
-	// relies on knowing a lot about the structure of the DFS implementation, but
-	// after all, the library documents it, so it should be OK to take advantage
-	// of that.
-
-
-	class dfsa_visitor : public default_dfs_visitor {
-	public:
-		dfsa_visitor(Kb::vertex_descriptor s, const set<Kb::vertex_descriptor> & S, set<Kb::edge_descriptor> & E)
-			: m_s(s), m_S(S), m_E(E), m_P(list<Kb::edge_descriptor> ()), m_S_end(S.end()) {}
-
-		void discover_vertex(Kb::vertex_descriptor u, const dfsa<Kb::boost_graph_t>& ag) {
-			if (u == m_s) return;
-			if (m_S.find(u) == m_S_end) return; // if u not in S, return
-			m_E.insert(m_P.begin(), m_P.end()); // add path to m_E
-		}
+	// dfs version
+	//
+	// Every synset of the sentence is a source, and all of them are the
+	// targets (see Kb::dfs_multi).
 
-		void finish_vertex(Kb::vertex_descriptor u, const dfsa<Kb::boost_graph_t>& ag) {
-			if (u == m_s) return;
-			const_cast<dfsa<Kb::boost_graph_t>&>(ag).dec_depth(); // decrease depth
-			m_P.pop_back();
-		}
+	static void dgraph_dfs_edges(const CSentence & cs, kb_edges_t & edges) {
 
-		void tree_edge(Kb::edge_descriptor e, const dfsa<Kb::boost_graph_t> & ag) {
-			const_cast<dfsa<Kb::boost_graph_t>&>(ag).inc_depth(); // increase depth
-			m_P.push_back(e);
+		vector<Kb::vertex_descriptor> S;
+		for(vector<CWord>::const_iterator cw_it = cs.ubegin(), cw_end = cs.uend();
+			cw_it != cw_end; ++cw_it) {
+			for(CWord::const_iterator v_it = cw_it->begin(), v_end = cw_it->end();
+				v_it != v_end; ++v_it) {
+				S.push_back(v_it->first);
+			}
 		}
+		std::sort(S.begin(), S.end());
+		S.erase(std::unique(S.begin(), S.end()), S.end());
 
-	private:
-		Kb::vertex_descriptor m_s;                       // source vertex
-		const set<Kb::vertex_descriptor> & m_S;          // set of target synsets
-		set<Kb::edge_descriptor> & m_E;                  // the result set of edges
-		list<Kb::edge_descriptor> m_P;                   // path of DFS so far
-		set<Kb::vertex_descriptor>::const_iterator m_S_end;
-	};
-
+		vector<dfs_workspace_t> ws(std::max(glVars::dGraph::threads, size_t(1)));
+		Kb::instance().dfs_multi(S, S, glVars::dGraph::max_depth, edges, ws);
+	}
 
 	void build_dgraph_dfs_nocosenses(const CSentence &cs, DisambGraph & dgraph) {
-		set<Kb::vertex_descriptor> S;
-		Kb & kb = Kb::instance();
-		dfsa<Kb::boost_graph_t> ag(kb.graph(), glVars::dGraph::max_depth);
-		vector<set<Kb::vertex_descriptor> > coSenses; // coSenses of each word in sentence
 
-		// Init S with all target synsets
+		vector<set<Kb::vertex_descriptor> > coSenses; // coSenses of each word in sentence
 		for(vector<CWord>::const_iterator cw_it = cs.ubegin(), cw_end = cs.uend();
 			cw_it != cw_end; ++cw_it) {
 			coSenses.push_back(set<Kb::vertex_descriptor>());
 			set<Kb::vertex_descriptor> & coS = coSenses.back();
-			for(vector<pair<Kb::vertex_descriptor, float> >::const_iterator v_it = cw_it->V_vector().begin(),
-					v_end = cw_it->V_vector().end();
+			for(CWord::const_iterator v_it = cw_it->begin(), v_end = cw_it->end();
 				v_it != v_end; ++v_it) {
-				S.insert((*v_it).first);
-				coS.insert((*v_it).first);
+				coS.insert(v_it->first);
 			}
 		}
 
-		std::vector<default_color_type> colors(kb.size());
-		typedef color_traits<default_color_type> Color;
+		kb_edges_t edges;
+		dgraph_dfs_edges(cs, edges);
+
+		// the edges of all the sources, once and ordered by index
+		vector<pair<kb_index_t, size_t> > idx;
+		for(size_t i = 0; i < edges.E.size(); ++i) idx.push_back(make_pair(edges.E[i], i));
+		std::sort(idx.begin(), idx.end());
 
-		set<Kb::edge_descriptor> subg;
-		for(set<Kb::vertex_descriptor>::iterator it = S.begin(), end = S.end(); it != end; ++it) { // better to start at any S (not just TW_S)
-			fill(colors.begin(), colors.end(), Color::white());
-			dfsa_visitor vis(*it, S, subg);
-			depth_first_visit(ag, *it, vis, &colors[0]);
-		}
 		// Now filter edges and discard (u,v) if they are coSenses
-		set<Kb::edge_descriptor> filtered_subg;
-		for(set<Kb::edge_descriptor>::iterator it = subg.begin(), end = subg.end();
-			it != end; ++it) {
-			Kb::vertex_descriptor u = kb.edge_source(*it);
-			Kb::vertex_descriptor v = kb.edge_target(*it);
+		kb_edges_t filtered_subg;
+		for(size_t k = 0; k < idx.size(); ++k) {
+			if (k && idx[k - 1].first == idx[k].first) continue;
+			size_t i = idx[k].second;
+			Kb::vertex_descriptor u = edges.U[i];
+			Kb::vertex_descriptor v = edges.V[i];
 			bool ok = true;
 			for(vector<set<Kb::vertex_descriptor> >::iterator coit = coSenses.begin(), coend = coSenses.end();
 				coit != coend; ++coit) {
@@ -367,56 +379,40 @@ namespace ukb {
 					break;
 				}
 			}
-			if (ok) filtered_subg.insert(*it);
+			if (!ok) continue;
+			filtered_subg.E.push_back(edges.E[i]);
+			filtered_subg.U.push_back(u);
+			filtered_subg.V.push_back(v);
 		}
+		filtered_subg.offset.push_back(filtered_subg.E.size());
 		// fill the disambGraph with new edges
-		dgraph.fill_graph(filtered_subg);
+		dgraph.fill_graph(filtered_subg, 0);
 	}
 
 	void build_dgraph_dfs(const CSentence &cs, DisambGraph & dgraph) {
-		set<Kb::vertex_descriptor> S;
-		Kb & kb = Kb::instance();
-		dfsa<Kb::boost_graph_t> ag(kb.graph(), glVars::dGraph::max_depth);
-
-		// Init S with all target synsets
-		for(vector<CWord>::const_iterator cw_it = cs.ubegin(), cw_end = cs.uend();
-			cw_it != cw_end; ++cw_it) {
-			for(vector<pair<Kb::vertex_descriptor, float> >::const_iterator v_it = cw_it->V_vector().begin(),
-					v_end = cw_it->V_vector().end();
-				v_it != v_end; ++v_it) {
-				S.insert((*v_it).first);
-			}
-		}
 
-		std::vector<default_color_type> colors(kb.size());
-		typedef color_traits<default_color_type> Color;
-
-		for(set<Kb::vertex_descriptor>::iterator it = S.begin(), end = S.end(); it != end; ++it) {
-			fill(colors.begin(), colors.end(), Color::white());
-			set<Kb::edge_descriptor> subg;
-			dfsa_visitor vis(*it, S, subg);
-			depth_first_visit(ag, *it, vis, &colors[0]);
-			// Now  populate disambGraph with edges in subg
-			dgraph.fill_graph(subg);
+		kb_edges_t edges;
+		dgraph_dfs_edges(cs, edges);
+		for(size_t k = 0; k < edges.size(); ++k) {
+			// Now  populate disambGraph with edges of source k
+			dgraph.fill_graph(edges, k);
 		}
 	}
 
 	// Convert a pv vector of Kb::vertex_descriptor to the equivalent for Dis_vertex_t
 
 	size_t pv_to_dgraph(DisambGraph & dgraph,
-						const vector<float> & pv,
+						const sparse_vector_t & pv,
 						vector<float> & pv_dgraph) {
 
 		Dis_vertex_t u;
 		bool P;
 		size_t k = 0;
-		Kb & kb = ukb::Kb::instance();
-		for(size_t i = 0, end = pv.size(); i != end; ++i) {
-			if (pv[i] == 0.0) continue;
-			tie(u, P) = dgraph.get_vertex_by_name(kb.get_vertex_name(i));
+		for(sparse_vector_t::const_iterator it = pv.begin(), end = pv.end(); it != end; ++it) {
+			tie(u, P) = dgraph.get_vertex_by_kb_vertex(it->first);
 			if (!P) continue;
 			++k;
-			pv_dgraph[u] = pv[i];
+			pv_dgraph[u] = it->second;
 		}
 		return k;
 	}
@@ -430,7 +426,7 @@ namespace ukb {
 
 		if (!cs.has_tgtwords()) return false; // no target words
 
-		vector<float> pv;
+		sparse_vector_t pv;
 		size_t  pv_m = pv_from_cs_onlyC(cs, pv, exclude_word_it);
 		if (!pv_m) return false;
 
@@ -477,7 +473,9 @@ namespace ukb {
 			vector<float>(N, 0.0).swap(ranks); // Initialize rank vector
 		}
 
-		prank::init_degree(dgraph.graph(), &ranks[0]);
+		for(size_t v = 0; v < N; ++v) {
+			ranks[v] = dgraph.degree(v);
+		}
 		return true;
 	}
 
@@ -514,18 +512,12 @@ namespace ukb {
 
 		for(; cw_it != cw_end; ++cw_it) {
 			o << cw_it->word() << "{";
-			vector<string>::iterator syn_it = cw_it->begin();
-			vector<string>::iterator syn_end = cw_it->end();
-			if (syn_it != syn_end) {
-				--syn_end;
-				for(; syn_it != syn_end; ++syn_it) {
-					tie(v,P) = dgraph.get_vertex_by_name(*syn_it);
-					assert(P);
-					o << *syn_it << " ,";
-				}
-				tie(v,P) = dgraph.get_vertex_by_name(*syn_end);
+			size_t n = cw_it->size();
+			for(size_t i = 0; i < n; ++i) {
+				tie(v,P) = dgraph.get_vertex_by_kb_vertex(cw_it->vertex(i));
 				assert(P);
-				o << *syn_end;
+				o << cw_it->syn(i);
+				if (i + 1 < n) o << " ,";
 			}
 			o << "}" << endl;
 		}
@@ -540,43 +532,37 @@ namespace ukb {
 	void DisambGraph::pageRank_ppv(const vector<float> & ppv_map,
 								   vector<float> & ranks) {
 
-		typedef graph_traits<DisambG>::edge_descriptor edge_descriptor;
-		property_map<DisambGraph::boost_graph_t, edge_weight_t>::type weight_map = get(edge_weight, g);
-		prank::constant_property_map <edge_descriptor, float> cte_weight(1.0); // always return 1
-
-		size_t N = num_vertices(g);
-		size_t N_no_isolated;
-		vector<float> out_coefs(N, 0.0);
+		sym_csr_t g = csr();
+		if (!glVars::prank::use_weight) g.prop = NULL;
 
+		size_t N = g.n;
 		if (N == ranks.size()) {
 			std::fill(ranks.begin(), ranks.end(), 0.0);
 		} else {
 			vector<float>(N, 0.0).swap(ranks); // Initialize rank vector
 		}
+		if (!N) return;
 		vector<float> rank_tmp(N, 0.0);    // auxiliary rank vector
 
-		if (glVars::prank::use_weight) {
-			N_no_isolated = prank::init_out_coefs(g,  &out_coefs[0], weight_map);
-		} else {
-			N_no_isolated = prank::init_out_coefs(g, &out_coefs[0], cte_weight);
-		}
-
-		if (glVars::prank::use_weight) {
-			prank::do_pageRank(g, N_no_isolated, &ppv_map[0],
-							   weight_map, &ranks[0], &rank_tmp[0],
-							   glVars::prank::num_iterations,
-							   glVars::prank::threshold,
-							   glVars::prank::damping,
-							   out_coefs);
-		} else {
-			prank::do_pageRank(g, N_no_isolated, &ppv_map[0],
-							   cte_weight, &ranks[0], &rank_tmp[0],
-							   glVars::prank::num_iterations,
-							   glVars::prank::threshold,
-							   glVars::prank::damping,
-							   out_coefs);
+		// out coefficients (see prank::init_out_coefs). There are no
+		// dangling vertices in undirected graphs.
+		size_t N_no_isolated = 0;
+		vector<float> out_coefs(N, -1.0);
+		for(size_t v = 0; v < N; ++v) {
+			if (g.rowstart[v] == g.rowstart[v + 1]) continue;
+			float total_w = 0.0;
+			for(size_t i = g.rowstart[v]; i < g.rowstart[v + 1]; ++i)
+				total_w += g.prop ? g.prop[i].weight : 1.0f;
+			out_coefs[v] = 1.0f / total_w;
+			N_no_isolated++;
 		}
 
+		// dgraphs are small, so use just one thread
+		prank::sym_csr_sweep sweep(g, &ppv_map[0], out_coefs, glVars::prank::damping);
+		prank::power_method(sweep, N_no_isolated, &ranks[0], &rank_tmp[0],
+							glVars::prank::num_iterations,
+							glVars::prank::threshold,
+							1);
 	}
 
 
@@ -597,97 +583,48 @@ namespace ukb {
 			*it *= coef;
 	}
 
-	template<typename HProp, typename AProp>
-	void hits_update_auth (DisambG & g,
-						   vector<Dis_vertex_t>::iterator vit,
-						   vector<Dis_vertex_t>::iterator end,
-						   HProp hProp, AProp aProp) {
-		// I operation
-		// x^{p} = \sum_{q:(q,p) \in E} w_{qp}*y^{q}
-
-		//typename graph_traits<G>::vertex_iterator vit, end;
-		//tie(vit, end) =  vertices(g);
-		for(; vit != end; ++vit) {
-			float auth = 0;
-			graph_traits<DisambG>::in_edge_iterator e, e_end;
-			tie(e, e_end) = in_edges(*vit, g);
-			for(; e != e_end; ++e) {
-				auth+= get(hProp, source(*e, g)) * get(edge_weight, g, *e);
-			}
-			put(aProp, *vit, auth);
-		}
-	}
+	// The graph is undirected, so the in-edges and out-edges of a vertex are
+	// the same: the authority of p is \sum_{q adjacent to p} w_{qp}*y^{q},
+	// and its hub value \sum_{q adjacent to p} w_{pq}*x^{q}
 
-	template<typename HProp, typename AProp>
-	void hits_update_hub (DisambG & g,
-						  vector<Dis_vertex_t>::iterator vit,
-						  vector<Dis_vertex_t>::iterator end,
-						  HProp hProp, AProp aProp) {
-		// O operation
-		// y^{p} = \sum_{q:(p,q) \in E} w_{pq}*x^{q}
-
-		//typename graph_traits<G>::vertex_iterator vit, end;
-		//tie(vit, end) =  vertices(g);
-
-		for(; vit != end; ++vit) {
-			float hub = 0.0;
-			graph_traits<DisambG>::out_edge_iterator e, e_end;
-			tie(e, e_end) = out_edges(*vit, g);
-			for(; e != e_end; ++e) {
-				hub+= get(aProp, target(*e, g)) * get(edge_weight, g, *e);
+	static void hits_update(const sym_csr_t & g,
+							const vector<Dis_vertex_t> & V,
+							const vector<float> & from,
+							vector<float> & to) {
+		for(vector<Dis_vertex_t>::const_iterator vit = V.begin(), end = V.end(); vit != end; ++vit) {
+			float r = 0.0;
+			for(size_t i = g.rowstart[*vit]; i < g.rowstart[*vit + 1]; ++i) {
+				r += from[g.column[i]] * g.prop[i].weight;
 			}
-			put(hProp, *vit, hub);
+			to[*vit] = r;
 		}
 	}
 
-	template<typename HProp, typename AProp>
-	void hits_init_ranks(DisambG & g,
-						 vector<Dis_vertex_t>::iterator vit,
-						 vector<Dis_vertex_t>::iterator end,
-						 HProp hProp, AProp aProp, size_t n) {
+	void hits(const DisambGraph & dgraph, vector<float> & rank) {
 
-		assert(n);
-		float init_v = sqrt((float)n)/n;
+		sym_csr_t g = dgraph.csr();
+		vector<float> aRank(g.n, 0.0f);
+		vector<float> hRank(g.n, 0.0f);
 
-		//graph_traits<DisambG>::vertex_iterator vit, end;
-		//tie(vit, end) =  vertices(g);
-		for(; vit != end; ++vit) {
-			put(aProp, *vit, init_v);
-			put(hProp, *vit, init_v);
+		// connected vertices
+		vector<Dis_vertex_t> V;
+		for(size_t v = 0; v < g.n; ++v) {
+			if (g.rowstart[v] != g.rowstart[v + 1]) V.push_back(v);
 		}
-	}
 
-	void hits_iterate(DisambG & g,
-					  vector<Dis_vertex_t>::iterator vit,
-					  vector<Dis_vertex_t>::iterator end,
-					  vector<float> & hProp,
-					  vector<float> & aProp,
-					  size_t iterations) {
-
-		hits_init_ranks(g, vit, end, &hProp[0], &aProp[0], num_connected_vertices(g));
-		for(size_t i = 0; i<iterations; ++i) {
-			hits_update_auth(g, vit, end, &hProp[0], &aProp[0]);
-			hits_update_hub(g, vit, end, &hProp[0], &aProp[0]);
-			hits_norm(aProp);
-			hits_norm(hProp);
+		if (V.size()) {
+			float init_v = sqrt((float)V.size())/V.size();
+			for(vector<Dis_vertex_t>::const_iterator vit = V.begin(), end = V.end(); vit != end; ++vit) {
+				aRank[*vit] = init_v;
+				hRank[*vit] = init_v;
+			}
+			for(size_t i = 0; i < 50; ++i) { // 50 iterations
+				hits_update(g, V, hRank, aRank);
+				hits_update(g, V, aRank, hRank);
+				hits_norm(aRank);
+				hits_norm(hRank);
+			}
 		}
-	}
-
-	void hits(DisambG & g, vector<float> & rank) {
-
-		vector<float> aRank(num_vertices(g), 0.0f);
-		vector<float> hRank(num_vertices(g), 0.0f);
-
-		vector<Dis_vertex_t> V(num_connected_vertices(g));
-
-		graph_traits<DisambG>::vertex_iterator vIt, vItEnd;
-		tie(vIt, vItEnd) = vertices(g);
-		ukb::copy_if(vIt, vItEnd, V.begin(), vertex_is_connected<DisambG>(g));
-
-		hits_iterate(g, V.begin(), V.end(), hRank, aRank, 50); // 50 iterations
-
-		//vector<Dis_vertex_t>::const_iterator it = V.begin();
-		//vector<Dis_vertex_t>::const_iterator end = V.end();
 		rank.swap(hRank);
 	}
 
@@ -697,39 +634,11 @@ namespace ukb {
 
 	const size_t magic_id = 0x070517;
 
-	// read
-
-	Dis_vertex_t read_vertex_from_stream(ifstream & is,
-										 DisambG & g) {
-
-		string name;
-
-		read_atom_from_stream(is, name);
-		Dis_vertex_t v = add_vertex(g);
-		put(vertex_name, g, v, name);
-		//  put(vertex_wname, g, v, wname);
-		return v;
-	}
-
-	Dis_edge_t read_edge_from_stream(ifstream & is,
-									 DisambG & g) {
-
-		size_t sIdx;
-		size_t tIdx;
-		float freq;
-		//size_t source;
-		bool insertedP;
-		Dis_edge_t e;
+	// The format is that of the old (adjacency list) graphs: a map from
+	// vertex names to vertices, the vertex names and the edges as (target,
+	// source, weight) triplets.
 
-		read_atom_from_stream(is, tIdx);
-		read_atom_from_stream(is, sIdx);
-		read_atom_from_stream(is, freq);
-		tie(e, insertedP) = add_edge(sIdx, tIdx, g);
-		assert(insertedP);
-		put(edge_weight, g, e, freq);
-
-		return e;
-	}
+	// read
 
 	void DisambGraph::read_from_stream (std::ifstream & is) {
 
@@ -737,6 +646,7 @@ namespace ukb {
 		size_t edge_n;
 		size_t i;
 		size_t id;
+		boost::unordered_map<string, size_t> synsetMap;
 
 		read_atom_from_stream(is, id);
 		if(id != magic_id) {
@@ -748,9 +658,18 @@ namespace ukb {
 			cerr << "Error: invalid id after reading maps" << endl;
 		}
 
+		Kb & kb = Kb::instance();
 		read_atom_from_stream(is, vertex_n);
 		for(i=0; i<vertex_n; ++i) {
-			read_vertex_from_stream(is, g);
+			string name;
+			read_atom_from_stream(is, name);
+			Kb::vertex_descriptor u;
+			bool P;
+			tie(u, P) = kb.get_vertex_by_name(name);
+			if (!P)
+				throw runtime_error("DisambGraph::read_from_stream: " + name + " is not in the KB");
+			if (add_dgraph_vertex(u) != i)
+				throw runtime_error("DisambGraph::read_from_stream: repeated vertex " + name);
 		}
 
 		read_atom_from_stream(is, id);
@@ -760,19 +679,21 @@ namespace ukb {
 
 		read_atom_from_stream(is, edge_n);
 		for(i=0; i<edge_n; ++i) {
-			read_edge_from_stream(is, g);
+			size_t sIdx;
+			size_t tIdx;
+			float freq;
+			read_atom_from_stream(is, tIdx);
+			read_atom_from_stream(is, sIdx);
+			read_atom_from_stream(is, freq);
+			if (sIdx >= vertex_n || tIdx >= vertex_n)
+				throw runtime_error("DisambGraph::read_from_stream: invalid edge");
+			add_dgraph_edge(sIdx, tIdx, freq);
 		}
 
 		read_atom_from_stream(is, id);
 		if(id != magic_id) {
 			cerr << "Error: invalid id after reading edges" << endl;
 		}
-
-		//   graph_traits<DisambG>::vertex_iterator v_it, v_end;
-		//   tie(v_it, v_end) = vertices(g);
-		//   for(; v_it != v_end; ++v_it) {
-		//     w2syns[get(vertex_name, g, *v_it)] = *v_it;
-		//   }
 	}
 
 	void DisambGraph::read_from_binfile (const string & fname) {
@@ -786,31 +707,17 @@ namespace ukb {
 
 	// write
 
-	ofstream & write_vertex_to_stream(ofstream & o,
-									  const DisambG & g,
-									  const Dis_vertex_t & v) {
-		string name;
-
-		write_atom_to_stream(o, get(vertex_name, g, v));
-		return o;
-	}
-
-	ofstream & write_edge_to_stream(ofstream & o,
-									const DisambG & g,
-									const Dis_edge_t & e) {
-
-		size_t uIdx = get(vertex_index, g, source(e,g));
-		size_t vIdx = get(vertex_index, g, target(e,g));
-		float freq = get(edge_weight, g, e);
-
-		o.write(reinterpret_cast<const char *>(&vIdx), sizeof(vIdx));
-		o.write(reinterpret_cast<const char *>(&uIdx), sizeof(uIdx));
-		o.write(reinterpret_cast<const char *>(&freq), sizeof(freq));
+	ofstream & DisambGraph::write_to_stream(ofstream & o) const {
 
-		return o;
-	}
+		freeze();
 
-	ofstream & DisambGraph::write_to_stream(ofstream & o) const {
+		size_t vertex_n = m_kbv.size();
+		vector<string> names(vertex_n);
+		boost::unordered_map<string, size_t> synsetMap;
+		for(size_t v = 0; v < vertex_n; ++v) {
+			names[v] = get_vertex_name(v);
+			synsetMap[names[v]] = v;
+		}
 
 		// First write maps
 
@@ -820,25 +727,23 @@ namespace ukb {
 
 		// Then the graph
 
-		size_t vertex_n = num_vertices(g);
-
 		write_atom_to_stream(o, vertex_n);
-		graph_traits<DisambG>::vertex_iterator v_it, v_end;
-		tie(v_it, v_end) = vertices(g);
-		for(; v_it != v_end; ++v_it) {
-			write_vertex_to_stream(o, g, *v_it);
+		for(size_t v = 0; v < vertex_n; ++v) {
+			write_atom_to_stream(o, names[v]);
 		}
 
 		write_atom_to_stream(o, magic_id);
 
-		size_t edge_n = num_edges(g);
+		size_t edge_n = m_E.size();
 
 		write_atom_to_stream(o, edge_n);
-		graph_traits<DisambG>::edge_iterator e_it, e_end;
-
-		tie(e_it, e_end) = edges(g);
-		for(; e_it != e_end; ++e_it) {
-			write_edge_to_stream(o, g, *e_it);
+		for(vector<edge_t>::const_iterator it = m_E.begin(), end = m_E.end(); it != end; ++it) {
+			size_t uIdx = it->u;
+			size_t vIdx = it->v;
+			float freq = it->w;
+			o.write(reinterpret_cast<const char *>(&vIdx), sizeof(vIdx));
+			o.write(reinterpret_cast<const char *>(&uIdx), sizeof(uIdx));
+			o.write(reinterpret_cast<const char *>(&freq), sizeof(freq));
 		}
 		return o;
 	}
@@ -856,61 +761,28 @@ namespace ukb {
 	//////////////////////////////////////////////////////7
 	// graphviz
 
+	// Only the vertices with some edge are written.
 
-	class myV_writer {
-	public:
-		myV_writer(const DisambG & g_) : g(g_) {};
-		void operator()(std::ostream& out, const Dis_vertex_t & v) const {
-			out << " [label=\"" << get(vertex_name, g, v) << "\"]";
-		}
-		const DisambG & g;
-	};
-
-	class myE_writer {
-	public:
-		myE_writer(const DisambG & g_) : g(g_) {};
-		void operator()(std::ostream& out, const Dis_edge_t & e) const {
-			out << " [weight=\"" << get(edge_weight, g, e) << "\"]";
-		}
-		const DisambG & g;
-	};
-
-
-	//
-	// Predicate to make a filtered graph
-	//
-
-	template<class G>
-	struct connected_vertex {
-		G * g;
-		connected_vertex( G & g_) : g(&g_) {};
-		connected_vertex( ) {};
-		typedef typename boost::graph_traits<G>::vertex_descriptor vertex_descriptor;
-		bool operator ()(vertex_descriptor u) const {
-			return out_degree(u, *g) || in_degree(u, *g);
-		}
-	};
-
-
-	void write_dgraph_graphviz(const string & fname, DisambG & g) {
+	void write_dgraph_graphviz(const string & fname, const DisambGraph & dgraph) {
 
 		ofstream fo(fname.c_str(), ofstream::out);
 		if (!fo) {
 			cerr << "Can't create " << fname << endl;
 			exit(-1);
 		}
-		connected_vertex<DisambG> vp(g);
-		//   boost::filtered_graph<DisambG, keep_all, keep_all >
-		//     fg(g, keep_all(), keep_all());
 
-		boost::filtered_graph<DisambG, keep_all, connected_vertex<DisambG> >
-			fg(g, keep_all(), vp);
-
-		boost::write_graphviz(fo,
-							  fg,
-							  //boost::default_writer(),
-							  //make_my_writer(get(vertex_name, g), "label"),
-							  make_my_writer(get(vertex_name, g), "label"),
-							  make_my_writer(get(edge_weight, g), "weight"));
+		sym_csr_t g = dgraph.csr();
+		fo << "graph G {" << endl;
+		for(size_t v = 0; v < g.n; ++v) {
+			if (g.rowstart[v] == g.rowstart[v + 1]) continue;
+			fo << v << "[label=\"" << dgraph.get_vertex_name(v) << "\"];" << endl;
+		}
+		for(size_t v = 0; v < g.n; ++v) {
+			for(size_t i = g.rowstart[v]; i < g.rowstart[v + 1]; ++i) {
+				if (g.column[i] < v) continue; // write every edge once
+				fo << v << "--" << g.column[i] << " [weight=\"" << g.prop[i].weight << "\"];" << endl;
+			}
+		}
+		fo << "}" << endl;
 	}
 }
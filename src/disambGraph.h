@@ -6,66 +6,59 @@
 #include "kbGraph.h"
 #include "csentence.h"
 
-#include <boost/graph/adjacency_list.hpp>
-
-using boost::adjacency_list;
-using boost::graph_traits;
-using boost::property;
-using boost::property_map;
-using boost::vertex_name_t;
-using boost::vertex_name;
-using boost::edge_weight_t;
-using boost::edge_weight;
-
-enum edge_freq_t    { edge_freq };
-
-namespace boost {
-	BOOST_INSTALL_PROPERTY(edge, freq);
-}
-
 namespace ukb {
 
-	typedef adjacency_list <
-		boost::listS,
-		boost::vecS,
-		boost::undirectedS,
-		//  boost::bidirectionalS,
-		property<vertex_name_t, std::string>,          // the synset name
-		property<edge_weight_t, float>
-		> DisambG;
+	// Disambiguation graphs.
+	//
+	// The vertices are KB vertices, numbered (local ids) in the order they
+	// are added to the graph. Edges are undirected, and adding an edge which
+	// is already there increases its weight.
+	//
+	// New edges are just appended to a flat vector. The graph is frozen into
+	// a symmetric CSR (see sym_csr_t) the first time it is read, sorting the
+	// edges and merging the repeated ones, so that the PageRank kernels of the
+	// KB run on it. Edges may still be added afterwards, and the CSR is then
+	// rebuilt when needed.
 
-	typedef graph_traits<DisambG>::vertex_descriptor Dis_vertex_t;
-	typedef graph_traits<DisambG>::edge_descriptor Dis_edge_t;
-	typedef graph_traits<DisambG >::vertices_size_type Dis_vertex_size_t;
+	typedef kb_index_t Dis_vertex_t;
 
 	class DisambGraph {
 
 	public:
 
-		typedef DisambG boost_graph_t; // the underlying graph type
-		typedef graph_traits<DisambG>::vertex_descriptor vertex_t;
-		typedef graph_traits<DisambG>::edge_descriptor edge_t;
-		typedef graph_traits<DisambG >::vertices_size_type vertex_size_t;
-
+		typedef Dis_vertex_t vertex_t;
 
 		DisambGraph();
 
-		size_t size() const {return num_vertices(g); }
+		size_t size() const {return m_kbv.size(); }
 		std::pair<Dis_vertex_t, bool> get_vertex_by_name(const std::string & str) const;
+		std::pair<Dis_vertex_t, bool> get_vertex_by_kb_vertex(Kb::vertex_descriptor u) const;
+
+		Kb::vertex_descriptor kb_vertex(Dis_vertex_t v) const { return m_kbv[v]; }
+		std::string get_vertex_name(Dis_vertex_t v) const { return Kb::instance().get_vertex_name(m_kbv[v]); }
 
 		void fill_graph(Kb::vertex_descriptor src,
 						Kb::vertex_descriptor tgt,
 						const std::vector<Kb::vertex_descriptor> & parents);
 
-		void fill_graph(const std::set<Kb::edge_descriptor> & E);
+		// add the path P (given from target to source)
+		void fill_graph(const std::vector<Kb::vertex_descriptor> & P);
 
-		Dis_vertex_t add_dgraph_vertex(const std::string & str);
+		// add the edges of the k-th source of E
+		void fill_graph(const kb_edges_t & E, size_t k);
+
+		Dis_vertex_t add_dgraph_vertex(Kb::vertex_descriptor u);
 		void add_dgraph_edge(Dis_vertex_t u, Dis_vertex_t v, float w = 1.0);
 
 		void write_to_binfile (const std::string & fName) const;
 		void read_from_binfile (const std::string & fName);
 
-		DisambG & graph() {return g;}
+		// The (frozen) graph. Each edge appears twice, once in the row of
+		// each of its vertices, and neighbors are sorted.
+		sym_csr_t csr() const;
+		size_t num_edges() const { freeze(); return m_column.size() / 2; }
+		size_t degree(Dis_vertex_t v) const { freeze(); return m_rowstart[v + 1] - m_rowstart[v]; }
+
 		void prune() {}
 		void reset_edge_weights();
 
@@ -80,11 +73,29 @@ namespace ukb {
 		void read_from_stream (std::ifstream & is);
 		std::ofstream & write_to_stream(std::ofstream & o) const;
 
-		//typedef std::vector<Dis_vertex_t> VertexV;
-		//std::map<std::string, VertexV> w2syns;
-		boost::unordered_map<std::string, Dis_vertex_t> synsetMap;
+		void freeze() const;
+
+		struct edge_t {
+			kb_index_t u;   // u < v
+			kb_index_t v;
+			float w;
+
+			edge_t(kb_index_t u_, kb_index_t v_, float w_) : u(u_), v(v_), w(w_) {}
+			bool operator<(const edge_t & o) const { return u < o.u || (u == o.u && v < o.v); }
+		};
+
+		std::vector<Kb::vertex_descriptor> m_kbv;                                 // dgraph vertex -> KB vertex
+		boost::unordered_map<Kb::vertex_descriptor, Dis_vertex_t> kbMap;         // KB vertex -> dgraph vertex
+
+		// edges. The first m_merged ones are sorted, have no repetitions and
+		// are those of the CSR.
+		mutable std::vector<edge_t> m_E;
+		mutable size_t m_merged;
 
-		DisambG g;
+		// CSR
+		mutable std::vector<kb_index_t> m_rowstart;
+		mutable std::vector<kb_index_t> m_column;
+		mutable std::vector<kb_edge_t> m_weight;
 	};
 
 	//////////////////////////////////////////////////////////////7
@@ -112,7 +123,7 @@ namespace ukb {
 
 	// HITS ranking
 
-	void hits(DisambG & g, std::vector<float> & ranks);
+	void hits(const DisambGraph & dgraph, std::vector<float> & ranks);
 
 	// PageRank ranking
 
@@ -141,18 +152,6 @@ namespace ukb {
 
 	// export to dot format (graphviz)
 
-	void write_dgraph_graphviz(const std::string & fname, DisambG & g);
-
-	// streaming functions for disambG type graphs
-	Dis_vertex_t read_vertex_from_stream(std::ifstream & is,
-										 DisambG & g);
-	Dis_edge_t read_edge_from_stream(std::ifstream & is,
-									 DisambG & g);
-	std::ofstream & write_vertex_to_stream(std::ofstream & o,
-										   const DisambG & g,
-										   const Dis_vertex_t & v);
-	std::ofstream & write_edge_to_stream(std::ofstream & o,
-										 const DisambG & g,
-										 const Dis_edge_t & e);
+	void write_dgraph_graphviz(const std::string & fname, const DisambGraph & dgraph);
 }
 #endif
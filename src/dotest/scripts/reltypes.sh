@@ -0,0 +1,21 @@
+#!/bin/bash
+
+if [ $# -gt 0 ] ; then
+    ver=$1
+else
+    ver=$(../../compile_kb --version)
+fi
+
+echo $ver
+rootdir=../results/v${ver}
+dir=${rootdir}/reltypes
+install -d $dir
+graphSrc=../input/test_reltypes.txt
+# relation types must survive a compile (-r) and dump (-t) round trip
+../../compile_kb -r -o $dir/reltypes.bin ${graphSrc}
+../../compile_kb -t $dir/reltypes.bin | sort > $dir/reltypes.txt
+../../compile_kb -r -o $dir/reltypes2.bin $dir/reltypes.txt
+../../compile_kb -t $dir/reltypes2.bin | sort > $dir/reltypes2.txt
+../../compile_kb --dump $dir/reltypes.bin > $dir/reltypes_dump.txt
+sort ${graphSrc} | cmp -s - $dir/reltypes.txt || echo "reltypes: dump differs from ${graphSrc}"
+cmp -s $dir/reltypes.txt $dir/reltypes2.txt || echo "reltypes: round trip differs"
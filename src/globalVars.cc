@@ -64,6 +64,8 @@ namespace ukb {
 			float damping = 0.85; // damping factor
 			PrankImpl impl = pm; // default is power method
 			float nibble_epsilon = 0.0000005;
+			size_t threads = 1;
+			WeightQuant weight_quant = wq_none;
 		}
 
 		namespace input {
@@ -87,11 +89,13 @@ namespace ukb {
 			bool keep_directed = true;
 			bool v1_kb = true;
 			bool filter_src = true;
+			size_t threads = 1;
 		}
 
 		namespace dGraph {
 			int max_depth = 6;
 			bool stopCosenses = false;
+			size_t threads = 1;
 		}
 
 		// walk and print
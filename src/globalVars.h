@@ -45,6 +45,13 @@ namespace ukb {
 			nibble       // PageRank-Nibble approximation
 		};
 
+		// Quantization of the edge weights used by the power method
+		enum WeightQuant {
+			wq_none,     // 32 bit floats, default
+			wq_fp16,     // IEEE half precision
+			wq_log16     // 16 bit log-scale codebook
+		};
+
 		extern std::vector<std::string> rel_source;
 
 		namespace csentence {
@@ -75,6 +82,8 @@ namespace ukb {
 			extern float damping;
 			extern PrankImpl impl; // default is power method
 			extern float nibble_epsilon;
+			extern size_t threads; // number of threads for the power method
+			extern WeightQuant weight_quant; // edge weights in the power method
 		}
 
 		// Input
@@ -102,11 +111,13 @@ namespace ukb {
 			extern bool v1_kb; // Wether input has v1 format
 			extern bool filter_src; // Wether input relations should be filtered by relation source
 			extern bool keep_directed; // Wether we will allow directed edges (default true)
+			extern size_t threads; // number of threads for reading text KBs
 		}
 
 		namespace dGraph {
 			extern int max_depth;
 			extern bool stopCosenses;
+			extern size_t threads; // number of threads for building dgraphs
 		}
 
 		RankAlg get_algEnum(const std::string & alg);
@@ -13,10 +13,16 @@
 #include <iterator>
 #include <algorithm>
 #include <ostream>
+#include <sstream>
+#include <cstring>
+#include <limits>
+
+#include <boost/shared_ptr.hpp>
 
 // Tokenizer
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/static_assert.hpp>
 
 // Stuff for generating random numbers
 
@@ -90,6 +96,23 @@ namespace ukb {
 		p_instance = tenp;
 	}
 
+	static bool is_mapped_binfile(const char *p, size_t n); // see below
+
+	// throw if a graph of this size does not fit into kb_index_t
+
+	static void check_kb_size(size_t vertex_n, size_t edge_n) {
+		size_t max_idx = std::numeric_limits<kb_index_t>::max();
+		if (vertex_n >= max_idx || edge_n >= max_idx)
+			throw runtime_error("KB too big for " + lexical_cast<string>(8 * sizeof(kb_index_t)) +
+								" bit indices (compile ukb with UKB_CSR64)");
+	}
+
+	// the edge weights of the graph are written and read as a float array
+	BOOST_STATIC_ASSERT(sizeof(kb_edge_t) == sizeof(float));
+
+	static Kb::boost_graph_t *build_kb_csr(const precsr_t & pre,
+										   vector<etype_t::value_type> & etypes); // see below
+
 	void Kb::create_from_binfile(const std::string & fname) {
 
 		if (p_instance) return;
@@ -98,11 +121,21 @@ namespace ukb {
 		if (!fname.size())
 			throw std::runtime_error(string("[E] loading KB: no KB name"));
 
-		ifstream fi(fname.c_str(), ifstream::binary|ifstream::in);
-		if (!fi)
+		std::auto_ptr<mmap_file> mf;
+		try {
+			mf.reset(new mmap_file(fname));
+		} catch (std::exception & e) {
 			throw std::runtime_error(string("[E] loading KB: can not open ") + fname);
-
-		tenp->read_from_stream(fi);
+		}
+		if (is_mapped_binfile(mf->data(), mf->size())) {
+			tenp->read_from_mapped(mf);
+		} else {
+			mf.reset();
+			ifstream fi(fname.c_str(), ifstream::binary|ifstream::in);
+			if (!fi)
+				throw std::runtime_error(string("[E] loading KB: can not open ") + fname);
+			tenp->read_from_stream(fi);
+		}
 		p_instance = tenp;
 	}
 
@@ -121,23 +154,16 @@ namespace ukb {
 			precsr16.insert_edge(ustr, vstr, get(edge_weight, oldg, *eit), get(edge_rtype, oldg, *eit));
 		}
 
-		boost_graph_t *new_g = new boost_graph_t(boost::edges_are_unsorted_multi_pass,
-												 precsr16.E.begin(), precsr16.E.end(),
-												 precsr16.eProp.begin(),
-												 precsr16.m_vsize);
-
-		tenp->m_g.reset(new_g);
-
-		BGL_FORALL_VERTICES(v, *(tenp->m_g), Kb::boost_graph_t) {
-			(*(tenp->m_g))[v].name = precsr16.vProp[v].name;
-		}
+		check_kb_size(precsr16.m_vsize, precsr16.m_esize);
+		vector<etype_t::value_type> etypes;
+		tenp->m_g.reset(build_kb_csr(precsr16, etypes));
+		tenp->set_etypes(etypes);
+		tenp->m_names.swap(precsr16.vNames);
 
 		tenp->m_vertexN = num_vertices(*(tenp->m_g));
 		tenp->m_edgeN = num_edges(*(tenp->m_g));
 		// relation sources
 		std::set<std::string>(kbg.relsSource).swap(tenp->m_relsSource);
-		// vertex map
-		tenp->m_synsetMap.swap(precsr16.m_vMap);
 		// relation types
 		tenp->m_rtypes.m_strtypes.swap(kbg.rtypes);
 		// Notes
@@ -224,7 +250,7 @@ namespace ukb {
 		vector<float> w;
 		vector<float> dist(m);
 		property_map<Kb::boost_graph_t, boost::vertex_index_t>::type indexmap = get(vertex_index, *m_g);
-		property_map<Kb::boost_graph_t, float edge_prop_t::*>::type wmap = get(&edge_prop_t::weight, *(me.m_g));
+		property_map<Kb::boost_graph_t, float kb_edge_t::*>::type wmap = get(&kb_edge_t::weight, *(me.m_g));
 
 		dijkstra_shortest_paths(*m_g,
 								src,
@@ -238,6 +264,465 @@ namespace ukb {
 		return true;
 	}
 
+	// Multi-source BFS (MS-BFS, see Then et al., "The More the Merrier:
+	// Efficient Multi-Source Graph Traversal", VLDB 2014).
+	//
+	// seen[v] and next[v] are bitmasks of the sources which have reached v,
+	// and of those which reach it at the level being built. The levels are
+	// kept, as sorted arrays of vertices with the bitmask of the sources
+	// reaching them, and the paths are then followed back from the targets
+	// (see msbfs_tree_t).
+
+	namespace {
+
+		typedef boost::uint64_t msbfs_mask_t;
+
+		struct msbfs_level_t {
+			vector<kb_index_t> V;
+			vector<msbfs_mask_t> M;
+
+			// sources of the batch which reach v at this level
+			msbfs_mask_t mask(kb_index_t v) const {
+				vector<kb_index_t>::const_iterator it = std::lower_bound(V.begin(), V.end(), v);
+				if (it == V.end() || *it != v) return 0;
+				return M[it - V.begin()];
+			}
+		};
+
+		// The BFS trees of the sources of a batch. Parents are those found by
+		// Kb::bfs, that is, by a FIFO queue: the parent of v is the first of
+		// its in-neighbors in the previous level to enter the queue. Vertices
+		// of a level enter the queue in the order of their parents, and then
+		// in the order of the out-edges of the parent. The in-edges of v are
+		// scanned once for all the sources reaching it at level l.
+
+		struct msbfs_tree_t {
+
+			msbfs_tree_t(const vector<msbfs_level_t> & levels_,
+						 const kb_index_t * rowstart_, const kb_index_t * column_,
+						 const kb_index_t * in_rowstart_, const kb_index_t * in_column_)
+				: levels(levels_), rowstart(rowstart_), column(column_),
+				  in_rowstart(in_rowstart_), in_column(in_column_) {}
+
+			// parent of v for source b, which reaches v at level l > 0
+			kb_index_t parent(kb_index_t v, size_t l, size_t b) {
+				boost::uint64_t key = (boost::uint64_t(l) << 38) | (boost::uint64_t(b) << 32) | v;
+				boost::unordered_map<boost::uint64_t, kb_index_t>::iterator it = pmemo.find(key);
+				if (it != pmemo.end()) return it->second;
+				std::pair<size_t, size_t> cand = candidates(v, l);
+				msbfs_mask_t bit = msbfs_mask_t(1) << b;
+				kb_index_t p = 0;
+				bool found = false;
+				for(size_t k = cand.first; k < cand.second; ++k) {
+					if (!(CM[k] & bit)) continue;
+					kb_index_t u = CV[k];
+					if (found && (u == p || !before(u, p, l - 1, b))) continue;
+					p = u;
+					found = true;
+				}
+				pmemo[key] = p;
+				return p;
+			}
+
+			// whether a enters the queue before b, both at level l
+			bool before(kb_index_t a, kb_index_t b, size_t l, size_t src) {
+				if (l == 0) return false; // just the source
+				kb_index_t pa = parent(a, l, src);
+				kb_index_t pb = parent(b, l, src);
+				if (pa != pb) return before(pa, pb, l - 1, src);
+				return edge_pos(pa, a) < edge_pos(pa, b);
+			}
+
+			// first out-edge u->v
+			kb_index_t edge_pos(kb_index_t u, kb_index_t v) const {
+				kb_index_t e = rowstart[u];
+				while(column[e] != v) ++e;
+				return e;
+			}
+
+			// in-neighbors of v at level l - 1, with the sources reaching v
+			// through them, as a range of CV and CM
+			std::pair<size_t, size_t> candidates(kb_index_t v, size_t l) {
+				boost::uint64_t key = (boost::uint64_t(l) << 32) | v;
+				boost::unordered_map<boost::uint64_t, std::pair<size_t, size_t> >::iterator it = cmemo.find(key);
+				if (it != cmemo.end()) return it->second;
+				msbfs_mask_t M = levels[l].mask(v);
+				std::pair<size_t, size_t> res(CV.size(), 0);
+				for(kb_index_t e = in_rowstart[v], e_end = in_rowstart[v + 1]; e < e_end; ++e) {
+					kb_index_t u = in_column[e];
+					msbfs_mask_t m = levels[l - 1].mask(u) & M;
+					if (!m) continue;
+					CV.push_back(u);
+					CM.push_back(m);
+				}
+				res.second = CV.size();
+				cmemo[key] = res;
+				return res;
+			}
+
+			const vector<msbfs_level_t> & levels;
+			const kb_index_t * rowstart;
+			const kb_index_t * column;
+			const kb_index_t * in_rowstart;
+			const kb_index_t * in_column;
+			boost::unordered_map<boost::uint64_t, std::pair<size_t, size_t> > cmemo;
+			boost::unordered_map<boost::uint64_t, kb_index_t> pmemo;
+			vector<kb_index_t> CV;
+			vector<msbfs_mask_t> CM;
+		};
+	}
+
+	void Kb::bfs_multi(const vector<Kb::vertex_descriptor> & sources,
+					   const vector<vector<Kb::vertex_descriptor> > & targets,
+					   kb_paths_t & paths) const {
+
+		size_t N = num_vertices(*m_g);
+		const kb_index_t * rowstart = &m_g->m_forward.m_rowstart[0];
+		const kb_index_t * column = m_edgeN ? &m_g->m_forward.m_column[0] : NULL;
+		// in-edges (symmetric graphs have none, see is_symmetric)
+		const kb_index_t * in_rowstart = rowstart;
+		const kb_index_t * in_column = column;
+		if (!m_symmetric) {
+			in_rowstart = &m_g->m_backward.m_rowstart[0];
+			in_column = m_edgeN ? &m_g->m_backward.m_column[0] : NULL;
+		}
+
+		paths.offset.assign(1, 0);
+		paths.V.clear();
+
+		vector<msbfs_mask_t> seen(N, 0);
+		vector<msbfs_mask_t> next(N, 0);
+		vector<msbfs_level_t> levels;
+		vector<kb_index_t> touched;
+		vector<msbfs_mask_t> need(N, 0);  // sources which still have to reach v
+		size_t need_n = 0;                // vertices with need[v] != 0
+
+		for(size_t i_begin = 0; i_begin < sources.size(); i_begin += 64) {
+			size_t i_end = std::min(sources.size(), i_begin + 64);
+
+			// targets of the batch, with the sources which need them
+			for(size_t i = i_begin; i < i_end; ++i) {
+				msbfs_mask_t bit = msbfs_mask_t(1) << (i - i_begin);
+				for(size_t j = 0; j < targets[i].size(); ++j) {
+					kb_index_t v = targets[i][j];
+					if (!need[v]) ++need_n;
+					need[v] |= bit;
+				}
+			}
+
+			// level 0
+			levels.clear();
+			levels.push_back(msbfs_level_t());
+			for(size_t i = i_begin; i < i_end; ++i) {
+				kb_index_t v = sources[i];
+				msbfs_mask_t bit = msbfs_mask_t(1) << (i - i_begin);
+				if (!seen[v]) levels.back().V.push_back(v);
+				seen[v] |= bit;
+				if ((need[v] & bit) && !(need[v] &= ~bit)) --need_n;
+			}
+			touched = levels.back().V;
+			std::sort(levels.back().V.begin(), levels.back().V.end());
+			for(size_t k = 0; k < levels.back().V.size(); ++k)
+				levels.back().M.push_back(seen[levels.back().V[k]]);
+
+			while(need_n) {   // until all targets are reached
+				const msbfs_level_t & cur = levels.back();
+				msbfs_level_t nxt;
+				size_t fsize = 0;
+				for(size_t k = 0; k < cur.V.size(); ++k) {
+					kb_index_t u = cur.V[k];
+					for(kb_index_t e = rowstart[u], e_end = rowstart[u + 1]; e < e_end; ++e) {
+						kb_index_t w = column[e];
+						msbfs_mask_t m = cur.M[k] & ~seen[w];
+						if (!m) continue;
+						if (!next[w]) {
+							nxt.V.push_back(w);
+							++fsize;
+						}
+						next[w] |= m;
+					}
+				}
+				if (!fsize) break; // some targets are not reachable
+				// sort the new level, scanning all the vertices if it is large
+				if (fsize > N / 16) {
+					nxt.V.clear();
+					for(size_t w = 0; w < N; ++w) {
+						if (next[w]) nxt.V.push_back(w);
+					}
+				} else {
+					std::sort(nxt.V.begin(), nxt.V.end());
+				}
+				nxt.M.resize(fsize);
+				for(size_t k = 0; k < fsize; ++k) {
+					kb_index_t w = nxt.V[k];
+					if (!seen[w]) touched.push_back(w);
+					seen[w] |= next[w];
+					nxt.M[k] = next[w];
+					if ((need[w] & next[w]) && !(need[w] &= ~next[w])) --need_n;
+					next[w] = 0;
+				}
+				levels.push_back(msbfs_level_t());
+				levels.back().V.swap(nxt.V);
+				levels.back().M.swap(nxt.M);
+			}
+
+			// follow the paths back from the targets
+			msbfs_tree_t tree(levels, rowstart, column, in_rowstart, in_column);
+			for(size_t i = i_begin; i < i_end; ++i) {
+				msbfs_mask_t bit = msbfs_mask_t(1) << (i - i_begin);
+				for(size_t j = 0; j < targets[i].size(); ++j) {
+					kb_index_t v = targets[i][j];
+					size_t l = 0;
+					if (seen[v] & bit) {
+						while(!(levels[l].mask(v) & bit)) ++l;
+						paths.V.push_back(v);
+					}
+					for(; l > 0; --l) {
+						v = tree.parent(v, l, i - i_begin);
+						paths.V.push_back(v);
+					}
+					paths.offset.push_back(paths.V.size());
+				}
+			}
+
+			for(size_t k = 0; k < touched.size(); ++k) seen[touched[k]] = 0;
+			for(size_t i = i_begin; i < i_end; ++i) {
+				for(size_t j = 0; j < targets[i].size(); ++j) need[targets[i][j]] = 0;
+			}
+			need_n = 0;
+		}
+	}
+
+	// Target-bounded Dijkstra. Vertices are settled in the same order as
+	// with boost's dijkstra_shortest_paths, but the search stops once all the
+	// targets are settled, as their paths can not change afterwards. Sources
+	// are assigned to threads round robin, and each thread stores the paths
+	// of its sources in order.
+
+	namespace {
+
+		struct dijkstra_multi_t {
+
+			dijkstra_multi_t(const vector<Kb::vertex_descriptor> & sources_,
+							 const vector<vector<Kb::vertex_descriptor> > & targets_,
+							 vector<dijkstra_workspace_t> & ws_,
+							 size_t N_, const kb_index_t * rowstart_, const kb_index_t * column_,
+							 const kb_edge_t * eprop_)
+				: sources(sources_), targets(targets_), ws(ws_), paths(ws_.size()),
+				  N(N_), rowstart(rowstart_), column(column_), eprop(eprop_) {}
+
+			void operator()(size_t tid) {
+				for(size_t i = tid; i < sources.size(); i += ws.size())
+					search(sources[i], targets[i], ws[tid], paths[tid]);
+			}
+
+			void search(kb_index_t src, const vector<Kb::vertex_descriptor> & T,
+						dijkstra_workspace_t & w, kb_paths_t & P) const {
+				w.start(N);
+				size_t need = 0; // targets not yet settled
+				for(size_t j = 0; j < T.size(); ++j) {
+					if (w.want[T[j]] == w.epoch) continue;
+					w.want[T[j]] = w.epoch;
+					++need;
+				}
+				w.seen[src] = w.epoch;
+				w.dist[src] = 0.0f;
+				w.parent[src] = src;
+				w.push(src);
+				const boost::uint32_t epoch = w.epoch;
+				boost::uint32_t * seen = &w.seen[0];
+				float * dist = &w.dist[0];
+				kb_index_t * parent = &w.parent[0];
+				const kb_index_t * pos = &w.pos[0];
+				while(need && !w.heap.empty()) {
+					kb_index_t u = w.pop();
+					if (w.want[u] == epoch) {
+						w.want[u] = 0;
+						if (!--need) break;
+					}
+					float d_u = dist[u];
+					for(kb_index_t e = rowstart[u], e_end = rowstart[u + 1]; e < e_end; ++e) {
+						kb_index_t v = column[e];
+						float d = d_u + eprop[e].weight;
+						if (seen[v] != epoch) {
+							seen[v] = epoch;
+							dist[v] = d;
+							parent[v] = u;
+							w.push(v);
+						} else if (pos[v] != dijkstra_workspace_t::no_pos && d < dist[v]) {
+							dist[v] = d;
+							parent[v] = u;
+							w.decrease(v);
+						}
+					}
+				}
+				for(size_t j = 0; j < T.size(); ++j) {
+					kb_index_t v = T[j];
+					// unreached targets are never settled
+					if (w.seen[v] == w.epoch && w.pos[v] == dijkstra_workspace_t::no_pos) {
+						P.V.push_back(v);
+						while(v != src) {
+							v = w.parent[v];
+							P.V.push_back(v);
+						}
+					}
+					P.offset.push_back(P.V.size());
+				}
+			}
+
+			const vector<Kb::vertex_descriptor> & sources;
+			const vector<vector<Kb::vertex_descriptor> > & targets;
+			vector<dijkstra_workspace_t> & ws;
+			vector<kb_paths_t> paths; // of each thread
+			size_t N;
+			const kb_index_t * rowstart;
+			const kb_index_t * column;
+			const kb_edge_t * eprop;
+		};
+	}
+
+	void Kb::dijkstra_multi(const vector<Kb::vertex_descriptor> & sources,
+							const vector<vector<Kb::vertex_descriptor> > & targets,
+							kb_paths_t & paths,
+							vector<dijkstra_workspace_t> & ws) const {
+
+		if (ws.empty()) ws.resize(1);
+		dijkstra_multi_t dm(sources, targets, ws, num_vertices(*m_g),
+							&m_g->m_forward.m_rowstart[0],
+							m_edgeN ? &m_g->m_forward.m_column[0] : NULL,
+							m_edgeN ? &m_g->m_forward.m_edge_properties[0] : NULL);
+		thr::run_parallel(std::min(ws.size(), std::max(sources.size(), size_t(1))), dm);
+
+		// merge the paths of the threads, in the order of the sources
+		paths.offset.assign(1, 0);
+		paths.V.clear();
+		vector<size_t> k(ws.size(), 0);
+		for(size_t i = 0; i < sources.size(); ++i) {
+			size_t tid = i % ws.size();
+			const kb_paths_t & P = dm.paths[tid];
+			for(size_t j = 0; j < targets[i].size(); ++j, ++k[tid]) {
+				paths.V.insert(paths.V.end(), P.begin(k[tid]), P.end(k[tid]));
+				paths.offset.push_back(paths.V.size());
+			}
+		}
+	}
+
+	// Depth-limited DFS, with an explicit stack. When a target is visited,
+	// the edges of the path not yet stored are added to the edges of the
+	// source. Each vertex is visited once, so every edge is stored at most
+	// once per source. Sources are assigned to threads round robin.
+
+	namespace {
+
+		struct dfs_multi_t {
+
+			dfs_multi_t(const vector<Kb::vertex_descriptor> & sources_,
+						const vector<Kb::vertex_descriptor> & targets_,
+						size_t max_depth_,
+						vector<dfs_workspace_t> & ws_,
+						size_t N_, const kb_index_t * rowstart_, const kb_index_t * column_)
+				: sources(sources_), targets(targets_), max_depth(max_depth_), ws(ws_),
+				  edges(ws_.size()), N(N_), rowstart(rowstart_), column(column_) {}
+
+			void operator()(size_t tid) {
+				for(size_t i = tid; i < sources.size(); i += ws.size())
+					search(sources[i], ws[tid], edges[tid]);
+			}
+
+			void search(kb_index_t src, dfs_workspace_t & w, kb_edges_t & R) const {
+				w.start(N);
+				size_t r_begin = R.E.size();
+				size_t stored = 0; // edges of the path already stored
+				w.seen[src] = w.epoch;
+				dfs_workspace_t::frame_t f = { src, rowstart[src], rowstart[src] };
+				if (max_depth) f.e_end = rowstart[src + 1];
+				w.stack.push_back(f);
+				while(!w.stack.empty()) {
+					dfs_workspace_t::frame_t & top = w.stack.back();
+					if (top.e == top.e_end) {
+						// finish top.u
+						w.stack.pop_back();
+						if (!w.path.empty()) w.path.pop_back();
+						if (stored > w.path.size()) stored = w.path.size();
+						continue;
+					}
+					kb_index_t e = top.e++;
+					kb_index_t v = column[e];
+					if (w.seen[v] == w.epoch) continue;
+					w.seen[v] = w.epoch;
+					w.path.push_back(e);
+					if (std::binary_search(targets.begin(), targets.end(), v)) {
+						for(; stored < w.path.size(); ++stored) {
+							kb_index_t pe = w.path[stored];
+							R.E.push_back(pe);
+							R.U.push_back(w.stack[stored].u);
+							R.V.push_back(column[pe]);
+						}
+					}
+					dfs_workspace_t::frame_t g = { v, rowstart[v], rowstart[v] };
+					if (w.path.size() < max_depth) g.e_end = rowstart[v + 1];
+					w.stack.push_back(g);
+				}
+				sort_edges(R, r_begin);
+				R.offset.push_back(R.E.size());
+			}
+
+			// sort the edges of R from r_begin by index
+			void sort_edges(kb_edges_t & R, size_t r_begin) const {
+				vector<pair<kb_index_t, kb_index_t> > idx;
+				for(size_t k = r_begin; k < R.E.size(); ++k)
+					idx.push_back(make_pair(R.E[k], R.U[k]));
+				std::sort(idx.begin(), idx.end());
+				for(size_t k = 0; k < idx.size(); ++k) {
+					size_t i = r_begin + k;
+					R.E[i] = idx[k].first;
+					R.U[i] = idx[k].second;
+					R.V[i] = column[idx[k].first];
+				}
+			}
+
+			const vector<Kb::vertex_descriptor> & sources;
+			const vector<Kb::vertex_descriptor> & targets;
+			size_t max_depth;
+			vector<dfs_workspace_t> & ws;
+			vector<kb_edges_t> edges; // of each thread
+			size_t N;
+			const kb_index_t * rowstart;
+			const kb_index_t * column;
+		};
+	}
+
+	void Kb::dfs_multi(const vector<Kb::vertex_descriptor> & sources,
+					   const vector<Kb::vertex_descriptor> & targets,
+					   size_t max_depth,
+					   kb_edges_t & edges,
+					   vector<dfs_workspace_t> & ws) const {
+
+		if (ws.empty()) ws.resize(1);
+		dfs_multi_t dm(sources, targets, max_depth, ws, num_vertices(*m_g),
+					   &m_g->m_forward.m_rowstart[0],
+					   m_edgeN ? &m_g->m_forward.m_column[0] : NULL);
+		thr::run_parallel(std::min(ws.size(), std::max(sources.size(), size_t(1))), dm);
+
+		// merge the edges of the threads, in the order of the sources
+		edges.offset.assign(1, 0);
+		edges.E.clear();
+		edges.U.clear();
+		edges.V.clear();
+		vector<size_t> k(ws.size(), 0);
+		for(size_t i = 0; i < sources.size(); ++i) {
+			size_t tid = i % ws.size();
+			const kb_edges_t & R = dm.edges[tid];
+			size_t b = R.offset[k[tid]];
+			size_t e = R.offset[k[tid] + 1];
+			edges.E.insert(edges.E.end(), R.E.begin() + b, R.E.begin() + e);
+			edges.U.insert(edges.U.end(), R.U.begin() + b, R.U.begin() + e);
+			edges.V.insert(edges.V.end(), R.V.begin() + b, R.V.begin() + e);
+			edges.offset.push_back(edges.E.size());
+			++k[tid];
+		}
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 	// Get shortest subgraphs
 
@@ -344,11 +829,11 @@ namespace ukb {
 		vector<vector<string> >(N).swap(E);
 
 		for(size_t i=0; i < N; ++i) {
-			V[i] = (*m_g)[sg.V[i]].name;
+			V[i] = get_vertex_name(sg.V[i]);
 			size_t m = sg.E[i].size();
 			vector<string> l(m);
 			for(size_t j=0; j < m; ++j) {
-				l[j] =  (*m_g)[sg.E[i].at(j)].name;
+				l[j] =  get_vertex_name(sg.E[i].at(j));
 			}
 			E[i].swap(l);
 		}
@@ -389,19 +874,38 @@ namespace ukb {
 	// strings <-> vertex_id
 
 	pair<Kb::vertex_descriptor, bool> Kb::get_vertex_by_name(const std::string & str) const {
-		map<string, Kb::vertex_descriptor>::const_iterator it;
-
-		it = m_synsetMap.find(str);
-		if (it != m_synsetMap.end()) return make_pair(it->second, true);
+		size_t v;
+		if (m_names.find(str, v)) return make_pair(Kb::vertex_descriptor(v), true);
 		return make_pair(Kb::vertex_descriptor(), false);
 	}
 
 	void Kb::edge_add_reltype(Kb::edge_descriptor e, const string & rel) {
-		m_rtypes.add_type(rel, (*m_g)[e].etype);
+		expand_symmetric();
+		m_rtypes.add_type(rel, edge_etype_ref(e.idx));
 	}
 
 	std::vector<std::string> Kb::edge_reltypes(Kb::edge_descriptor e) const {
-		return m_rtypes.tvector((*m_g)[e].etype);
+		return m_rtypes.tvector(edge_etype(e.idx));
+	}
+
+	// relation types of edge eidx, for changing them. The relation types are
+	// copied first if they are not owned.
+
+	etype_t::value_type & Kb::edge_etype_ref(size_t eidx) {
+		if (m_etype_buf.size() != m_edgeN) {
+			vector<etype_t::value_type> buf(m_edgeN, 0);
+			if (m_etype) std::copy(m_etype, m_etype + m_edgeN, buf.begin());
+			m_etype_buf.swap(buf);
+		}
+		m_etype = &m_etype_buf[0];
+		return m_etype_buf[eidx];
+	}
+
+	// take the (owned) relation types of the edges of a new graph
+
+	void Kb::set_etypes(vector<etype_t::value_type> & etypes) {
+		m_etype_buf.swap(etypes);
+		m_etype = m_etype_buf.size() ? &m_etype_buf[0] : NULL;
 	}
 
 	float Kb::get_edge_weight(Kb::edge_descriptor e) const {
@@ -410,7 +914,9 @@ namespace ukb {
 	}
 
 	void Kb::set_edge_weight(Kb::edge_descriptor e, float w) {
+		expand_symmetric();
 		(*m_g)[e].weight = w;
+		reset_out_coefs();
 	}
 
 	std::pair<Kb::out_edge_iterator, Kb::out_edge_iterator> Kb::out_neighbors(Kb::vertex_descriptor u) {
@@ -418,9 +924,74 @@ namespace ukb {
 	}
 
 	std::pair<Kb::in_edge_iterator, Kb::in_edge_iterator> Kb::in_neighbors(Kb::vertex_descriptor u) {
+		expand_symmetric();
 		return in_edges(u, *m_g);
 	}
 
+	////////////////////////////////////////////////////////////////////////////////
+	// Symmetric graphs
+
+	// Whether every edge u->v of g has a reverse edge v->u with the same
+	// properties. The out-edges of each vertex v (sorted by target) are
+	// compared with its in-edges (sorted by source).
+
+	static bool csr_is_symmetric(const Kb::boost_graph_t & g, const etype_t::value_type * etype) {
+		const vector<kb_index_t> & frow = g.m_forward.m_rowstart;
+		const vector<kb_index_t> & brow = g.m_backward.m_rowstart;
+		if (brow != frow) return false;
+		vector<pair<size_t, size_t> > out, in;
+		for(size_t v = 0, N = num_vertices(g); v < N; ++v) {
+			out.clear();
+			in.clear();
+			for(size_t e = frow[v]; e < frow[v + 1]; ++e) {
+				out.push_back(make_pair(size_t(g.m_forward.m_column[e]), e));
+				in.push_back(make_pair(size_t(g.m_backward.m_column[e]), size_t(g.m_backward.m_edge_properties[e])));
+			}
+			std::sort(out.begin(), out.end());
+			std::sort(in.begin(), in.end());
+			for(size_t i = 0; i < out.size(); ++i) {
+				if (out[i].first != in[i].first) return false;
+				size_t e1 = out[i].second;
+				size_t e2 = in[i].second;
+				if (g.m_forward.m_edge_properties[e1].weight != g.m_forward.m_edge_properties[e2].weight) return false;
+				if (etype && etype[e1] != etype[e2]) return false;
+			}
+		}
+		return true;
+	}
+
+	// Build the in-edges of a symmetric graph, which is no longer taken as
+	// symmetric (in-edges are sorted by source, as in any other graph).
+
+	void Kb::expand_symmetric() {
+		if (!m_symmetric) return;
+		Kb::boost_graph_t & g = *m_g;
+		size_t N = m_vertexN;
+		const vector<kb_index_t> & frow = g.m_forward.m_rowstart;
+		vector<kb_index_t> pos(frow.begin(), frow.end() - 1);
+		g.m_backward.m_column.resize(m_edgeN);
+		g.m_backward.m_edge_properties.resize(m_edgeN);
+		for(size_t u = 0; u < N; ++u) {
+			for(size_t e = frow[u]; e < frow[u + 1]; ++e) {
+				size_t i = pos[g.m_forward.m_column[e]]++;
+				g.m_backward.m_column[i] = u;
+				g.m_backward.m_edge_properties[i] = e;
+			}
+		}
+		m_symmetric = false;
+	}
+
+	sym_csr_t Kb::sym_csr() const {
+		sym_csr_t csr;
+		csr.n = m_vertexN;
+		csr.rowstart = &m_g->m_forward.m_rowstart[0];
+		if (m_edgeN) {
+			csr.column = &m_g->m_forward.m_column[0];
+			if (glVars::prank::use_weight) csr.prop = &m_g->m_forward.m_edge_properties[0];
+		}
+		return csr;
+	}
+
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Query and retrieval
@@ -431,37 +1002,6 @@ namespace ukb {
 	//   2 -> only concepts
 
 
-	void vname_filter(const map<string, Kb::vertex_descriptor> & theMap,
-					  const vector<float> & ranks,
-					  const Kb::boost_graph_t & g,
-					  vector<float> & outranks,
-					  vector<string> & vnames) {
-
-		size_t v_m = theMap.size();
-
-		vector<Kb::vertex_descriptor> V(v_m);
-		// empty output vectors
-		vector<float>(v_m).swap(outranks);
-		vector<string>(v_m).swap(vnames);
-
-		map<string, Kb::vertex_descriptor>::const_iterator m_it = theMap.begin();
-		map<string, Kb::vertex_descriptor>::const_iterator m_end = theMap.end();
-		size_t v_i = 0;
-
-		// Fill vertices index vector
-		for(; m_it != m_end; ++m_it, ++v_i) {
-			V[v_i] = m_it->second;
-		}
-		// Sort to guarantee uniqueness
-		sort(V);
-
-		for(v_i = 0; v_i < v_m; ++v_i) {
-			outranks[v_i] = ranks[V[v_i]];
-			vnames[v_i] = g[V[v_i]].name;
-		}
-	}
-
-
 	void Kb::filter_ranks_vnames(const vector<float> & ranks,
 								 vector<float> & outranks,
 								 vector<string> & vnames,
@@ -475,22 +1015,51 @@ namespace ukb {
 		vnames.resize(v_m);
 		for(v_i = 0; v_i < v_m; ++v_i) {
 			outranks[v_i] = ranks[v_i];
-			vnames[v_i] = (*m_g)[v_i].name;
+			vnames[v_i] = get_vertex_name(v_i);
 		}
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Get static pageRank vector
 
+	// Precomputed static ranks (see precompute_prank) come after a header
+	// with the parameters used to compute them: damping factor, number of
+	// iterations, threshold and whether edge weights were used. They are
+	// computed with unquantized weights, so they are not used with
+	// --prank_quant.
+
+	static const size_t pre_static_hdr_n = 4;
+
+	static void pre_static_header(float * hdr) {
+		hdr[0] = glVars::prank::damping;
+		hdr[1] = static_cast<float>(glVars::prank::num_iterations);
+		hdr[2] = glVars::prank::threshold;
+		hdr[3] = glVars::prank::use_weight ? 1.0f : 0.0f;
+	}
+
+	static bool pre_static_match(const float * hdr) {
+		float cur[pre_static_hdr_n];
+		pre_static_header(cur);
+		return glVars::prank::impl == glVars::pm &&
+			glVars::prank::weight_quant == glVars::wq_none &&
+			std::equal(cur, cur + pre_static_hdr_n, hdr);
+	}
+
 	const std::vector<float> & Kb::static_prank() const {
-		if (m_static_ppv.size()) return m_static_ppv;
 
-		// Hack to remove const-ness
-		Kb & me = const_cast<Kb &>(*this);
+		thr::scoped_lock lock(m_static_mutex);
+		if (m_static_ppv.size()) return m_static_ppv;
 
 		if (m_vertexN == 0) return m_static_ppv; // empty graph
+		const float * pre = m_pre_static[glVars::prank::use_weight ? 1 : 0];
+		if (pre && pre_static_match(pre)) {
+			m_static_ppv.assign(pre + pre_static_hdr_n, pre + pre_static_hdr_n + m_vertexN);
+			return m_static_ppv;
+		}
 		vector<float> pv(m_vertexN, 1.0/static_cast<float>(m_vertexN));
-		me.pageRank_ppv(pv, me.m_static_ppv);
+		vector<float> ranks;
+		pageRank_ppv(pv, ranks);
+		m_static_ppv.swap(ranks);
 		return m_static_ppv;
 	}
 
@@ -508,6 +1077,69 @@ namespace ukb {
 	// read from textfile and create graph
 
 
+	// Text KBs are read in chunks of whole lines. The chunks are parsed in
+	// parallel (see glVars::kb::threads), each one into its own table of
+	// vertex names and list of relations, and the results are merged in
+	// input order. Thus vertex ids and the order of edges are the same as
+	// when reading the lines one by one. Finally, duplicate edges are
+	// removed and the CSR arrays are built, in parallel too (see
+	// build_txt_csr).
+
+	static const size_t txt_chunk_size = 1 << 22; // bytes
+
+	struct txt_chunk_t {
+		size_t seq;          // chunk number
+		size_t first_line;   // line number of the first line
+		string text;         // whole lines
+	};
+
+	// An edge u->v, with local vertex ids and relation type index (+1, 0
+	// meaning no type) while in a chunk, and global ids and etype bits once
+	// merged.
+
+	struct txt_rel_t {
+		boost::uint32_t u;
+		boost::uint32_t v;
+		float w;
+		etype_t::value_type etype;
+
+		txt_rel_t() : u(0), v(0), w(0.0f), etype(0) {}
+		txt_rel_t(boost::uint32_t u_, boost::uint32_t v_, float w_, etype_t::value_type et)
+			: u(u_), v(v_), w(w_), etype(et) {}
+	};
+
+	// result of parsing a chunk
+
+	struct txt_part_t {
+		vertex_names_t names;         // vertices, in order of appearance
+		vector<txt_rel_t> rels;       // edges, in order of insertion
+		vector<string> rtypes;        // relation types, in order of appearance
+		vector<size_t> rtype_lines;   // line where each relation type appears first
+		set<string> srcs;             // relation sources
+		vector<string> msgs;          // skipped lines (see glVars::input::swallow)
+		string error;                 // first error (if not swallowing them)
+		size_t error_line;
+
+		txt_part_t() : error_line(0) {}
+	};
+
+	// Read the next chunk of lines. line_n is the number of the next line.
+
+	static bool read_txt_chunk(istream & is, txt_chunk_t & chunk, size_t & line_n) {
+		chunk.text.resize(txt_chunk_size);
+		is.read(&chunk.text[0], txt_chunk_size);
+		chunk.text.resize(is.gcount());
+		if (chunk.text.empty()) return false;
+		if (chunk.text[chunk.text.size() - 1] != '\n') {
+			string rest;
+			if (std::getline(is, rest)) chunk.text += rest;
+			chunk.text += '\n';
+		}
+		chunk.first_line = line_n;
+		line_n += std::count(chunk.text.begin(), chunk.text.end(), '\n');
+		return true;
+	}
+
 	// Line format:
 	//
 	// u:synset v:synset t:rel i:rel s:source d:directed w:weight
@@ -520,39 +1152,45 @@ namespace ukb {
 	// d: wether the relation is directed. Optional, default is undirected.
 	// w: relation weight. Must be positive. Optional.
 
+	typedef std::pair<const char *, const char *> txt_field_t;
 
 	struct rel_parse {
-		string u;
-		string v;
-		string rtype;
-		string irtype;
-		string src;
+		txt_field_t u;
+		txt_field_t v;
+		txt_field_t rtype;
+		txt_field_t irtype;
+		txt_field_t src;
 		float w;
 		bool directed;
 
 		rel_parse() : u(), v(), rtype(), irtype(), src(), w(0.0), directed(false) {}
-
 	};
 
-	bool parse_line(const string & line, rel_parse & out) {
+	static inline bool txt_blank(char c) { return c == ' ' || c == '\t'; }
 
-		rel_parse res;
+	static inline bool txt_field_eq(const txt_field_t & a, const txt_field_t & b) {
+		return a.second - a.first == b.second - b.first &&
+			std::equal(a.first, a.second, b.first);
+	}
 
-		char_separator<char> sep(" \t");
-		tokenizer<char_separator<char> > tok(line, sep);
-		tokenizer<char_separator<char> >::iterator it = tok.begin();
-		tokenizer<char_separator<char> >::iterator end = tok.end();
-		if (it == end) return false; // empty line
-		for(;it != end; ++it) {
+	// Parse line [p, end), already trimmed. Return false if line is empty.
 
-			string str = *it;
-			if (str.length() < 3 || str[1] != ':') {
-				throw runtime_error("parse_line error. Malformed line: " + line);
+	static bool parse_line(const char * p, const char * end, rel_parse & out) {
+
+		rel_parse res;
+		const char * line = p;
+
+		if (p == end) return false; // empty line
+		while (p != end) {
+			while (p != end && txt_blank(*p)) ++p;
+			if (p == end) break;
+			const char * tok = p;
+			while (p != end && !txt_blank(*p)) ++p;
+			if (p - tok < 3 || tok[1] != ':') {
+				throw runtime_error("parse_line error. Malformed line: " + string(line, end));
 			}
-			char f = str[0];
-			string val = str.substr(2);
-			if(!val.size()) continue;
-			switch (f) {
+			txt_field_t val(tok + 2, p);
+			switch (tok[0]) {
 			case 'u':
 				res.u = val;
 				break;
@@ -569,92 +1207,579 @@ namespace ukb {
 				res.src = val;
 				break;
 			case 'w':
-				res.w = lexical_cast<float>(val);
+				res.w = lexical_cast<float>(string(val.first, val.second));
 				break;
 			case 'd':
-				res.directed = glVars::kb::keep_directed && lexical_cast<bool>(val);
+				if (!glVars::kb::keep_directed) {
+					res.directed = false;
+				} else if (val.second - val.first == 1 && (*val.first == '0' || *val.first == '1')) {
+					res.directed = *val.first == '1';
+				} else {
+					res.directed = lexical_cast<bool>(string(val.first, val.second));
+				}
 				break;
 			default:
-				throw runtime_error("parse_line error. Unknown value " + str);
+				throw runtime_error("parse_line error. Unknown value " + string(tok, p));
 				break;
 			}
 		}
-		if (!res.u.size()) throw runtime_error("parse_line error. No source vertex.");
-		if (!res.v.size()) throw runtime_error("parse_line error. No target vertex.");
+		if (res.u.first == res.u.second) throw runtime_error("parse_line error. No source vertex.");
+		if (res.v.first == res.v.second) throw runtime_error("parse_line error. No target vertex.");
 		out = res;
 		return true;
 	}
 
-	void Kb::read_from_txt(istream & kbFile,
-						   const set<string> & src_allowed) {
-		string line;
-		size_t line_number = 0;
-		precsr_t csr_pre;
-
-		set<string>::const_iterator srel_end = src_allowed.end();
-		while(kbFile) {
-			vector<string> fields;
-			read_line_noblank(kbFile, line, line_number);
-			if(!kbFile) continue;
-			if (line[0] == '#') continue;
+	// Parse a chunk of lines into part
+
+	static void parse_txt_chunk(const txt_chunk_t & chunk,
+								const set<string> & src_allowed,
+								txt_part_t & part) {
+
+		const char * p = chunk.text.data();
+		const char * text_end = p + chunk.text.size();
+		size_t line_number = chunk.first_line;
+
+		// cache the last relation source, as consecutive lines usually have
+		// the same one
+		string last_src;
+		bool last_src_ok = false;
+		bool have_src = false;
+
+		for(; p != text_end; ++line_number) {
+			const char * eol = std::find(p, text_end, '\n');
+			const char * b = p;
+			const char * e = eol;
+			p = eol == text_end ? eol : eol + 1;
+			while (b != e && (txt_blank(*b) || *b == '\r')) ++b;
+			while (e != b && (txt_blank(e[-1]) || e[-1] == '\r')) --e;
+			if (b == e) continue;
+			if (*b == '#') continue;
 			rel_parse f;
 			try {
-				if (!parse_line(line, f)) continue;
-
-				if (glVars::kb::filter_src) {
-					if (src_allowed.find(f.src) == srel_end) continue; // Skip this relation
+				if (!parse_line(b, e, f)) continue;
+
+				if (f.src.first != f.src.second || glVars::kb::filter_src) {
+					if (!have_src || last_src.size() != size_t(f.src.second - f.src.first) ||
+						!std::equal(f.src.first, f.src.second, last_src.begin())) {
+						have_src = true;
+						last_src.assign(f.src.first, f.src.second);
+						last_src_ok = !glVars::kb::filter_src || src_allowed.count(last_src);
+						if (last_src_ok && last_src.size()) part.srcs.insert(last_src);
+					}
+					if (!last_src_ok) continue; // Skip this relation
 				}
 
-				if (f.u == f.v) continue; // no self-loops
-
-				if (f.src.size()) {
-					this->add_relSource(f.src);
-				}
+				if (txt_field_eq(f.u, f.v)) continue; // no self-loops
 
 				float w = f.w ? f.w : 1.0;
-				// add edge
 
 				// relation type
 				// empty f.rtype unless glVars::kb::keep_reltypes
 
-				if (!glVars::kb::keep_reltypes)
-					string().swap(f.rtype);
+				etype_t::value_type rtype = 0;
+				if (glVars::kb::keep_reltypes && f.rtype.first != f.rtype.second) {
+					size_t i = 0;
+					for(; i < part.rtypes.size(); ++i) {
+						const string & t = part.rtypes[i];
+						if (t.size() == size_t(f.rtype.second - f.rtype.first) &&
+							std::equal(f.rtype.first, f.rtype.second, t.begin())) break;
+					}
+					if (i == part.rtypes.size()) {
+						part.rtypes.push_back(string(f.rtype.first, f.rtype.second));
+						part.rtype_lines.push_back(line_number);
+					}
+					rtype = i + 1;
+				}
 
-				csr_pre.insert_edge(f.u, f.v, w, f.rtype);
+				boost::uint32_t u = part.names.insert(f.u.first, f.u.second - f.u.first);
+				boost::uint32_t v = part.names.insert(f.v.first, f.v.second - f.v.first);
+				part.rels.push_back(txt_rel_t(u, v, w, rtype));
 
 				// Insert v->u if undirected relation
 
 				if (!f.directed || !glVars::kb::keep_directed) {
-					csr_pre.insert_edge(f.v, f.u, w, f.rtype);
+					part.rels.push_back(txt_rel_t(v, u, w, rtype));
 				}
 			} catch (std::exception & e) {
 				string msg(string(e.what()) + " in line " + lexical_cast<string>(line_number));
-				if(!glVars::input::swallow) throw std::runtime_error(msg);
+				if(!glVars::input::swallow) {
+					part.error = msg;
+					part.error_line = line_number;
+					return;
+				}
 				if (glVars::debug::warning) {
-					cerr << msg << " (Skipping)\n";
+					part.msgs.push_back(msg + " (Skipping)");
 				}
 			}
 		}
+	}
 
-		Kb::boost_graph_t *new_g = new Kb::boost_graph_t(boost::edges_are_unsorted_multi_pass,
-														 csr_pre.E.begin(), csr_pre.E.end(),
-														 csr_pre.eProp.begin(),
-														 csr_pre.m_vsize);
+	// Merge parsed chunks, in input order
 
-		m_g.reset(new_g);
-		// add_edges(csr_pre.E.begin(), csr_pre.E.end(),
-		//		  // csr_pre.eProp.begin(),
-		//		  // csr_pre.eProp.end(),
-		//		  g);
+	struct txt_merge_t {
+		vertex_names_t names;
+		vector<txt_rel_t> rels;
+		set<string> srcs;
+		etype_t rtypes;
+
+		void merge(txt_part_t & part) {
+
+			for(size_t i = 0; i < part.msgs.size(); ++i) {
+				cerr << part.msgs[i] << "\n";
+			}
+
+			// relation types
+
+			vector<etype_t::value_type> tmap(part.rtypes.size() + 1, 0);
+			for(size_t i = 0; i < part.rtypes.size(); ++i) {
+				if (part.error.size() && part.error_line < part.rtype_lines[i]) break;
+				try {
+					rtypes.add_type(part.rtypes[i], tmap[i + 1]);
+				} catch (std::exception & e) {
+					string msg(string(e.what()) + " in line " + lexical_cast<string>(part.rtype_lines[i]));
+					if(!glVars::input::swallow) throw std::runtime_error(msg);
+					if (glVars::debug::warning) {
+						cerr << msg << " (Skipping)\n";
+					}
+				}
+			}
+			if (part.error.size()) throw std::runtime_error(part.error);
+
+			srcs.insert(part.srcs.begin(), part.srcs.end());
+
+			// vertices
+
+			const boost::uint64_t * offset = part.names.offsets();
+			const char * arena = part.names.arena();
+			vector<boost::uint32_t> vmap(part.names.size());
+			for(size_t i = 0; i < vmap.size(); ++i) {
+				vmap[i] = names.insert(arena + offset[i], offset[i + 1] - offset[i]);
+			}
+
+			// edges
+
+			rels.reserve(rels.size() + part.rels.size());
+			for(size_t i = 0; i < part.rels.size(); ++i) {
+				const txt_rel_t & r = part.rels[i];
+				rels.push_back(txt_rel_t(vmap[r.u], vmap[r.v], r.w, tmap[r.etype]));
+			}
+		}
+	};
+
+	// Multithreaded reading. Thread 0 reads the chunks, thread 1 merges the
+	// parsed chunks and the rest parse them.
+
+	struct txt_pipeline_t {
+
+		istream & is;
+		const set<string> & src_allowed;
+		txt_merge_t & merger;
+		thr::bounded_queue<boost::shared_ptr<txt_chunk_t> > chunks;
+		thr::ordered_queue<boost::shared_ptr<txt_part_t> > parts;
+
+		txt_pipeline_t(istream & is_, const set<string> & src_allowed_,
+					   txt_merge_t & merger_, size_t workers)
+			: is(is_), src_allowed(src_allowed_), merger(merger_),
+			  chunks(2 * workers), parts(2 * workers) {}
+
+		void abort() {
+			chunks.abort();
+			parts.abort();
+		}
+
+		void read() {
+			size_t seq = 0;
+			size_t line_n = 1;
+			while(1) {
+				boost::shared_ptr<txt_chunk_t> chunk(new txt_chunk_t);
+				if (!read_txt_chunk(is, *chunk, line_n)) break;
+				chunk->seq = seq++;
+				if (!chunks.push(chunk)) return; // aborted
+			}
+			chunks.close();
+			parts.close(seq);
+		}
 
-		BGL_FORALL_VERTICES(v, *m_g, Kb::boost_graph_t) {
-			(*m_g)[v].name = csr_pre.vProp[v].name;
+		void parse() {
+			boost::shared_ptr<txt_chunk_t> chunk;
+			while (chunks.pop(chunk)) {
+				boost::shared_ptr<txt_part_t> part(new txt_part_t);
+				parse_txt_chunk(*chunk, src_allowed, *part);
+				size_t seq = chunk->seq;
+				chunk.reset();
+				if (!parts.push(seq, part)) return; // aborted
+			}
 		}
 
+		void merge() {
+			boost::shared_ptr<txt_part_t> part;
+			while (parts.pop(part)) {
+				merger.merge(*part);
+				part.reset();
+			}
+		}
+
+		void operator()(size_t tid) {
+			try {
+				if (tid == 0) read();
+				else if (tid == 1) merge();
+				else parse();
+			} catch (...) {
+				abort();
+				throw;
+			}
+		}
+	};
+
+	// Build the CSR arrays of g from the edges in rels (which is emptied).
+	//
+	// Edges are first bucketed by source vertex (a stable counting sort),
+	// then duplicates are removed within each bucket: the edge keeps the
+	// position of its first occurrence and the weight of the last one, and
+	// gets the relation types of all of them. Finally, the in-edges are
+	// bucketed by target vertex. This is what boost's CSR constructor would
+	// do given the first occurrence of each edge, but runs in parallel:
+	// each thread takes a range of the input edges when counting, and a
+	// range of vertices (and thus their out-edges) otherwise.
+
+	struct txt_csr_builder_t {
+
+		typedef boost::uint32_t count_t;
+
+		vector<txt_rel_t> & rels;
+		size_t N;
+		size_t T;
+		Kb::boost_graph_t & g;
+		vector<etype_t::value_type> & etypes;   // relation types of the edges of g
+		thr::barrier bar;
+
+		vector<txt_rel_t> bucket;            // rels bucketed by source
+		vector<size_t> start;                // bucket of u is [start[u], start[u+1])
+		vector<size_t> ucount;               // edges of u after removing duplicates
+		vector<vector<count_t> > hist;       // per thread counts of each vertex
+		bool too_big;
+
+		txt_csr_builder_t(vector<txt_rel_t> & rels_, size_t N_, size_t T_, Kb::boost_graph_t & g_,
+						  vector<etype_t::value_type> & etypes_)
+			: rels(rels_), N(N_), T(T_), g(g_), etypes(etypes_), bar(T_), start(N_ + 1, 0),
+			  ucount(N_, 0), hist(T_), too_big(false) {}
+
+		size_t vfirst(size_t t) const { return N * t / T; }
+		size_t rfirst(size_t t, size_t n) const { return n * t / T; }
+
+		// total count of each vertex in [v0, v1) over all threads. Leave in
+		// hist the position of each thread relative to the first one.
+
+		void sum_hist(size_t v0, size_t v1, vector<size_t> & total) {
+			for(size_t v = v0; v < v1; ++v) {
+				count_t acc = 0;
+				for(size_t t = 0; t < T; ++t) {
+					count_t c = hist[t][v];
+					hist[t][v] = acc;
+					acc += c;
+				}
+				total[v] = acc;
+			}
+		}
+
+		// exclusive prefix sum of n values of total into res[0..n]
+
+		template<class V>
+		static void prefix_sum(const vector<size_t> & total, size_t n, V & res) {
+			size_t acc = 0;
+			for(size_t i = 0; i < n; ++i) {
+				res[i] = acc;
+				acc += total[i];
+			}
+			res[n] = acc;
+		}
+
+		// remove duplicate edges from b[0, n). Return the number of edges left.
+
+		static size_t dedup(txt_rel_t * b, size_t n, vector<std::pair<boost::uint32_t, size_t> > & aux,
+							vector<std::pair<size_t, txt_rel_t> > & uniq) {
+			if (n < 2) return n;
+			if (n <= 16) {
+				size_t k = 0;
+				for(size_t i = 0; i < n; ++i) {
+					size_t j = 0;
+					while (j < k && b[j].v != b[i].v) ++j;
+					if (j == k) {
+						b[k++] = b[i];
+					} else {
+						b[j].w = b[i].w;
+						b[j].etype |= b[i].etype;
+					}
+				}
+				return k;
+			}
+			aux.resize(n);
+			for(size_t i = 0; i < n; ++i) aux[i] = std::make_pair(b[i].v, i);
+			std::sort(aux.begin(), aux.end());
+			uniq.clear();
+			for(size_t i = 0; i < n;) {
+				txt_rel_t r = b[aux[i].second];
+				size_t first = aux[i].second;
+				for(++i; i < n && aux[i].first == r.v; ++i) {
+					r.w = b[aux[i].second].w;
+					r.etype |= b[aux[i].second].etype;
+				}
+				uniq.push_back(std::make_pair(first, r));
+			}
+			std::sort(uniq.begin(), uniq.end(), uniq_less);
+			for(size_t i = 0; i < uniq.size(); ++i) b[i] = uniq[i].second;
+			return uniq.size();
+		}
+
+		static bool uniq_less(const std::pair<size_t, txt_rel_t> & a,
+							  const std::pair<size_t, txt_rel_t> & b) {
+			return a.first < b.first;
+		}
+
+		void operator()(size_t t) {
+
+			size_t R = rels.size();
+			size_t v0 = vfirst(t);
+			size_t v1 = vfirst(t + 1);
+
+			// bucket by source
+
+			size_t r0 = rfirst(t, R);
+			size_t r1 = rfirst(t + 1, R);
+			vector<count_t>(N, 0).swap(hist[t]);
+			for(size_t i = r0; i < r1; ++i) ++hist[t][rels[i].u];
+			bar.wait();
+			sum_hist(v0, v1, ucount);
+			bar.wait();
+			if (t == 0) {
+				prefix_sum(ucount, N, start);
+				vector<txt_rel_t>(R).swap(bucket);
+			}
+			bar.wait();
+			for(size_t i = r0; i < r1; ++i) {
+				size_t u = rels[i].u;
+				bucket[start[u] + hist[t][u]++] = rels[i];
+			}
+			bar.wait();
+			if (t == 0) vector<txt_rel_t>().swap(rels);
+
+			// remove duplicates
+
+			vector<std::pair<boost::uint32_t, size_t> > aux;
+			vector<std::pair<size_t, txt_rel_t> > uniq;
+			for(size_t u = v0; u < v1; ++u) {
+				ucount[u] = dedup(R ? &bucket[start[u]] : NULL, start[u + 1] - start[u], aux, uniq);
+			}
+			bar.wait();
+			if (t == 0) {
+				vector<kb_index_t> & rowstart = g.m_forward.m_rowstart;
+				rowstart.resize(N + 1);
+				size_t acc = 0;
+				for(size_t u = 0; u < N; ++u) acc += ucount[u];
+				too_big = acc >= size_t(std::numeric_limits<kb_index_t>::max());
+				if (!too_big) {
+					prefix_sum(ucount, N, rowstart);
+					g.m_forward.m_column.resize(acc);
+					g.m_forward.m_edge_properties.resize(acc);
+					etypes.resize(acc);
+					g.m_backward.m_column.resize(acc);
+					g.m_backward.m_edge_properties.resize(acc);
+					g.m_backward.m_rowstart.resize(N + 1);
+				}
+			}
+			bar.wait();
+			if (too_big) return;
+
+			// out-edges, and count in-edges
+
+			const vector<kb_index_t> & rowstart = g.m_forward.m_rowstart;
+			std::fill(hist[t].begin(), hist[t].end(), 0);
+			for(size_t u = v0; u < v1; ++u) {
+				const txt_rel_t * b = ucount[u] ? &bucket[start[u]] : NULL;
+				for(size_t i = 0, e = rowstart[u]; i < ucount[u]; ++i, ++e) {
+					g.m_forward.m_column[e] = b[i].v;
+					g.m_forward.m_edge_properties[e] = kb_edge_t(b[i].w);
+					etypes[e] = b[i].etype;
+					++hist[t][b[i].v];
+				}
+			}
+			bar.wait();
+			if (t == 0) vector<txt_rel_t>().swap(bucket);
+			sum_hist(v0, v1, ucount);
+			bar.wait();
+			if (t == 0) prefix_sum(ucount, N, g.m_backward.m_rowstart);
+			bar.wait();
+
+			// in-edges
+
+			const vector<kb_index_t> & brow = g.m_backward.m_rowstart;
+			for(size_t u = v0; u < v1; ++u) {
+				for(size_t e = rowstart[u]; e < rowstart[u + 1]; ++e) {
+					size_t v = g.m_forward.m_column[e];
+					size_t pos = brow[v] + hist[t][v]++;
+					g.m_backward.m_column[pos] = u;
+					g.m_backward.m_edge_properties[pos] = e;
+				}
+			}
+			bar.wait();
+			vector<count_t>().swap(hist[t]);
+		}
+	};
+
+	// Build a CSR graph with N vertices from the edges in rels (which is
+	// emptied), leaving the relation types of its edges in etypes.
+
+	static Kb::boost_graph_t *build_kb_csr(vector<txt_rel_t> & rels, size_t N,
+										   vector<etype_t::value_type> & etypes) {
+		size_t threads = std::max(glVars::kb::threads, size_t(1));
+		std::auto_ptr<Kb::boost_graph_t> new_g(new Kb::boost_graph_t());
+		txt_csr_builder_t builder(rels, N, std::min(threads, std::max(N, size_t(1))), *new_g, etypes);
+		thr::run_parallel(builder.T, builder);
+		if (builder.too_big) check_kb_size(N, std::numeric_limits<kb_index_t>::max());
+		return new_g.release();
+	}
+
+	static Kb::boost_graph_t *build_kb_csr(const precsr_t & pre,
+										   vector<etype_t::value_type> & etypes) {
+		vector<txt_rel_t> rels;
+		rels.reserve(pre.m_esize);
+		for(size_t i = 0; i < pre.m_esize; ++i) {
+			rels.push_back(txt_rel_t(pre.E[i].first, pre.E[i].second, pre.eProp[i].weight, pre.eProp[i].etype));
+		}
+		return build_kb_csr(rels, pre.m_vsize, etypes);
+	}
+
+	void Kb::read_from_txt(istream & kbFile,
+						   const set<string> & src_allowed) {
+
+		size_t threads = std::max(glVars::kb::threads, size_t(1));
+		txt_merge_t merger;
+
+		if (threads == 1) {
+			txt_chunk_t chunk;
+			size_t line_n = 1;
+			while (read_txt_chunk(kbFile, chunk, line_n)) {
+				txt_part_t part;
+				parse_txt_chunk(chunk, src_allowed, part);
+				merger.merge(part);
+			}
+		} else {
+			txt_pipeline_t pipeline(kbFile, src_allowed, merger, threads);
+			thr::run_parallel(threads + 2, pipeline);
+		}
+
+		for(set<string>::const_iterator it = merger.srcs.begin(); it != merger.srcs.end(); ++it) {
+			this->add_relSource(*it);
+		}
+
+		if (m_g.get()) {
+			add_delta(merger.names, merger.rels, merger.rtypes);
+			return;
+		}
+
+		m_rtypes.swap(merger.rtypes);
+
+		size_t vertex_n = merger.names.size();
+		check_kb_size(vertex_n, 0);
+		vector<etype_t::value_type> etypes;
+		m_g.reset(build_kb_csr(merger.rels, vertex_n, etypes));
+		set_etypes(etypes);
+		m_symmetric = false;
+		m_names.swap(merger.names);
+
 		m_vertexN = num_vertices(*m_g);
 		m_edgeN = num_edges(*m_g);
-		// Init vertex map
-		m_synsetMap.swap(csr_pre.m_vMap);
+	}
+
+	// Add the relations read by read_from_txt to an existing graph. names
+	// are the vertices of the relations and rtypes their relation types.
+
+	void Kb::add_delta(const vertex_names_t & names,
+					   const vector<txt_rel_t> & rels,
+					   const etype_t & rtypes) {
+
+		expand_symmetric();
+
+		// relation types
+
+		vector<etype_t::value_type> tmap(rtypes.size() + 1, 0);
+		for(size_t i = 0; i < rtypes.size(); ++i) {
+			m_rtypes.add_type(rtypes.m_strtypes[i], tmap[i + 1]);
+		}
+
+		// vertices. New vertices get empty rows in the CSR graph.
+
+		vector<boost::uint32_t> vmap(names.size());
+		for(size_t i = 0; i < vmap.size(); ++i) {
+			vmap[i] = m_names.insert(names.name(i));
+		}
+		size_t vertex_n = m_names.size();
+		check_kb_size(vertex_n, m_edgeN);
+		for(size_t v = num_vertices(*m_g); v < vertex_n; ++v) {
+			m_g->m_forward.m_rowstart.push_back(m_g->m_forward.m_rowstart.back());
+			m_g->m_backward.m_rowstart.push_back(m_g->m_backward.m_rowstart.back());
+		}
+		m_vertexN = vertex_n;
+
+		// edges already in the graph are updated in place
+
+		for(size_t i = 0; i < rels.size(); ++i) {
+			Kb::vertex_descriptor u = vmap[rels[i].u];
+			Kb::vertex_descriptor v = vmap[rels[i].v];
+			etype_t::value_type etype = 0;
+			for(size_t j = 1; j < tmap.size(); ++j) {
+				if (rels[i].etype & (etype_t::value_type(1) << j)) etype |= tmap[j];
+			}
+			Kb::edge_descriptor e;
+			bool existsP;
+			tie(e, existsP) = edge(u, v, *m_g);
+			if (existsP) {
+				(*m_g)[e].weight = rels[i].w;
+				edge_etype_ref(e.idx) |= etype;
+			} else {
+				m_delta.insert_edge(u, v, rels[i].w, etype);
+			}
+		}
+		reset_out_coefs();
+		vector<float>().swap(m_static_ppv);
+	}
+
+	void Kb::merge_delta() {
+
+		if (m_delta.empty() && !m_names.has_extra()) return;
+
+		// all edges, those of the CSR graph first
+
+		vector<txt_rel_t> rels;
+		rels.reserve(m_edgeN + m_delta.size());
+		for(size_t u = 0; u < m_vertexN; ++u) {
+			for(size_t e = m_g->m_forward.m_rowstart[u]; e < m_g->m_forward.m_rowstart[u + 1]; ++e) {
+				rels.push_back(txt_rel_t(u, m_g->m_forward.m_column[e],
+										 m_g->m_forward.m_edge_properties[e].weight, edge_etype(e)));
+			}
+		}
+		for(size_t i = 0; i < m_delta.size(); ++i) {
+			const edge_prop_t & p = m_delta.eProp[i];
+			rels.push_back(txt_rel_t(m_delta.E[i].first, m_delta.E[i].second, p.weight, p.etype));
+		}
+		m_delta.clear();
+
+		vector<etype_t::value_type> etypes;
+		std::auto_ptr<Kb::boost_graph_t> new_g(build_kb_csr(rels, m_vertexN, etypes));
+
+		reset_out_coefs();
+		vector<float>().swap(m_static_ppv);
+		m_g = new_g;
+		set_etypes(etypes);
+		m_symmetric = false;
+		if (m_names.has_extra()) {
+			// names are (partly) in the mapped file, copy them
+			vertex_names_t names;
+			for(size_t v = 0; v < m_vertexN; ++v) names.insert(m_names.name(v));
+			m_names.swap(names);
+			m_mapped.reset();
+		}
+		m_edgeN = num_edges(*m_g);
 	}
 
 	void Kb::read_from_txt(const std::string & synsFileName,
@@ -688,6 +1813,15 @@ namespace ukb {
 			writeV(o, m_rtypes.m_strtypes);
 			o << endl;
 		}
+		if (m_delta.size()) {
+			o << m_delta.size() << " edges in the delta overlay." << endl;
+		}
+		if (m_symmetric) {
+			o << "Symmetric graph (in-edges are not stored)." << endl;
+		}
+		if (m_pre_static[0] || m_pre_static[1]) {
+			o << "Precomputed PageRank data (damping " << (m_pre_static[0] ? m_pre_static[0][0] : m_pre_static[1][0]) << ")" << endl;
+		}
 	}
 
 
@@ -754,62 +1888,512 @@ namespace ukb {
 
 	void Kb::ppv_weights(const vector<float> & ppv) {
 
+		expand_symmetric();
+
 		graph_traits<Kb::boost_graph_t>::edge_iterator it, end;
 
 		tie(it, end) = edges(*m_g);
 		for(; it != end; ++it) {
 			(*m_g)[*it].weight = ppv[target(*it, *m_g)];
 		}
+		for(size_t i = 0; i < m_delta.size(); ++i) {
+			m_delta.eProp[i].weight = ppv[m_delta.E[i].second];
+		}
+		reset_out_coefs();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Vertex reordering
+
+	// Undirected view of the graph: the neighbors of u (both through out and
+	// in-edges) are adj[rowstart[u], rowstart[u+1]). Neighbors joined by
+	// edges in both directions appear twice.
+
+	struct undirected_adj_t {
+		vector<size_t> rowstart;
+		vector<boost::uint32_t> adj;
+
+		size_t degree(size_t u) const { return rowstart[u + 1] - rowstart[u]; }
+	};
+
+	static void undirected_adj(const Kb::boost_graph_t & g, undirected_adj_t & res) {
+		size_t N = num_vertices(g);
+		res.rowstart.resize(N + 1);
+		res.adj.clear();
+		res.adj.reserve(2 * num_edges(g));
+		for(Kb::vertex_descriptor u = 0; u < N; ++u) {
+			res.rowstart[u] = res.adj.size();
+			BGL_FORALL_OUTEDGES(u, e, g, Kb::boost_graph_t) {
+				res.adj.push_back(target(e, g));
+			}
+			BGL_FORALL_INEDGES(u, e, g, Kb::boost_graph_t) {
+				res.adj.push_back(source(e, g));
+			}
+		}
+		res.rowstart[N] = res.adj.size();
+	}
+
+	// Orderings. order[i] is the (old) vertex which gets id i.
+
+	// by decreasing degree (ties keep the old order)
+
+	struct degree_greater {
+		degree_greater(const undirected_adj_t & a) : A(a) {}
+		bool operator()(size_t u, size_t v) const { return A.degree(u) > A.degree(v); }
+		const undirected_adj_t & A;
+	};
+
+	static void order_degree(const undirected_adj_t & A, vector<size_t> & order) {
+		size_t N = A.rowstart.size() - 1;
+		order.resize(N);
+		for(size_t i = 0; i < N; ++i) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), degree_greater(A));
+	}
+
+	// breadth first, starting each component at its first vertex
+
+	static void order_bfs(const undirected_adj_t & A, vector<size_t> & order) {
+		size_t N = A.rowstart.size() - 1;
+		vector<char> seen(N, 0);
+		order.clear();
+		order.reserve(N);
+		for(size_t s = 0; s < N; ++s) {
+			if (seen[s]) continue;
+			seen[s] = 1;
+			size_t head = order.size();
+			order.push_back(s);
+			for(; head < order.size(); ++head) {
+				size_t u = order[head];
+				for(size_t i = A.rowstart[u]; i < A.rowstart[u + 1]; ++i) {
+					size_t v = A.adj[i];
+					if (seen[v]) continue;
+					seen[v] = 1;
+					order.push_back(v);
+				}
+			}
+		}
+	}
+
+	// reverse Cuthill-McKee: breadth first, starting each component at a
+	// vertex of minimum degree and visiting neighbors by increasing degree,
+	// and reverse the result
+
+	struct degree_less {
+		degree_less(const undirected_adj_t & a) : A(a) {}
+		bool operator()(size_t u, size_t v) const { return A.degree(u) < A.degree(v); }
+		const undirected_adj_t & A;
+	};
+
+	static void order_rcm(const undirected_adj_t & A, vector<size_t> & order) {
+		size_t N = A.rowstart.size() - 1;
+		vector<size_t> by_degree;
+		order_degree(A, by_degree);
+		std::reverse(by_degree.begin(), by_degree.end());
+		vector<char> seen(N, 0);
+		vector<size_t> nbrs;
+		order.clear();
+		order.reserve(N);
+		for(size_t k = 0; k < N; ++k) {
+			size_t s = by_degree[k];
+			if (seen[s]) continue;
+			seen[s] = 1;
+			size_t head = order.size();
+			order.push_back(s);
+			for(; head < order.size(); ++head) {
+				size_t u = order[head];
+				nbrs.clear();
+				for(size_t i = A.rowstart[u]; i < A.rowstart[u + 1]; ++i) {
+					size_t v = A.adj[i];
+					if (seen[v]) continue;
+					seen[v] = 1;
+					nbrs.push_back(v);
+				}
+				std::stable_sort(nbrs.begin(), nbrs.end(), degree_less(A));
+				order.insert(order.end(), nbrs.begin(), nbrs.end());
+			}
+		}
+		std::reverse(order.begin(), order.end());
+	}
+
+	// Rabbit order (Arai et al., "Rabbit Order: Just-in-time Parallel
+	// Reordering for Fast Graph Analysis", IPDPS 2016), sequential version.
+	//
+	// Vertices are visited by increasing degree, and each one is merged into
+	// the neighbor community which most increases the modularity, if any.
+	// Merges make a dendrogram, and the new ids are given by a depth first
+	// traversal of it, so that each community gets consecutive ids.
+
+	typedef vector<pair<boost::uint32_t, float> > rabbit_adj_t;
+
+	static size_t rabbit_find(vector<boost::uint32_t> & dest, size_t u) {
+		size_t r = u;
+		while (dest[r] != r) r = dest[r];
+		while (dest[u] != r) {
+			size_t next = dest[u];
+			dest[u] = r;
+			u = next;
+		}
+		return r;
+	}
+
+	static void order_rabbit(const undirected_adj_t & A, vector<size_t> & order) {
+		size_t N = A.rowstart.size() - 1;
+		vector<rabbit_adj_t> nbrs(N);
+		vector<double> deg(N);
+		double W = 0.0; // 2m
+		for(size_t u = 0; u < N; ++u) {
+			for(size_t i = A.rowstart[u]; i < A.rowstart[u + 1]; ++i) {
+				nbrs[u].push_back(make_pair(A.adj[i], 1.0f));
+			}
+			deg[u] = A.degree(u);
+			W += deg[u];
+		}
+
+		vector<boost::uint32_t> dest(N);
+		for(size_t u = 0; u < N; ++u) dest[u] = u;
+		vector<char> done(N, 0);
+		// dendrogram: children lists, and top level communities
+		vector<boost::uint32_t> child(N, vertex_names_t::no_vertex);
+		vector<boost::uint32_t> sibling(N, vertex_names_t::no_vertex);
+		vector<size_t> tops;
+
+		vector<size_t> visit;
+		order_degree(A, visit);
+		std::reverse(visit.begin(), visit.end());
+		for(size_t k = 0; k < N; ++k) {
+			size_t u = visit[k];
+			// aggregate the edges to each (current) community
+			rabbit_adj_t & nu = nbrs[u];
+			for(size_t i = 0; i < nu.size(); ++i) {
+				nu[i].first = rabbit_find(dest, nu[i].first);
+			}
+			std::sort(nu.begin(), nu.end());
+			size_t best = u;
+			double best_dq = 0.0;
+			for(size_t i = 0; i < nu.size(); ) {
+				size_t v = nu[i].first;
+				double w = 0.0;
+				for(; i < nu.size() && nu[i].first == v; ++i) w += nu[i].second;
+				if (v == u) continue;
+				double dq = 2.0 * (w / W - deg[u] * deg[v] / (W * W));
+				if (dq > best_dq) {
+					best_dq = dq;
+					best = v;
+				}
+			}
+			done[u] = 1;
+			if (best == u) {
+				tops.push_back(u);
+				rabbit_adj_t().swap(nu);
+				continue;
+			}
+			// merge u into best
+			dest[u] = best;
+			deg[best] += deg[u];
+			sibling[u] = child[best];
+			child[best] = u;
+			if (!done[best]) {
+				// best will be visited later, so it needs the edges of u
+				nbrs[best].insert(nbrs[best].end(), nu.begin(), nu.end());
+			}
+			rabbit_adj_t().swap(nu);
+		}
+
+		// depth first traversal of the dendrogram
+		order.clear();
+		order.reserve(N);
+		vector<size_t> stack;
+		for(size_t k = 0; k < tops.size(); ++k) {
+			stack.push_back(tops[k]);
+			while(stack.size()) {
+				size_t u = stack.back();
+				stack.pop_back();
+				order.push_back(u);
+				for(boost::uint32_t c = child[u]; c != vertex_names_t::no_vertex; c = sibling[c]) {
+					stack.push_back(c);
+				}
+			}
+		}
+	}
+
+	void Kb::reorder_vertices(const std::string & method) {
+
+		expand_symmetric();
+
+		undirected_adj_t A;
+		undirected_adj(*m_g, A);
+		vector<size_t> order;
+		if (method == "degree") order_degree(A, order);
+		else if (method == "bfs") order_bfs(A, order);
+		else if (method == "rcm") order_rcm(A, order);
+		else if (method == "rabbit") order_rabbit(A, order);
+		else throw runtime_error("Kb::reorder_vertices: unknown method " + method);
+		vector<size_t>().swap(A.rowstart);
+		vector<boost::uint32_t>().swap(A.adj);
+
+		// perm[u] is the new id of vertex u
+		size_t N = m_vertexN;
+		assert(order.size() == N);
+		vector<size_t> perm(N);
+		for(size_t i = 0; i < N; ++i) perm[order[i]] = i;
+
+		vector<txt_rel_t> rels;
+		rels.reserve(m_edgeN);
+		BGL_FORALL_EDGES(e, *m_g, Kb::boost_graph_t) {
+			rels.push_back(txt_rel_t(perm[source(e, *m_g)], perm[target(e, *m_g)],
+									 (*m_g)[e].weight, edge_etype(e.idx)));
+		}
+		vertex_names_t new_names;
+		for(size_t i = 0; i < N; ++i) new_names.insert(get_vertex_name(order[i]));
+
+		vector<etype_t::value_type> etypes;
+		m_g.reset(build_kb_csr(rels, N, etypes));
+		set_etypes(etypes);
+		m_names.swap(new_names);
+		m_mapped.reset();
+		reset_out_coefs();
+		vector<float>().swap(m_static_ppv);
+		assert(num_edges(*m_g) == m_edgeN);
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// PageRank in KB
 
+	// The delta overlay in the PageRank computations. The coefficients of
+	// the vertices with edges in the overlay are computed again, and the
+	// overlay in-edges are merged into the flat in-edge CSR, sorted by
+	// source as in the CSR graph, so that the results are the same as with
+	// the merged graph (see merge_delta).
+
+	template<class wmap_t>
+	static void delta_out_coefs(const Kb::boost_graph_t & g, const kb_delta_t & delta,
+								wmap_t wmap, bool use_weight, vector<float> & out_coefs) {
+		const kb_delta_t::adj_t * adj[2] = { &delta.out, &delta.in };
+		for(size_t a = 0; a < 2; ++a) {
+			for(kb_delta_t::adj_t::const_iterator it = adj[a]->begin(); it != adj[a]->end(); ++it) {
+				Kb::vertex_descriptor u = it->first;
+				size_t i = 0;
+				float total_w = 0.0;
+				Kb::out_edge_iterator e, e_end;
+				for(tie(e, e_end) = out_edges(u, g); e != e_end; ++e) {
+					++i;
+					total_w += wmap[*e];
+				}
+				const vector<size_t> * dout = delta.out_edges(u);
+				for(size_t j = 0; dout && j < dout->size(); ++j) {
+					++i;
+					total_w += use_weight ? delta.eProp[(*dout)[j]].weight : 1.0f;
+				}
+				if (i) {
+					out_coefs[u] = 1.0f / total_w;
+				} else {
+					out_coefs[u] = (in_degree(u, g) || delta.in_edges(u)) ? 0.0f : -1.0f;
+				}
+			}
+		}
+	}
 
-	// PPV version
+	static void delta_in_csr(const kb_delta_t & delta, bool use_weight,
+							 const vector<float> & out_coefs, in_csr_t & csr) {
+		if (delta.empty()) return;
+		size_t N = csr.size();
+		in_csr_t res;
+		res.rowstart.reserve(N + 1);
+		res.src.reserve(csr.src.size() + delta.size());
+		res.w.reserve(csr.src.size() + delta.size());
+		vector<std::pair<size_t, float> > din;
+		res.rowstart.push_back(0);
+		for(size_t v = 0; v < N; ++v) {
+			din.clear();
+			const vector<size_t> * dv = delta.in_edges(v);
+			for(size_t j = 0; dv && j < dv->size(); ++j) {
+				size_t e = (*dv)[j];
+				size_t u = delta.E[e].first;
+				din.push_back(std::make_pair(u, (use_weight ? delta.eProp[e].weight : 1.0f) * out_coefs[u]));
+			}
+			std::sort(din.begin(), din.end());
+			vector<std::pair<size_t, float> >::const_iterator d = din.begin();
+			for(size_t i = csr.rowstart[v]; i < csr.rowstart[v + 1]; ++i) {
+				for(; d != din.end() && d->first < csr.src[i]; ++d) {
+					res.src.push_back(d->first);
+					res.w.push_back(d->second);
+				}
+				res.src.push_back(csr.src[i]);
+				res.w.push_back(csr.w[i]);
+			}
+			for(; d != din.end(); ++d) {
+				res.src.push_back(d->first);
+				res.w.push_back(d->second);
+			}
+			res.rowstart.push_back(res.src.size());
+		}
+		csr.swap(res);
+	}
 
-	void Kb::pageRank_ppv(const vector<float> & ppv_map,
-						  vector<float> & ranks) {
+	// Compute the out-degree coefficients and the flat in-edge CSR used by the
+	// PageRank kernels. They depend on edge weights, so they have to be reset
+	// (see reset_out_coefs) whenever weights change. Symmetric graphs need no
+	// in-edge CSR (see sym_csr_t), and their weights are never quantized.
+
+	void Kb::init_out_coefs() const {
+
+		thr::scoped_lock lock(m_coefs_mutex);
+		if (m_out_coefs.size()) return;
 
 		typedef graph_traits<Kb::boost_graph_t>::edge_descriptor edge_descriptor;
-		property_map<Kb::boost_graph_t, float edge_prop_t::*>::type weight_map = get(&edge_prop_t::weight, *m_g);
+		property_map<Kb::boost_graph_t, float kb_edge_t::*>::type weight_map = get(&kb_edge_t::weight, *m_g);
 		prank::constant_property_map <edge_descriptor, float> cte_weight(1.0); // always return 1
 
-		if (0 == m_out_coefs.size()) {
-			vector<float>(m_vertexN, 0.0f).swap(m_out_coefs);
-			if (glVars::prank::use_weight) {
-				prank::init_out_coefs(*m_g,  &m_out_coefs[0], weight_map);
-			} else {
-				prank::init_out_coefs(*m_g,  &m_out_coefs[0], cte_weight);
-			}
+		vector<float> out_coefs(m_vertexN, 0.0f);
+		const float * pre = m_pre_coefs[glVars::prank::use_weight ? 1 : 0];
+		if (pre) {
+			std::copy(pre, pre + m_vertexN, out_coefs.begin());
+		}
+		if (glVars::prank::use_weight) {
+			if (!pre) prank::init_out_coefs(*m_g,  &out_coefs[0], weight_map);
+			delta_out_coefs(*m_g, m_delta, weight_map, true, out_coefs);
+			if (!m_symmetric) prank::init_in_csr(*m_g, weight_map, out_coefs, m_in_csr);
+		} else {
+			if (!pre) prank::init_out_coefs(*m_g,  &out_coefs[0], cte_weight);
+			delta_out_coefs(*m_g, m_delta, cte_weight, false, out_coefs);
+			if (!m_symmetric) prank::init_in_csr(*m_g, cte_weight, out_coefs, m_in_csr);
+		}
+		// (symmetric graphs have no delta, see add_delta)
+		delta_in_csr(m_delta, glVars::prank::use_weight, out_coefs, m_in_csr);
+		if (glVars::prank::weight_quant != glVars::wq_none && !m_in_csr.empty())
+			prank::quantize_in_csr(m_in_csr, glVars::prank::weight_quant == glVars::wq_log16);
+		m_out_coefs.swap(out_coefs);
+	}
+
+	// Note that this also drops the precomputed data, which is no longer
+	// valid once the weights (or the graph) change.
+
+	void Kb::reset_out_coefs() {
+		thr::scoped_lock lock(m_coefs_mutex);
+		vector<float>().swap(m_out_coefs);
+		in_csr_t().swap(m_in_csr);
+		clear_precomputed();
+	}
+
+	void Kb::clear_precomputed() {
+		for(size_t i = 0; i < 2; ++i) {
+			m_pre_coefs[i] = NULL;
+			m_pre_static[i] = NULL;
+		}
+		for(size_t i = 0; i < 4; ++i) {
+			vector<float>().swap(m_pre_buf[i]);
 		}
-		if (m_vertexN == ranks.size()) {
+	}
+
+	void Kb::precompute_prank() {
+
+		bool use_weight = glVars::prank::use_weight;
+		glVars::PrankImpl impl = glVars::prank::impl;
+		glVars::prank::impl = glVars::pm;
+		// graphs which are written as symmetric (see write_to_stream) are
+		// ranked with the symmetric kernel when loaded, so use it here, too,
+		// to get the same ranks
+		bool symmetric = m_symmetric;
+		if (!m_symmetric && m_delta.empty()) m_symmetric = csr_is_symmetric(*m_g, m_etype);
+
+		reset_out_coefs();
+		vector<float>().swap(m_static_ppv);
+		vector<float> bufs[4];
+		for(size_t w = 0; w < 2; ++w) {
+			glVars::prank::use_weight = (w == 1);
+			init_out_coefs();
+			bufs[w] = m_out_coefs;
+			vector<float> & ranks = bufs[2 + w];
+			ranks.resize(pre_static_hdr_n);
+			pre_static_header(&ranks[0]);
+			const vector<float> & sranks = static_prank();
+			ranks.insert(ranks.end(), sranks.begin(), sranks.end());
+			reset_out_coefs();
+			vector<float>().swap(m_static_ppv);
+		}
+		glVars::prank::use_weight = use_weight;
+		glVars::prank::impl = impl;
+		m_symmetric = symmetric;
+
+		for(size_t i = 0; i < 4; ++i) m_pre_buf[i].swap(bufs[i]);
+		for(size_t w = 0; w < 2; ++w) {
+			m_pre_coefs[w] = m_vertexN ? &m_pre_buf[w][0] : NULL;
+			m_pre_static[w] = &m_pre_buf[2 + w][0];
+		}
+	}
+
+	// Set all ranks to zero, resizing if necessary
+
+	static void init_ranks(size_t N, vector<float> & ranks) {
+		if (N == ranks.size()) {
 			std::fill(ranks.begin(), ranks.end(), 0.0);
 		} else {
-			vector<float>(m_vertexN, 0.0).swap(ranks); // Initialize rank vector
+			vector<float>(N, 0.0).swap(ranks);
+		}
+	}
+
+	// Scatter (or clear, if clear is true) the entries of a sparse vector
+	// into a dense one
+
+	static void scatter_sparse(const sparse_vector_t & sv, vector<float> & v, bool clear = false) {
+		for(sparse_vector_t::const_iterator it = sv.begin(), end = sv.end();
+			it != end; ++it) {
+			v[it->first] = clear ? 0.0f : it->second;
 		}
-		vector<float> rank_tmp(m_vertexN, 0.0);    // auxiliary rank vector
+	}
+
+	// PPV version
+
+	void Kb::pageRank_ppv(const vector<float> & ppv_map,
+						  vector<float> & ranks) const {
+		PrankWorkspace ws;
+		pageRank_ppv(ppv_map, ranks, ws);
+	}
+
+	void Kb::pageRank_ppv(const sparse_vector_t & pv,
+						  vector<float> & ranks) const {
+		PrankWorkspace ws;
+		pageRank_ppv(pv, ranks, ws);
+	}
+
+	void Kb::pageRank_ppv(const vector<float> & ppv_map,
+						  vector<float> & ranks,
+						  PrankWorkspace & ws) const {
 
 		switch(glVars::prank::impl) {
 		  case glVars::pm:
-			  if (glVars::prank::use_weight) {
-				  prank::do_pageRank(*m_g, m_vertexN, &ppv_map[0],
-									 weight_map, &ranks[0], &rank_tmp[0],
-									 glVars::prank::num_iterations,
-									 glVars::prank::threshold,
-									 glVars::prank::damping,
-									 m_out_coefs);
-			  } else {
-				  prank::do_pageRank(*m_g, m_vertexN, &ppv_map[0],
-									 cte_weight, &ranks[0], &rank_tmp[0],
-									 glVars::prank::num_iterations,
-									 glVars::prank::threshold,
-									 glVars::prank::damping,
-									 m_out_coefs);
+			  {
+				  init_out_coefs();
+				  // no need to clear them, the power method initializes ranks, and
+				  // only writes to the (non isolated) vertices of tmp
+				  if (ranks.size() != m_vertexN) ranks.resize(m_vertexN);
+				  if (ws.tmp.size() != m_vertexN) vector<float>(m_vertexN, 0.0).swap(ws.tmp);
+				  thr::pool_lease pool(m_prank_pools, glVars::prank::threads);
+				  if (m_symmetric) {
+					  sym_csr_t csr = sym_csr();
+					  prank::sym_csr_sweep sweep(csr, &ppv_map[0], m_out_coefs, glVars::prank::damping);
+					  prank::power_method(sweep, m_vertexN, &ranks[0], &ws.tmp[0],
+										  glVars::prank::num_iterations,
+										  glVars::prank::threshold,
+										  glVars::prank::threads, pool.get());
+				  } else {
+					  prank::csr_sweep sweep(m_in_csr, &ppv_map[0], m_out_coefs, glVars::prank::damping);
+					  prank::power_method(sweep, m_vertexN, &ranks[0], &ws.tmp[0],
+										  glVars::prank::num_iterations,
+										  glVars::prank::threshold,
+										  glVars::prank::threads, pool.get());
+				  }
 			  }
 			  break;
 		  case glVars::nibble:
-			  prank::pageRank_nibble_lazy(*m_g, ppv_map, m_out_coefs, glVars::prank::damping, glVars::prank::nibble_epsilon, ranks);
+			  {
+				  sparse_vector_t & pv = ws.spv;
+				  pv.clear();
+				  for(size_t i = 0; i < m_vertexN; ++i) {
+					  if (ppv_map[i] != 0.0f) pv.push_back(std::make_pair(i, ppv_map[i]));
+				  }
+				  pageRank_ppv(pv, ranks, ws);
+			  }
 			  break;
 		default:
 			cerr << "Error! undefined method for PageRank calculation.\n";
@@ -818,6 +2402,134 @@ namespace ukb {
 		}
 	}
 
+	// Sparse PPV version
+
+	void Kb::pageRank_ppv(const sparse_vector_t & pv,
+						  vector<float> & ranks,
+						  PrankWorkspace & ws) const {
+
+		if (glVars::prank::impl == glVars::nibble) {
+			init_ranks(m_vertexN, ranks);
+			pageRank_nibble(pv, ws.out, ws.nibble);
+			scatter_sparse(ws.out, ranks);
+			return;
+		}
+		if (ws.pv.size() != m_vertexN) vector<float>(m_vertexN, 0.0).swap(ws.pv);
+		scatter_sparse(pv, ws.pv);
+		try {
+			pageRank_ppv(ws.pv, ranks, ws);
+		} catch (...) {
+			scatter_sparse(pv, ws.pv, true);
+			throw;
+		}
+		scatter_sparse(pv, ws.pv, true); // leave ws.pv zeroed
+	}
+
+	// Sparse nibble version
+
+	void Kb::pageRank_nibble(const sparse_vector_t & pv,
+							 sparse_vector_t & ranks,
+							 nibble_workspace_t & ws) const {
+		init_out_coefs();
+		prank::pageRank_nibble_lazy(*m_g, pv, m_out_coefs,
+									glVars::prank::damping, glVars::prank::nibble_epsilon,
+									ws, ranks, m_delta.empty() ? NULL : &m_delta);
+	}
+
+
+	// Batched PPV version
+	//
+	// The rank block holds K floats per vertex, so we process the vectors in
+	// chunks of at most prank_batch_max columns to keep memory bounded.
+
+	static const size_t prank_batch_max = 16;
+
+	void Kb::batch_prank(const vector<const float *> & pvs, const vector<float *> & ranks) const {
+		thr::pool_lease pool(m_prank_pools, glVars::prank::threads);
+		if (m_symmetric) {
+			prank::do_pageRank_batch(sym_csr(), m_vertexN, pvs, ranks,
+									 glVars::prank::num_iterations,
+									 glVars::prank::threshold,
+									 glVars::prank::damping,
+									 m_out_coefs,
+									 glVars::prank::threads, pool.get());
+		} else {
+			prank::do_pageRank_batch(m_in_csr, m_vertexN, pvs, ranks,
+									 glVars::prank::num_iterations,
+									 glVars::prank::threshold,
+									 glVars::prank::damping,
+									 m_out_coefs,
+									 glVars::prank::threads, pool.get());
+		}
+	}
+
+	void Kb::pageRank_ppv_batch(const vector<vector<float> > & ppv_maps,
+								vector<vector<float> > & ranks) const {
+
+		size_t K = ppv_maps.size();
+		ranks.resize(K);
+		if (glVars::prank::impl != glVars::pm || K == 1) {
+			// no batched version, compute one by one
+			for(size_t k = 0; k < K; ++k) {
+				pageRank_ppv(ppv_maps[k], ranks[k]);
+			}
+			return;
+		}
+
+		init_out_coefs();
+		for(size_t k = 0; k < K; ++k) {
+			init_ranks(m_vertexN, ranks[k]);
+		}
+
+		for(size_t first = 0; first < K; first += prank_batch_max) {
+			size_t last = std::min(K, first + prank_batch_max);
+			vector<const float *> pv_ptr;
+			vector<float *> rank_ptr;
+			for(size_t k = first; k < last; ++k) {
+				pv_ptr.push_back(&ppv_maps[k][0]);
+				rank_ptr.push_back(&ranks[k][0]);
+			}
+			batch_prank(pv_ptr, rank_ptr);
+		}
+	}
+
+	// Batched sparse PPV version. Only one dense PV per column of the chunk is
+	// needed.
+
+	void Kb::pageRank_ppv_batch(const vector<sparse_vector_t> & pvs,
+								vector<vector<float> > & ranks) const {
+
+		size_t K = pvs.size();
+		ranks.resize(K);
+		if (glVars::prank::impl != glVars::pm || K == 1) {
+			// no batched version, compute one by one
+			for(size_t k = 0; k < K; ++k) {
+				pageRank_ppv(pvs[k], ranks[k]);
+			}
+			return;
+		}
+
+		init_out_coefs();
+		for(size_t k = 0; k < K; ++k) {
+			init_ranks(m_vertexN, ranks[k]);
+		}
+
+		vector<vector<float> > ppv_maps(std::min(K, prank_batch_max), vector<float>(m_vertexN, 0.0));
+		for(size_t first = 0; first < K; first += prank_batch_max) {
+			size_t last = std::min(K, first + prank_batch_max);
+			vector<const float *> pv_ptr;
+			vector<float *> rank_ptr;
+			for(size_t k = first; k < last; ++k) {
+				scatter_sparse(pvs[k], ppv_maps[k - first]);
+				pv_ptr.push_back(&ppv_maps[k - first][0]);
+				rank_ptr.push_back(&ranks[k][0]);
+			}
+			batch_prank(pv_ptr, rank_ptr);
+			for(size_t k = first; k < last; ++k) {
+				scatter_sparse(pvs[k], ppv_maps[k - first], true);
+			}
+		}
+	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// Debug
@@ -829,7 +2541,7 @@ namespace ukb {
 		graph_traits<Kb::boost_graph_t>::vertex_iterator it, end;
 		tie(it, end) = vertices(*m_g);
 		for(;it != end; ++it) {
-			o << (*m_g)[*it].name;
+			o << get_vertex_name(*it);
 			graph_traits<Kb::boost_graph_t>::out_edge_iterator e, e_end;
 			tie(e, e_end) = out_edges(*it, *m_g);
 			if (e != e_end)
@@ -838,7 +2550,7 @@ namespace ukb {
 				o << "  ";
 				vector<string> r = edge_reltypes(*e);
 				writeV(o, r);
-				o << " " << (*m_g)[target(*e, *m_g)].name;
+				o << " " << get_vertex_name(target(*e, *m_g));
 				o << " (" << (*m_g)[*e].weight << ")\n";
 			}
 		}
@@ -851,27 +2563,218 @@ namespace ukb {
 	static const size_t magic_id_v1 = 0x070201;
 	static const size_t magic_id = 0x080826;
 	static const size_t magic_id_csr = 0x110501;
+	static const boost::uint64_t magic_id_map = 0x261017;
+
+	// Memory mappable binfiles (magic_id_map, see ukbMmap.h)
+	//
+	// The header holds these boost::uint64_t values:
+	//
+	//   magic_id_map, map_version, number of vertices, number of edges,
+	//   number of sections
+	//
+	// Graph indices are written as kb_index_t, and read back as either 32 or
+	// 64 bit integers (see map_index_section).
+
+	static const boost::uint64_t map_version = 1;
+
+	enum map_section_id {
+		sec_meta = 1,      // relation sources, relation types and notes (stream format)
+		sec_fwd_rowstart,  // index[V + 1]
+		sec_fwd_column,    // index[E]
+		sec_bwd_rowstart,  // index[V + 1]
+		sec_bwd_column,    // index[E]
+		sec_bwd_eidx,      // index[E], edge index of each in-edge
+		sec_edge_weight,   // float[E]
+		sec_edge_etype,    // etype_t::value_type[E]
+		sec_name_offset,   // uint64_t[V + 1]
+		sec_name_arena,    // char[]
+		sec_name_index,    // retired (vertices sorted by name)
+		sec_name_hash,     // uint32_t[2^k], name hash table (see vertex_names_t)
+		sec_out_coefs,     // float[V], out-degree coefficients (optional)
+		sec_out_coefs_w,   // float[V], same, using edge weights (optional)
+		sec_static,        // float[4 + V], parameters and static ranks (optional)
+		sec_static_w,      // float[4 + V], same, using edge weights (optional)
+		sec_symmetric      // uint64_t, 1 if the graph is symmetric (no sec_bwd_* sections)
+	};
 
-	// CSR read
+	static const size_t map_header_n = 5;
 
-	vertex_prop_t read_vertex_prop_from_stream(istream & is) {
+	static bool is_mapped_binfile(const char *p, size_t n) {
+		return is_map_file(p, n, magic_id_map);
+	}
 
-		string name;
+	// copy the index array [p, p + n) into v, checking that the values fit
+	// into kb_index_t
 
-		read_atom_from_stream(is, name);
-		return vertex_prop_t(name);
+	template<class T>
+	static void assign_kb_index(const T *p, size_t n, vector<kb_index_t> & v) {
+		if (sizeof(T) > sizeof(kb_index_t)) {
+			for(size_t i = 0; i < n; ++i) {
+				if (p[i] > std::numeric_limits<kb_index_t>::max())
+					check_kb_size(p[i], p[i]);
+			}
+		}
+		v.assign(p, p + n);
 	}
 
-	edge_prop_t read_edge_prop_from_stream(istream & is) {
+	// read index array section id (32 or 64 bit integers) into v
 
-		float w;
-		etype_t::value_type etype;
+	static void map_index_section(const char *base, size_t fsize,
+								  const vector<map_section_t> & secs,
+								  boost::uint64_t id, size_t n, vector<kb_index_t> & v) {
+		if (n && map_section_size(secs, id) == n * sizeof(boost::uint32_t)) {
+			assign_kb_index(map_section_data<boost::uint32_t>(base, fsize, secs, id, n), n, v);
+		} else {
+			assign_kb_index(map_section_data<boost::uint64_t>(base, fsize, secs, id, n), n, v);
+		}
+	}
+
+	// check that rowstart and column hold a valid CSR index of vertex_n
+	// vertices and edge_n edges, so that the sweeps never read out of bounds
+
+	static void check_csr_index(const vector<kb_index_t> & rowstart,
+								const vector<kb_index_t> & column,
+								size_t vertex_n, size_t edge_n) {
+		if (rowstart.size() != vertex_n + 1 || column.size() != edge_n ||
+			rowstart[0] != 0 || rowstart[vertex_n] != edge_n)
+			throw runtime_error("Invalid binfile (bad CSR row index)");
+		for(size_t i = 0; i < vertex_n; ++i) {
+			if (rowstart[i] > rowstart[i + 1])
+				throw runtime_error("Invalid binfile (bad CSR row index)");
+		}
+		for(size_t i = 0; i < edge_n; ++i) {
+			if (column[i] >= vertex_n)
+				throw runtime_error("Invalid binfile (bad CSR column index)");
+		}
+	}
+
+	void Kb::read_from_mapped(std::auto_ptr<mmap_file> & mf) {
+
+		const char *base = mf->data();
+		size_t fsize = mf->size();
+		size_t vertex_n;
+		size_t edge_n;
+		bool symmetric;
+		std::auto_ptr<Kb::boost_graph_t> new_g;
+
+		try {
+			boost::uint64_t h[map_header_n];
+			vector<map_section_t> secs;
+			read_map_sections(base, fsize, h, map_header_n, secs);
+			if (h[1] != map_version)
+				throw runtime_error("Unknown version " + lexical_cast<string>(h[1]) + " (newer ukb?)");
+			vertex_n = h[2];
+			edge_n = h[3];
+			check_kb_size(vertex_n, edge_n);
+
+			// relation sources, types and notes are small, so just read them
+
+			size_t meta_n = map_section_size(secs, sec_meta);
+			const char *meta_p = map_section_data<char>(base, fsize, secs, sec_meta, meta_n);
+			std::istringstream meta(string(meta_p, meta_n));
+			read_set_from_stream(meta, m_relsSource);
+			m_rtypes.read_from_stream(meta);
+			read_vector_from_stream(meta, m_notes);
+
+			// graph structure
+
+			typedef boost::uint64_t u64;
+			const float *weight = map_section_data<float>(base, fsize, secs, sec_edge_weight, edge_n);
+			const etype_t::value_type *etype =
+				map_section_data<etype_t::value_type>(base, fsize, secs, sec_edge_etype, edge_n);
+
+			// vertex names
+
+			const u64 *name_offset = map_section_data<u64>(base, fsize, secs, sec_name_offset, vertex_n + 1);
+			size_t arena_n = map_section_size(secs, sec_name_arena);
+			const char *name_arena = map_section_data<char>(base, fsize, secs, sec_name_arena, arena_n);
+			if (name_offset[vertex_n] != arena_n)
+				throw runtime_error("bad vertex names");
+			// the name hash table is optional (it is rebuilt if missing)
+			size_t hash_n = map_section_size(secs, sec_name_hash) / sizeof(boost::uint32_t);
+			const boost::uint32_t *name_hash = NULL;
+			if (hash_n) {
+				if ((hash_n & (hash_n - 1)) || hash_n <= vertex_n)
+					throw runtime_error("bad vertex name hash table");
+				name_hash = map_section_data<boost::uint32_t>(base, fsize, secs, sec_name_hash, hash_n);
+			}
+
+			// boost's CSR graph owns its arrays, so they are copied in bulk
+			// (and are not shared among processes, unlike the names and
+			// relation types)
+
+			new_g.reset(new Kb::boost_graph_t());
+			map_index_section(base, fsize, secs, sec_fwd_rowstart, vertex_n + 1, new_g->m_forward.m_rowstart);
+			map_index_section(base, fsize, secs, sec_fwd_column, edge_n, new_g->m_forward.m_column);
+			symmetric = map_section_size(secs, sec_symmetric) &&
+				*map_section_data<boost::uint64_t>(base, fsize, secs, sec_symmetric, 1) == 1;
+			if (symmetric) {
+				// in-degrees are the out-degrees
+				new_g->m_backward.m_rowstart = new_g->m_forward.m_rowstart;
+			} else {
+				map_index_section(base, fsize, secs, sec_bwd_rowstart, vertex_n + 1, new_g->m_backward.m_rowstart);
+				map_index_section(base, fsize, secs, sec_bwd_column, edge_n, new_g->m_backward.m_column);
+				map_index_section(base, fsize, secs, sec_bwd_eidx, edge_n, new_g->m_backward.m_edge_properties);
+			}
+			check_csr_index(new_g->m_forward.m_rowstart, new_g->m_forward.m_column, vertex_n, edge_n);
+			if (!symmetric) {
+				check_csr_index(new_g->m_backward.m_rowstart, new_g->m_backward.m_column, vertex_n, edge_n);
+				const vector<kb_index_t> & eidx = new_g->m_backward.m_edge_properties;
+				for(size_t i = 0; i < edge_n; ++i) {
+					if (eidx[i] >= edge_n)
+						throw runtime_error("Invalid binfile (bad backward edge index)");
+				}
+			}
+			new_g->m_forward.m_edge_properties.assign(weight, weight + edge_n);
+			// the relation types are not copied
+			vector<etype_t::value_type>().swap(m_etype_buf);
+			m_etype = edge_n ? etype : NULL;
+
+			m_names.attach(vertex_n, name_offset, name_arena, name_hash, hash_n);
+
+			// precomputed PageRank data (optional)
+
+			clear_precomputed();
+			for(size_t w = 0; w < 2; ++w) {
+				map_section_id cid = w ? sec_out_coefs_w : sec_out_coefs;
+				map_section_id sid = w ? sec_static_w : sec_static;
+				if (vertex_n && map_section_size(secs, cid))
+					m_pre_coefs[w] = map_section_data<float>(base, fsize, secs, cid, vertex_n);
+				if (map_section_size(secs, sid))
+					m_pre_static[w] = map_section_data<float>(base, fsize, secs, sid, pre_static_hdr_n + vertex_n);
+			}
+		} catch (std::exception & e) {
+			throw runtime_error(string("Error when reading serialized graph: ") + e.what());
+		}
+
+		m_g.reset(new_g.release());
+		m_symmetric = symmetric;
+		m_mapped = mf;
+		vector<float>().swap(m_static_ppv); // empty static rank vector
 
+		m_vertexN = vertex_n;
+		m_edgeN = edge_n;
+		assert(num_vertices(*m_g) == m_vertexN);
+		assert(num_edges(*m_g) == m_edgeN);
+	}
+
+	// CSR read (pre-mmap binfiles)
+
+	static void read_edge_prop_from_stream(istream & is, float & w, etype_t::value_type & etype) {
 		read_atom_from_stream(is, w);
 		read_atom_from_stream(is, etype);
+	}
 
-		return edge_prop_t(w, etype);
+	// indices are size_t in these files
 
+	static void read_kb_index_from_stream(istream & is, vector<kb_index_t> & v) {
+		vector<size_t> aux;
+		read_vector_from_stream(is, aux);
+		if (aux.empty()) {
+			v.clear();
+			return;
+		}
+		assign_kb_index(&aux[0], aux.size(), v);
 	}
 
 	void  Kb::read_from_stream (std::istream & is) {
@@ -880,6 +2783,8 @@ namespace ukb {
 		size_t edge_n;
 		size_t id;
 		Kb::boost_graph_t *new_g;
+		vertex_names_t vNames;
+		vector<etype_t::value_type> etypes;
 
 		try {
 			read_atom_from_stream(is, id);
@@ -891,7 +2796,9 @@ namespace ukb {
 			}
 			read_set_from_stream(is, m_relsSource);
 			m_rtypes.read_from_stream(is);
-			read_map_from_stream(is, m_synsetMap);
+			// synset map (the name index is rebuilt from the vertex names)
+			map<string, size_t> synsetMap;
+			read_map_from_stream(is, synsetMap);
 
 			read_atom_from_stream(is, id);
 			if (id != magic_id_csr) {
@@ -905,22 +2812,26 @@ namespace ukb {
 			if (id != magic_id_csr) {
 				throw runtime_error("Invalid id after reading graph sizes");
 			}
+			check_kb_size(vertex_n, edge_n);
 			new_g = new Kb::boost_graph_t();
 
-			new_g->m_forward.m_rowstart.resize(0);
-			read_vector_from_stream(is, new_g->m_forward.m_rowstart);
-			read_vector_from_stream(is, new_g->m_forward.m_column);
-			new_g->m_backward.m_rowstart.resize(0);
-			read_vector_from_stream(is, new_g->m_backward.m_rowstart);
-			read_vector_from_stream(is, new_g->m_backward.m_column);
-			read_vector_from_stream(is, new_g->m_backward.m_edge_properties);
+			read_kb_index_from_stream(is, new_g->m_forward.m_rowstart);
+			read_kb_index_from_stream(is, new_g->m_forward.m_column);
+			read_kb_index_from_stream(is, new_g->m_backward.m_rowstart);
+			read_kb_index_from_stream(is, new_g->m_backward.m_column);
+			read_kb_index_from_stream(is, new_g->m_backward.m_edge_properties);
 
 			for(size_t i = 0; i != vertex_n; ++i) {
-				new_g->vertex_properties().m_vertex_properties.push_back(read_vertex_prop_from_stream(is));
+				string name;
+				read_atom_from_stream(is, name);
+				if (vNames.insert(name) != i)
+					throw runtime_error("Repeated vertex name " + name);
 			}
 
+			new_g->m_forward.m_edge_properties.resize(edge_n);
+			etypes.resize(edge_n);
 			for(size_t i = 0; i != edge_n; ++i) {
-				new_g->m_forward.m_edge_properties.push_back(read_edge_prop_from_stream(is));
+				read_edge_prop_from_stream(is, new_g->m_forward.m_edge_properties[i].weight, etypes[i]);
 			}
 
 			read_atom_from_stream(is, id);
@@ -933,6 +2844,8 @@ namespace ukb {
 		}
 
 		m_g.reset(new_g);
+		set_etypes(etypes);
+		m_names.swap(vNames);
 		vector<float>().swap(m_static_ppv); // empty static rank vector
 
 		m_vertexN = vertex_n;
@@ -941,97 +2854,102 @@ namespace ukb {
 		assert(num_edges(*m_g) == m_edgeN);
 	}
 
-	// write
-
-	ostream & write_vertex_prop_to_stream(ostream & o,
-										  const vertex_prop_t & p) {
-		write_atom_to_stream(o, p.name);
-		return o;
-	}
-
-	ostream & write_edge_prop_to_stream(ostream & o,
-										const edge_prop_t & ep) {
-		write_atom_to_stream(o, ep.weight);
-		write_atom_to_stream(o, ep.etype);
-		return o;
-	}
+	// write (mappable format)
 
 	ostream & Kb::write_to_stream(ostream & o) const {
 
-		// First write maps
-
 		assert(m_vertexN == num_vertices(*m_g));
 		assert(m_edgeN == num_edges(*m_g));
 
-		write_atom_to_stream(o, magic_id_csr);
-
-		write_vector_to_stream(o, m_relsSource);
-		m_rtypes.write_to_stream(o);
-		write_map_to_stream(o, m_synsetMap);
+		// relation sources, types and notes
 
-		write_atom_to_stream(o, magic_id_csr);
+		std::ostringstream meta;
+		write_vector_to_stream(meta, m_relsSource);
+		m_rtypes.write_to_stream(meta);
+		write_vector_to_stream(meta, m_notes);
+		string meta_str(meta.str());
 
-		write_atom_to_stream(o, m_edgeN);
-		write_atom_to_stream(o, m_vertexN);
+		// relation types (all zero if there are none)
 
-		write_atom_to_stream(o, magic_id_csr);
+		vector<etype_t::value_type> no_etype;
+		if (!m_etype) no_etype.resize(m_edgeN, 0);
+		const etype_t::value_type *etype = m_etype ? m_etype : (m_edgeN ? &no_etype[0] : NULL);
 
-		write_vector_to_stream(o, m_g->m_forward.m_rowstart);
-		write_vector_to_stream(o, m_g->m_forward.m_column);
-		write_vector_to_stream(o, m_g->m_backward.m_rowstart);
-		write_vector_to_stream(o, m_g->m_backward.m_column);
-		write_vector_to_stream(o, m_g->m_backward.m_edge_properties);
+		size_t rowstart_bytes = (m_vertexN + 1) * sizeof(kb_index_t);
+		size_t column_bytes = m_edgeN * sizeof(kb_index_t);
 
-		//	write_vector_to_stream(o, m_g->vertex_properties().m_vertex_properties);
-		//	write_vector_to_stream(o, m_g->m_forward.m_edge_properties);
-
-		size_t vProp_n = m_g->vertex_properties().m_vertex_properties.size();
-		assert(vProp_n == m_vertexN);
-		for(size_t i = 0; i != vProp_n; ++i) {
-			write_vertex_prop_to_stream(o, m_g->vertex_properties().m_vertex_properties[i]);
+		vector<map_section_t> secs;
+		secs.push_back(map_section_t(sec_meta, meta_str.data(), meta_str.size()));
+		secs.push_back(map_section_t(sec_fwd_rowstart, &m_g->m_forward.m_rowstart[0], rowstart_bytes));
+		secs.push_back(map_section_t(sec_fwd_column, m_edgeN ? &m_g->m_forward.m_column[0] : NULL, column_bytes));
+		// the in-edges of symmetric graphs are not stored
+		boost::uint64_t symmetric = m_symmetric || csr_is_symmetric(*m_g, m_etype);
+		if (symmetric) {
+			secs.push_back(map_section_t(sec_symmetric, &symmetric, sizeof(symmetric)));
+		} else {
+			secs.push_back(map_section_t(sec_bwd_rowstart, &m_g->m_backward.m_rowstart[0], rowstart_bytes));
+			secs.push_back(map_section_t(sec_bwd_column, m_edgeN ? &m_g->m_backward.m_column[0] : NULL, column_bytes));
+			secs.push_back(map_section_t(sec_bwd_eidx, m_edgeN ? &m_g->m_backward.m_edge_properties[0] : NULL, column_bytes));
 		}
-
-		size_t eProp_n = m_g->m_forward.m_edge_properties.size();
-		assert(eProp_n == m_edgeN);
-		for(size_t i = 0; i != eProp_n; ++i) {
-			write_edge_prop_to_stream(o, m_g->m_forward.m_edge_properties[i]);
+		secs.push_back(map_section_t(sec_edge_weight, m_edgeN ? &m_g->m_forward.m_edge_properties[0].weight : NULL, m_edgeN * sizeof(float)));
+		secs.push_back(map_section_t(sec_edge_etype, etype, m_edgeN * sizeof(etype_t::value_type)));
+		secs.push_back(map_section_t(sec_name_offset, m_names.offsets(), (m_vertexN + 1) * sizeof(boost::uint64_t)));
+		secs.push_back(map_section_t(sec_name_arena, m_names.arena(), m_names.arena_size()));
+		secs.push_back(map_section_t(sec_name_hash, m_names.hash_table(), m_names.hash_size() * sizeof(boost::uint32_t)));
+		for(size_t w = 0; w < 2; ++w) {
+			if (m_pre_coefs[w])
+				secs.push_back(map_section_t(w ? sec_out_coefs_w : sec_out_coefs, m_pre_coefs[w], m_vertexN * sizeof(float)));
+			if (m_pre_static[w])
+				secs.push_back(map_section_t(w ? sec_static_w : sec_static, m_pre_static[w],
+											 (pre_static_hdr_n + m_vertexN) * sizeof(float)));
 		}
 
-		write_atom_to_stream(o, magic_id_csr);
-
-		write_vector_to_stream(o, m_notes);
-		return o;
+		boost::uint64_t h[map_header_n] = { magic_id_map, map_version, m_vertexN, m_edgeN, 0 };
+		return write_map_sections(o, h, map_header_n, secs);
 	}
 
 
 	void Kb::write_to_binfile (const string & fName) {
 
+		merge_delta();
+
 		ofstream fo(fName.c_str(),  ofstream::binary|ofstream::out);
 		if (!fo) {
 			cerr << "Error: can't create" << fName << endl;
 			exit(-1);
 		}
 		write_to_stream(fo);
+		fo.close();
+		if (!fo) {
+			throw runtime_error("Error when writing serialized graph " + fName + " (disk full?)");
+		}
 	}
 
 	// text write
 
+	static void write_txt_edge(ostream & o, const string & u_str, const string & v_str,
+							   const vector<string> & r) {
+		if (r.size()) {
+			for(vector<string>::const_iterator rit = r.begin(), rend = r.end();
+				rit != rend; ++rit) {
+				o << "u:" << u_str << " v:" << v_str << " t:" << *rit << " d:1\n";
+			}
+		} else {
+			o << "u:" << u_str << " v:" << v_str << " d:1\n";
+		}
+	}
+
 	ostream & Kb::write_to_textstream(ostream & o) const {
 
 		graph_traits<Kb::boost_graph_t>::edge_iterator it, end;
 		tie(it, end) = edges(*m_g);
 		for(;it != end; ++it) {
-			const string & u_str = (*m_g)[source(*it, *m_g)].name;
-			const string & v_str = (*m_g)[target(*it, *m_g)].name;
-			vector<string> r = edge_reltypes(*it);
-			if (r.size()) {
-				for(vector<string>::const_iterator rit = r.begin(), rend = r.end();
-					rit != rend; ++rit) {
-					o << "u:" << u_str << " v:" << v_str << " s:" << *rit << " d:1\n";
-				}
-			} else {
-				o << "u:" << u_str << " v:" << v_str << " d:1\n";
-			}
+			write_txt_edge(o, get_vertex_name(source(*it, *m_g)), get_vertex_name(target(*it, *m_g)),
+						   edge_reltypes(*it));
+		}
+		for(size_t i = 0; i < m_delta.size(); ++i) {
+			write_txt_edge(o, get_vertex_name(m_delta.E[i].first), get_vertex_name(m_delta.E[i].second),
+						   m_rtypes.tvector(m_delta.eProp[i].etype));
 		}
 		return o;
 	}
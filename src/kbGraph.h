@@ -14,6 +14,8 @@
 
 #include "kbGraph_common.h"
 #include "kbGraph_v16.h"
+#include "ukbThreads.h"
+#include "ukbMmap.h"
 
 // graph
 
@@ -40,14 +42,21 @@ using boost::edge_weight;
 
 namespace ukb {
 
+	struct txt_rel_t; // see kbGraph.cc
 
 	class Kb {
 
 	public:
 
+		// Vertex names are not stored in the graph (see get_vertex_name), and
+		// neither are the relation types of edges (see edge_reltypes)
+
 		typedef compressed_sparse_row_graph<boost::bidirectionalS,
-											vertex_prop_t,
-											edge_prop_t> boost_graph_t;
+											boost::no_property,
+											kb_edge_t,
+											boost::no_property,
+											kb_index_t,
+											kb_index_t> boost_graph_t;
 
 		typedef graph_traits<boost_graph_t>::vertex_descriptor vertex_descriptor;
 		typedef graph_traits<boost_graph_t>::vertex_iterator vertex_iterator;
@@ -64,7 +73,8 @@ namespace ukb {
 		// 1. create_from_txt
 		//    Create graph by reading a textfile with synset relations (synsFile)
 		//    If glVars::kb::filter_src is true, exclude input relations not in
-		//    rels_source set
+		//    rels_source set. The input is parsed by glVars::kb::threads
+		//    threads.
 
 		static void create_from_txt(const std::string & synsFile,
 									const std::set<std::string> & rels_source);
@@ -77,13 +87,17 @@ namespace ukb {
 
 
 		// 2. create_from_binfile
-		//    Load a binary snapshot of the graph into memory
+		//    Load a binary snapshot of the graph into memory. Binfiles
+		//    written by write_to_binfile are memory mapped, and the vertex
+		//    names are used straight from the mapped file. Older binfiles
+		//    are read as usual.
 
 		static void create_from_binfile(const std::string & o);
 
 
 		// write_to_binfile
-		// Write kb graph to a binary serialization file
+		// Write kb graph to a binary serialization file (memory mappable
+		// format). The delta overlay, if any, is merged first.
 
 		void write_to_binfile (const std::string & str);
 
@@ -98,6 +112,13 @@ namespace ukb {
 
 		// read_from_txt
 		// add relations from synsFile to the graph
+		//
+		// If the graph is already there (e.g. loaded from a binfile), the
+		// new relations go to the delta overlay (see kb_delta_t), without
+		// rebuilding the graph. The PageRank functions take the overlay into
+		// account, but the rest of graph algorithms (and out_neighbors,
+		// in_neighbors, etc.) only see the CSR graph until the overlay is
+		// merged (see merge_delta).
 
 		void read_from_txt(const std::string & synsFile,
 						   const std::set<std::string> & rels_source);
@@ -107,6 +128,15 @@ namespace ukb {
 		void read_from_txt(std::istream & is,
 						   const std::set<std::string> & rels_source);
 
+		// merge_delta
+		// Fold the delta overlay into a new CSR graph
+
+		void merge_delta();
+
+		// number of edges in the delta overlay
+
+		size_t delta_size() const { return m_delta.size(); }
+
 		// add_relSource
 		// add a new relation source
 
@@ -133,19 +163,29 @@ namespace ukb {
 
 		// ask for node properties
 
-		std::string & get_vertex_name(vertex_descriptor u) {return (*m_g)[u].name;}
-		const std::string & get_vertex_name(vertex_descriptor u) const {return (*m_g)[u].name;}
+		std::string get_vertex_name(vertex_descriptor u) const {return m_names.name(u);}
 		//std::string  get_vertex_gloss(vertex_descriptor u) const {return get(vertex_gloss, g, u);}
 
 		// Get vertices iterator
 
 		std::pair<vertex_iterator, vertex_iterator> get_vertices() { return boost::vertices(*m_g); }
 
-		// Get out-edges for vertex u
+		// Get out-edges for vertex u (in_neighbors builds the in-edges of
+		// symmetric graphs first, see is_symmetric)
 
 		std::pair<out_edge_iterator, out_edge_iterator> out_neighbors(vertex_descriptor u);
 		std::pair<in_edge_iterator, in_edge_iterator> in_neighbors(vertex_descriptor u);
 
+		// Whether the graph is symmetric, that is, every edge u->v has a
+		// reverse edge v->u with the same weight and relation types (as in
+		// graphs compiled with --undirected). Binfiles of symmetric graphs do
+		// not store the in-edges, as they are just the out-edges reversed, and
+		// neither does Kb when loading them. The in-edges are built again
+		// (and the graph is no longer taken as symmetric) before any change
+		// to the graph.
+
+		bool is_symmetric() const { return m_symmetric; }
+
 		bool exists_edge(vertex_descriptor u, vertex_descriptor v) const {
 			return edge(u, v, *m_g).second;
 		}
@@ -153,7 +193,10 @@ namespace ukb {
 		vertex_descriptor edge_source(edge_descriptor e) const { return source(e, *m_g); }
 		vertex_descriptor edge_target(edge_descriptor e) const { return target(e, *m_g); }
 
-		// ask for edge preperties
+		// ask for edge preperties. Relation types are kept in an array of
+		// their own, indexed by edge, which is used in place when the graph
+		// comes from a binfile, so it is only read when relation types are
+		// asked for.
 
 		std::vector<std::string> edge_reltypes(edge_descriptor e) const;
 
@@ -164,6 +207,11 @@ namespace ukb {
 
 		const std::vector<float> & static_prank() const;
 
+		// Note on threads: the read-only functions of Kb, including the PageRank
+		// functions when given a workspace each, can be called concurrently
+		// from many threads. Functions that modify the graph (adding edges or
+		// changing weights) can not.
+
 		// Given a previously calculated rank vector, output 2 vector, probably
 		// filtering the nodes.
 		//
@@ -186,6 +234,26 @@ namespace ukb {
 								 int filter_mode) const;
 
 
+		// Renumber the vertices, so that vertices which are close in the graph
+		// get close ids. This improves the cache locality of the graph
+		// algorithms (PageRank in particular). Methods are:
+		//
+		//   degree -> by decreasing degree
+		//   bfs    -> breadth first order
+		//   rcm    -> reverse Cuthill-McKee
+		//   rabbit -> Rabbit order (community based)
+
+		void reorder_vertices(const std::string & method);
+
+		// Compute the out-degree coefficients (with and without edge
+		// weights) and the static PageRank vectors with the current
+		// PageRank parameters, and keep them so that write_to_binfile stores
+		// them in the binfile. When such a binfile is loaded, PageRank uses
+		// them instead of computing them again, as long as the parameters
+		// are the same.
+
+		void precompute_prank();
+
 		// Add a comment to graph
 
 		void add_comment(const std::string & str);
@@ -215,8 +283,78 @@ namespace ukb {
 
 		bool dijkstra (vertex_descriptor src, std::vector<vertex_descriptor> & parents) const;
 
+		// Multi-source BFS. Find the shortest paths from each of the sources
+		// to each of its targets (targets[i] being those of sources[i]).
+		// paths has one path for every (source, target) pair, in order. All
+		// the sources are traversed at once, 64 sources per traversal, whose
+		// frontiers are sets of (vertex, bitmask of sources) pairs, and each
+		// traversal stops as soon as all the targets of its sources are
+		// reached. The paths are the same bfs would find.
+
+		void bfs_multi(const std::vector<vertex_descriptor> & sources,
+					   const std::vector<std::vector<vertex_descriptor> > & targets,
+					   kb_paths_t & paths) const;
+
+		// Shortest weighted paths from each of the sources to each of its
+		// targets, the same way bfs_multi does. Each Dijkstra stops as soon
+		// as all the targets of its source are settled. The sources are
+		// split among ws.size() threads, each using its own workspace. The
+		// paths are the same dijkstra would find.
+
+		void dijkstra_multi(const std::vector<vertex_descriptor> & sources,
+							const std::vector<std::vector<vertex_descriptor> > & targets,
+							kb_paths_t & paths,
+							std::vector<dijkstra_workspace_t> & ws) const;
+
+		// Depth-limited DFS from each of the sources. Vertices are visited
+		// in the same order as with boost's depth_first_visit, each at most
+		// once per source, and the out-edges of those at depth max_depth are
+		// not followed. edges gets, for each source, the edges of the DFS
+		// paths to the targets (sorted) it visits. The sources are split
+		// among ws.size() threads, each using its own workspace.
+
+		void dfs_multi(const std::vector<vertex_descriptor> & sources,
+					   const std::vector<vertex_descriptor> & targets,
+					   size_t max_depth,
+					   kb_edges_t & edges,
+					   std::vector<dfs_workspace_t> & ws) const;
+
 		void pageRank_ppv(const std::vector<float> & ppv_map,
-						  std::vector<float> & ranks);
+						  std::vector<float> & ranks) const;
+
+		// Same, but the personalization vector is sparse
+
+		void pageRank_ppv(const sparse_vector_t & pv,
+						  std::vector<float> & ranks) const;
+
+		// Same as above, but using the buffers of a caller-owned workspace
+		// instead of allocating new ones. ws must not be shared among threads.
+
+		void pageRank_ppv(const std::vector<float> & ppv_map,
+						  std::vector<float> & ranks,
+						  PrankWorkspace & ws) const;
+
+		void pageRank_ppv(const sparse_vector_t & pv,
+						  std::vector<float> & ranks,
+						  PrankWorkspace & ws) const;
+
+		// Compute many personalized PageRank vectors at once, sharing each sweep
+		// over the graph among all of them. ranks[i] is the PPV of ppv_maps[i].
+
+		void pageRank_ppv_batch(const std::vector<std::vector<float> > & ppv_maps,
+								std::vector<std::vector<float> > & ranks) const;
+
+		void pageRank_ppv_batch(const std::vector<sparse_vector_t> & pvs,
+								std::vector<std::vector<float> > & ranks) const;
+
+		// Approximate PPV (PageRank-nibble) for a sparse personalization
+		// vector. ranks is sparse, too. The buffers of ws are reused across
+		// calls, so the cost only depends on the vertices touched by the
+		// algorithm.
+
+		void pageRank_nibble(const sparse_vector_t & pv,
+							 sparse_vector_t & ranks,
+							 nibble_workspace_t & ws) const;
 
 		void ppv_weights(const std::vector<float> & ppv);
 
@@ -252,32 +390,77 @@ namespace ukb {
 		static Kb * create();
 
 		// Private methods
-		Kb() : m_g(NULL), m_vertexN(0), m_edgeN(0) {};
+		Kb() : m_g(NULL), m_symmetric(false), m_etype(NULL), m_vertexN(0), m_edgeN(0) { clear_precomputed(); };
 		Kb(const Kb &) {};
 		Kb &operator=(const Kb &);
 		~Kb() {};
 
 		vertex_descriptor InsertNode(const std::string & name, unsigned char flags);
-
-		void read_from_stream (std::istream & o);
+		void init_out_coefs() const;
+		void reset_out_coefs();
+		void clear_precomputed();
+		void expand_symmetric();
+		sym_csr_t sym_csr() const;
+		void batch_prank(const std::vector<const float *> & pvs,
+						 const std::vector<float *> & ranks) const;
+		etype_t::value_type edge_etype(size_t eidx) const { return m_etype ? m_etype[eidx] : 0; }
+		etype_t::value_type & edge_etype_ref(size_t eidx);
+		void set_etypes(std::vector<etype_t::value_type> & etypes);
+
+		void add_delta(const vertex_names_t & names,
+					   const std::vector<txt_rel_t> & rels,
+					   const etype_t & rtypes);
+
+		void read_from_stream (std::istream & o);    // pre-mmap binfiles
+		void read_from_mapped(std::auto_ptr<mmap_file> & mf);
 		std::ostream & write_to_stream(std::ostream & o) const;
 		// Private members
 		std::auto_ptr<boost_graph_t> m_g;
+		std::auto_ptr<mmap_file> m_mapped;              // mapped binfile, if any
+		bool m_symmetric;                                // no in-edges stored (see is_symmetric)
 		std::set<std::string> m_relsSource;              // Relation sources
-		std::map<std::string, vertex_descriptor> m_synsetMap; // synset name to vertex id
+		vertex_names_t m_names;                          // vertex names and name index
+		kb_delta_t m_delta;                              // edges added to the CSR graph
 
 		// Registered relation types
 
 		etype_t m_rtypes;
 
+		// Relation types of edges, either owned (m_etype_buf) or in the mapped
+		// binfile. NULL means that no edge has relation types.
+
+		const etype_t::value_type * m_etype;
+		std::vector<etype_t::value_type> m_etype_buf;
+
 		std::vector<std::string> m_notes;        // Command line which created the graph
 
 		// Aux variables
 
-		std::vector<float> m_out_coefs;          // aux. vector of out-degree coefficients
+		mutable std::vector<float> m_out_coefs;  // aux. vector of out-degree coefficients
+		mutable in_csr_t m_in_csr;               // aux. flat in-edges for PageRank
 		size_t m_vertexN;                        // Number of vertices
 		size_t m_edgeN;                          // Number of edges
-		std::vector<float> m_static_ppv;         // aux. vector with static prank computation
+		mutable std::vector<float> m_static_ppv; // aux. vector with static prank computation
+
+		// Data computed by precompute_prank, either owned (the m_pre_buf
+		// vectors) or in the mapped binfile. Pointers are NULL if there is no
+		// such data. Index 0 is without edge weights and 1 with them.
+
+		const float * m_pre_coefs[2];            // out-degree coefficients
+		const float * m_pre_static[2];           // PageRank parameters and static ranks
+		std::vector<float> m_pre_buf[4];
+
+		// Aux variables are lazily initialized. These mutexes serialize the
+		// initialization when Kb is used by many threads.
+
+		mutable thr::mutex m_coefs_mutex;        // for m_out_coefs and m_in_csr
+		mutable thr::mutex m_static_mutex;       // for m_static_ppv
+
+		// Threads of the multithreaded power method (see --prank_threads).
+		// They are started by the first PageRank call and reused by the
+		// following ones. Each concurrent call takes its own pool.
+
+		mutable thr::pool_set m_prank_pools;
 	};
 }
 
@@ -1,5 +1,7 @@
 #include "kbGraph_common.h"
 
+#include <algorithm>
+
 namespace ukb {
 
 	using namespace std;
@@ -39,14 +41,11 @@ namespace ukb {
 		std::vector<std::string> res;
 		if (m_strtypes.size() == 0) return res;
 
-		std::vector<std::string>::size_type idx = 0;
-		value_type i(1);
-		while(idx < 32) {
-			if (val & i) {
+		// type m_strtypes[idx] is bit idx + 1 (see strpos)
+		for(std::vector<std::string>::size_type idx = 0; idx < m_strtypes.size(); ++idx) {
+			if (val & (value_type(1) << (idx + 1))) {
 				res.push_back(m_strtypes[idx]);
 			}
-			idx++;
-			i <<= 1;
 		}
 		return res;
 	}
@@ -72,27 +71,266 @@ namespace ukb {
 	}
 
 	size_t etype_t::stradd(const std::string & tstr) {
-		m_strtypes.push_back(tstr);
-		size_t pos = m_strtypes.size();
-		if (pos > 32)
+		size_t pos = m_strtypes.size() + 1;
+		if (pos > 31) // bits 1 to 31 of value_type
 			throw std::runtime_error("etype_t:::add_type error: too many relation types !");
+		m_strtypes.push_back(tstr);
 		return pos;
 	}
 
-	// precsr_t
+	// vertex_names_t
 
+	const boost::uint32_t vertex_names_t::no_vertex;
 
-	size_t precsr_t::insert_vertex(const std::string & ustr) {
+	vertex_names_t::vertex_names_t()
+		: m_n(0), m_offset(NULL), m_arena(NULL), m_hash(NULL), m_hash_mask(0), m_owned(true),
+		  m_offset_buf(1, 0), m_hash_buf(16, no_vertex) {
+		sync();
+	}
+
+	// FNV-1a, folded to mix the high bits into the low ones
+
+	boost::uint64_t vertex_names_t::hash(const char * str, size_t len) {
+		boost::uint64_t h = 14695981039346656037ULL;
+		for(size_t i = 0; i < len; ++i) {
+			h ^= static_cast<unsigned char>(str[i]);
+			h *= 1099511628211ULL;
+		}
+		return h ^ (h >> 32);
+	}
+
+	// slot of name [str, str + len), or the empty slot where it should go
+
+	size_t vertex_names_t::find_slot(const char * str, size_t len, boost::uint64_t h) const {
+		size_t i = h & m_hash_mask;
+		while(1) {
+			boost::uint32_t v = m_hash[i];
+			if (v == no_vertex) return i;
+			size_t vlen = m_offset[v + 1] - m_offset[v];
+			if (vlen == len && char_traits<char>::compare(m_arena + m_offset[v], str, len) == 0)
+				return i;
+			i = (i + 1) & m_hash_mask;
+		}
+	}
 
+	bool vertex_names_t::find(const std::string & str, size_t & v) const {
+		size_t i = find_slot(str.data(), str.size(), hash(str.data(), str.size()));
+		if (m_hash[i] == no_vertex) {
+			if (!m_extra.get() || !m_extra->find(str, v)) return false;
+			v += m_n;
+			return true;
+		}
+		v = m_hash[i];
+		return true;
+	}
+
+	size_t vertex_names_t::insert(const char * str, size_t len) {
+		boost::uint64_t h = hash(str, len);
+		size_t i = find_slot(str, len, h);
+		if (m_hash[i] != no_vertex) return m_hash[i];
+		if (size() + 1 >= size_t(no_vertex))
+			throw std::runtime_error("vertex_names_t: too many vertices");
+		if (!m_owned) {
+			if (!m_extra.get()) m_extra.reset(new vertex_names_t);
+			return m_n + m_extra->insert(str, len);
+		}
+		m_arena_buf.insert(m_arena_buf.end(), str, str + len);
+		m_offset_buf.push_back(m_arena_buf.size());
+		size_t v = m_n;
+		++m_n;
+		sync();
+		if (2 * m_n > m_hash_buf.size()) {
+			rehash(2 * m_hash_buf.size());
+		} else {
+			m_hash_buf[i] = v;
+		}
+		return v;
+	}
+
+	void vertex_names_t::rehash(size_t hsize) {
+		vector<boost::uint32_t>(hsize, no_vertex).swap(m_hash_buf);
+		m_hash = &m_hash_buf[0];
+		m_hash_mask = hsize - 1;
+		for(size_t v = 0; v < m_n; ++v) {
+			const char * str = m_arena + m_offset[v];
+			size_t len = m_offset[v + 1] - m_offset[v];
+			m_hash_buf[find_slot(str, len, hash(str, len))] = v;
+		}
+	}
+
+	// point to the owned arrays
+
+	void vertex_names_t::sync() {
+		m_offset = &m_offset_buf[0];
+		m_arena = m_arena_buf.size() ? &m_arena_buf[0] : NULL;
+		m_hash = &m_hash_buf[0];
+		m_hash_mask = m_hash_buf.size() - 1;
+	}
+
+	void vertex_names_t::attach(size_t n,
+								const boost::uint64_t * offset,
+								const char * arena,
+								const boost::uint32_t * hash,
+								size_t hash_size) {
+		vector<boost::uint64_t>().swap(m_offset_buf);
+		vector<char>().swap(m_arena_buf);
+		vector<boost::uint32_t>().swap(m_hash_buf);
+		m_extra.reset();
+		m_owned = false;
+		m_n = n;
+		m_offset = offset;
+		m_arena = arena;
+		if (hash) {
+			m_hash = hash;
+			m_hash_mask = hash_size - 1;
+			return;
+		}
+		size_t hsize = 16;
+		while (hsize < 2 * n) hsize *= 2;
+		rehash(hsize);
+	}
+
+	void vertex_names_t::swap(vertex_names_t & o) {
+		std::swap(m_n, o.m_n);
+		std::swap(m_offset, o.m_offset);
+		std::swap(m_arena, o.m_arena);
+		std::swap(m_hash, o.m_hash);
+		std::swap(m_hash_mask, o.m_hash_mask);
+		std::swap(m_owned, o.m_owned);
+		m_offset_buf.swap(o.m_offset_buf);
+		m_arena_buf.swap(o.m_arena_buf);
+		m_hash_buf.swap(o.m_hash_buf);
+		vertex_names_t * extra = m_extra.release();
+		m_extra.reset(o.m_extra.release());
+		o.m_extra.reset(extra);
+	}
+
+	// kb_delta_t
+
+	size_t kb_delta_t::insert_edge(size_t u, size_t v, float w, etype_t::value_type etype) {
+		boost::unordered_map<vertex_pair_t, size_t>::iterator it;
 		bool insertedP;
-		vertex_map_t::iterator vit;
+		boost::tie(it, insertedP) = m_eMap.insert(std::make_pair(std::make_pair(u, v), E.size()));
+		if (insertedP) {
+			E.push_back(std::make_pair(u, v));
+			eProp.push_back(edge_prop_t());
+			out[u].push_back(it->second);
+			in[v].push_back(it->second);
+		}
+		eProp[it->second].etype |= etype;
+		eProp[it->second].weight = w;
+		return it->second;
+	}
 
-		boost::tie(vit, insertedP) = m_vMap.insert(std::make_pair(ustr, m_vsize));
-		if(insertedP) {
-			vProp.push_back(vertex_prop_t(ustr));
-			++m_vsize;
+	const std::vector<size_t> * kb_delta_t::out_edges(size_t u) const {
+		adj_t::const_iterator it = out.find(u);
+		return it == out.end() ? NULL : &it->second;
+	}
+
+	const std::vector<size_t> * kb_delta_t::in_edges(size_t v) const {
+		adj_t::const_iterator it = in.find(v);
+		return it == in.end() ? NULL : &it->second;
+	}
+
+	void kb_delta_t::clear() {
+		vector<vertex_pair_t>().swap(E);
+		vector<edge_prop_t>().swap(eProp);
+		adj_t().swap(out);
+		adj_t().swap(in);
+		boost::unordered_map<vertex_pair_t, size_t>().swap(m_eMap);
+	}
+
+	// sparse_vector_t
+
+	static bool sparse_elem_less(const pair<size_t, float> & a,
+								 const pair<size_t, float> & b) {
+		return a.first < b.first;
+	}
+
+	void sort_sparse_vector(sparse_vector_t & sv) {
+		std::stable_sort(sv.begin(), sv.end(), sparse_elem_less);
+		sparse_vector_t::iterator out = sv.begin();
+		sparse_vector_t::const_iterator it = sv.begin();
+		sparse_vector_t::const_iterator end = sv.end();
+		while(it != end) {
+			pair<size_t, float> elem = *it;
+			for(++it; it != end && it->first == elem.first; ++it) {
+				elem.second += it->second;
+			}
+			if (elem.second != 0.0f) *out++ = elem;
 		}
-		return vit->second;
+		sv.erase(out, sv.end());
+	}
+
+	// nibble_workspace_t
+
+	void nibble_workspace_t::start(size_t N) {
+		if (seen.size() != N) {
+			vector<float>(N, 0.0f).swap(r);
+			vector<float>(N, 0.0f).swap(p);
+			vector<boost::uint32_t>(N, 0).swap(seen);
+			vector<boost::uint32_t>(N, 0).swap(inq);
+			epoch = 0;
+		}
+		touched.clear();
+		Q.clear();
+		++epoch;
+		if (epoch == 0) {
+			// wrapped around, clear old stamps
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(inq.begin(), inq.end(), 0);
+			epoch = 1;
+		}
+	}
+
+	// dijkstra_workspace_t
+
+	const kb_index_t dijkstra_workspace_t::no_pos;
+
+	void dijkstra_workspace_t::start(size_t N) {
+		if (seen.size() != N) {
+			vector<float>(N, 0.0f).swap(dist);
+			vector<kb_index_t>(N, 0).swap(parent);
+			vector<kb_index_t>(N, no_pos).swap(pos);
+			vector<boost::uint32_t>(N, 0).swap(seen);
+			vector<boost::uint32_t>(N, 0).swap(want);
+			epoch = 0;
+		}
+		heap.clear();
+		++epoch;
+		if (epoch == 0) {
+			// wrapped around, clear old stamps
+			std::fill(seen.begin(), seen.end(), 0);
+			std::fill(want.begin(), want.end(), 0);
+			epoch = 1;
+		}
+	}
+
+	// dfs_workspace_t
+
+	void dfs_workspace_t::start(size_t N) {
+		if (seen.size() != N) {
+			vector<boost::uint32_t>(N, 0).swap(seen);
+			epoch = 0;
+		}
+		stack.clear();
+		path.clear();
+		++epoch;
+		if (epoch == 0) {
+			// wrapped around, clear old stamps
+			std::fill(seen.begin(), seen.end(), 0);
+			epoch = 1;
+		}
+	}
+
+	// precsr_t
+
+
+	size_t precsr_t::insert_vertex(const std::string & ustr) {
+
+		size_t v = vNames.insert(ustr);
+		m_vsize = vNames.size();
+		return v;
 	}
 
 	size_t precsr_t::insert_edge(const std::string & ustr,
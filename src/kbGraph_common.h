@@ -12,8 +12,10 @@
 
 #include <utility>
 #include <vector>
+#include <deque>
 #include <map>
 #include <string>
+#include <memory>
 #include <boost/cstdint.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/tuple/tuple.hpp>   // for "tie"
@@ -24,6 +26,16 @@ namespace ukb {
 
 	class Kb; // forward decl.
 
+	// Integer type for the vertex and edge indices of the KB graph. 32 bit
+	// indices halve the memory (and memory bandwidth) used by the graph
+	// arrays. Define UKB_CSR64 (make UKB_CSR64=1) for KBs with more edges.
+
+#ifdef UKB_CSR64
+	typedef boost::uint64_t kb_index_t;
+#else
+	typedef boost::uint32_t kb_index_t;
+#endif
+
 	// A class for dealing with edge types
 
 	class etype_t {
@@ -57,14 +69,7 @@ namespace ukb {
 		std::vector<std::string> m_strtypes;
 	};
 
-	// Vertex and edge properties
-
-	struct vertex_prop_t {
-		std::string name;
-
-		vertex_prop_t() : name(std::string()) {}
-		vertex_prop_t(const std::string & str) : name(str) {}
-	};
+	// Edge properties
 
 	struct edge_prop_t {
 		float weight;
@@ -75,6 +80,405 @@ namespace ukb {
 		edge_prop_t(float w, etype_t::value_type et) : weight(w), etype(et) {}
 	};
 
+	// Edge properties of the KB graph. The graph only keeps the weights,
+	// which is what the graph algorithms read, and the relation types are
+	// stored in a separate array (see Kb::edge_reltypes).
+
+	struct kb_edge_t {
+		float weight;
+
+		kb_edge_t() : weight(0.0f) {}
+		kb_edge_t(float w) : weight(w) {}
+	};
+
+	// Vertex names.
+	//
+	// The names are stored one after the other in a character arena, the
+	// name of vertex v being [offset[v], offset[v+1]). Names are found
+	// through an open addressing hash table (linear probing) whose slots
+	// hold vertex ids, or no_vertex for empty slots. The table has a power
+	// of two size and is at most half full.
+	//
+	// The arrays are either owned by the object, and then new names can be
+	// added with insert, or point to external memory, e.g. a memory mapped
+	// binfile (see attach). In the latter case the external arrays are
+	// read-only, and inserted names go to a second (owned) table, whose
+	// vertices follow the external ones.
+
+	class vertex_names_t {
+	public:
+
+		static const boost::uint32_t no_vertex = 0xFFFFFFFF;
+
+		vertex_names_t();
+
+		size_t size() const { return m_n + (m_extra.get() ? m_extra->size() : 0); }
+
+		std::string name(size_t v) const {
+			if (v >= m_n) return m_extra->name(v - m_n);
+			return std::string(m_arena + m_offset[v], m_arena + m_offset[v + 1]);
+		}
+
+		// find the vertex named str
+		bool find(const std::string & str, size_t & v) const;
+
+		// add a new name (if not already there) and return its vertex
+		size_t insert(const std::string & str) { return insert(str.data(), str.size()); }
+		size_t insert(const char * str, size_t len);
+
+		// use external arrays, which must outlive the object. If hash is
+		// NULL, an (owned) hash table is built from the names.
+		void attach(size_t n,
+					const boost::uint64_t * offset,
+					const char * arena,
+					const boost::uint32_t * hash,
+					size_t hash_size);
+
+		void swap(vertex_names_t & o);
+
+		// whether there are names out of the raw arrays (see insert)
+		bool has_extra() const { return m_extra.get() && m_extra->size(); }
+
+		// raw arrays
+		const boost::uint64_t * offsets() const { return m_offset; }
+		const char * arena() const { return m_arena; }
+		size_t arena_size() const { return m_offset[m_n]; }
+		const boost::uint32_t * hash_table() const { return m_hash; }
+		size_t hash_size() const { return m_hash_mask + 1; }
+
+		// Hash function of names. It is part of the binfile format, so it
+		// must not change.
+		static boost::uint64_t hash(const char * str, size_t len);
+
+	private:
+
+		vertex_names_t(const vertex_names_t &);
+		vertex_names_t &operator=(const vertex_names_t &);
+
+		size_t find_slot(const char * str, size_t len, boost::uint64_t h) const;
+		void rehash(size_t hsize);
+		void sync();
+
+		size_t m_n;
+		const boost::uint64_t * m_offset;
+		const char * m_arena;
+		const boost::uint32_t * m_hash;
+		size_t m_hash_mask;
+
+		// storage when owned
+		bool m_owned;
+		std::vector<boost::uint64_t> m_offset_buf;
+		std::vector<char> m_arena_buf;
+		std::vector<boost::uint32_t> m_hash_buf;
+
+		// names inserted when not owned
+		std::auto_ptr<vertex_names_t> m_extra;
+	};
+
+	// Flat in-edge CSR used by the PageRank kernels (structure of arrays).
+	//
+	// The in-edges u->v of vertex v are stored in positions
+	// [rowstart[v], rowstart[v+1]). src holds the source vertex u, and w the
+	// weight of the edge already multiplied by the out-degree coefficient of
+	// u, so that one step of the power method for v is just
+	// sum(rank[src[i]] * w[i]).
+	//
+	// The weights may be quantized to 16 bits (see prank::quantize_in_csr),
+	// which leaves 6 instead of 8 bytes per edge to stream through the power
+	// method. Then w is empty, and the weight of edge i is wtab[wq[i]].
+
+	struct in_csr_t {
+		std::vector<kb_index_t>      rowstart;
+		std::vector<boost::uint32_t> src;
+		std::vector<float>           w;
+		std::vector<boost::uint16_t> wq;      // quantized weights
+		std::vector<float>           wtab;    // codebook of wq
+
+		size_t size() const { return rowstart.size() ? rowstart.size() - 1 : 0; }
+		bool empty() const { return rowstart.empty(); }
+		float weight(size_t i) const { return wq.empty() ? w[i] : wtab[wq[i]]; }
+		void swap(in_csr_t & o) {
+			rowstart.swap(o.rowstart);
+			src.swap(o.src);
+			w.swap(o.w);
+			wq.swap(o.wq);
+			wtab.swap(o.wtab);
+		}
+	};
+
+	// In-edges of a symmetric graph (see Kb::is_symmetric).
+	//
+	// Symmetric graphs do not store their in-edges, as the in-edges of v are
+	// the out-edges of v reversed, with the same properties. This points to
+	// the (forward) CSR arrays of the graph, and the PageRank kernels use it
+	// instead of an in_csr_t, multiplying the weight of each edge by the
+	// out-degree coefficient of its target on the fly. prop is NULL when
+	// edge weights are not used.
+
+	struct sym_csr_t {
+		const kb_index_t * rowstart;
+		const kb_index_t * column;
+		const kb_edge_t * prop;
+		size_t n;
+
+		sym_csr_t() : rowstart(NULL), column(NULL), prop(NULL), n(0) {}
+		size_t size() const { return n; }
+	};
+
+	// Delta overlay.
+	//
+	// The CSR graph of a compiled KB can not change, so the edges added to
+	// it afterwards (see Kb::read_from_txt) are kept apart, along with small
+	// adjacency lists of their own, until they are folded into a new CSR
+	// graph (see Kb::merge_delta). Vertex ids are those of the KB.
+
+	struct kb_delta_t {
+
+		typedef std::pair<size_t, size_t> vertex_pair_t;
+		typedef boost::unordered_map<size_t, std::vector<size_t> > adj_t;
+
+		std::vector<vertex_pair_t> E;          // edges, in insertion order
+		std::vector<edge_prop_t> eProp;
+		adj_t out;                             // source -> edges (positions in E)
+		adj_t in;                              // target -> edges (positions in E)
+
+		size_t size() const { return E.size(); }
+		bool empty() const { return E.empty(); }
+
+		// add edge u->v, or update it if already there (the weight is
+		// replaced and the relation types are added)
+		size_t insert_edge(size_t u, size_t v, float w, etype_t::value_type etype);
+
+		// edges going out of u (into v), NULL if none
+		const std::vector<size_t> * out_edges(size_t u) const;
+		const std::vector<size_t> * in_edges(size_t v) const;
+
+		void clear();
+
+	private:
+		boost::unordered_map<vertex_pair_t, size_t> m_eMap;
+	};
+
+	// Sparse vectors over vertices, stored as (vertex, value) pairs sorted by
+	// vertex.
+
+	typedef std::vector<std::pair<size_t, float> > sparse_vector_t;
+
+	// Sort sv by vertex, adding up the values of repeated vertices (in their
+	// original order) and removing zero values.
+
+	void sort_sparse_vector(sparse_vector_t & sv);
+
+	// Paths found by a multi-source BFS (see Kb::bfs_multi). Path k, that
+	// of the k-th (source, target) pair, is [offset[k], offset[k+1]) of V,
+	// from the target to the source. It is empty if the target is not
+	// reachable from the source.
+
+	struct kb_paths_t {
+		std::vector<size_t>     offset;
+		std::vector<kb_index_t> V;
+
+		kb_paths_t() : offset(1, 0) {}
+		size_t size() const { return offset.size() - 1; }
+		const kb_index_t * begin(size_t k) const { return V.empty() ? NULL : &V[0] + offset[k]; }
+		const kb_index_t * end(size_t k) const { return V.empty() ? NULL : &V[0] + offset[k + 1]; }
+	};
+
+	// Edges found by a depth-limited DFS (see Kb::dfs_multi). The edges of
+	// the k-th source are [offset[k], offset[k+1]) of E (their indices in
+	// the KB), U and V (their endpoints, u->v), ordered by index.
+
+	struct kb_edges_t {
+		std::vector<size_t>     offset;
+		std::vector<kb_index_t> E;
+		std::vector<kb_index_t> U;
+		std::vector<kb_index_t> V;
+
+		kb_edges_t() : offset(1, 0) {}
+		size_t size() const { return offset.size() - 1; }
+	};
+
+	// Reusable buffers for the target-bounded Dijkstra (see
+	// Kb::dijkstra_multi).
+	//
+	// dist and parent are only valid for vertices stamped with the current
+	// epoch in seen, and want stamps the targets not yet settled. The queue
+	// is an indexed 4-ary heap keyed by dist which moves vertices the same
+	// way as the one of boost's dijkstra_shortest_paths, so that vertices at
+	// the same distance are settled in the same order. pos is the index of a
+	// vertex in the heap, or no_pos once it is settled.
+
+	struct dijkstra_workspace_t {
+		static const kb_index_t no_pos = kb_index_t(-1);
+
+		std::vector<float>           dist;
+		std::vector<kb_index_t>      parent;
+		std::vector<kb_index_t>      pos;
+		std::vector<boost::uint32_t> seen;
+		std::vector<boost::uint32_t> want;
+		std::vector<kb_index_t>      heap;
+		boost::uint32_t              epoch;
+
+		dijkstra_workspace_t() : epoch(0) {}
+
+		// prepare for a new query over a graph with N vertices
+		void start(size_t N);
+
+		void push(kb_index_t v);
+		kb_index_t pop();
+		void decrease(kb_index_t v); // after dist[v] has decreased
+
+	private:
+		void up(size_t i);
+		void down();
+	};
+
+	inline void dijkstra_workspace_t::push(kb_index_t v) {
+		pos[v] = heap.size();
+		heap.push_back(v);
+		up(heap.size() - 1);
+	}
+
+	inline kb_index_t dijkstra_workspace_t::pop() {
+		kb_index_t u = heap[0];
+		pos[u] = no_pos;
+		if (heap.size() == 1) {
+			heap.pop_back();
+			return u;
+		}
+		heap[0] = heap.back();
+		pos[heap[0]] = 0;
+		heap.pop_back();
+		down();
+		return u;
+	}
+
+	inline void dijkstra_workspace_t::decrease(kb_index_t v) {
+		up(pos[v]);
+	}
+
+	inline void dijkstra_workspace_t::up(size_t i) {
+		kb_index_t * H = &heap[0];
+		const float * D = &dist[0];
+		kb_index_t v = H[i];
+		float d = D[v];
+		while(i) {
+			size_t p = (i - 1) / 4;
+			kb_index_t u = H[p];
+			if (!(d < D[u])) break;
+			H[i] = u;
+			pos[u] = i;
+			i = p;
+		}
+		H[i] = v;
+		pos[v] = i;
+	}
+
+	inline void dijkstra_workspace_t::down() {
+		kb_index_t * H = &heap[0];
+		const float * D = &dist[0];
+		size_t n = heap.size();
+		size_t i = 0;
+		kb_index_t v = H[0];
+		float d = D[v];
+		while(1) {
+			size_t c = 4 * i + 1;
+			if (c >= n) break;
+			size_t c_end = std::min(c + 4, n);
+			size_t best = c;
+			float best_d = D[H[c]];
+			for(size_t k = c + 1; k < c_end; ++k) {
+				float dk = D[H[k]];
+				if (dk < best_d) {
+					best = k;
+					best_d = dk;
+				}
+			}
+			if (!(best_d < d)) break;
+			kb_index_t u = H[best];
+			H[i] = u;
+			pos[u] = i;
+			i = best;
+		}
+		H[i] = v;
+		pos[v] = i;
+	}
+
+	// Reusable buffers for the depth-limited DFS (see Kb::dfs_multi).
+	//
+	// A vertex has been visited by the current DFS if it is stamped with the
+	// current epoch in seen. stack holds the vertices of the current path
+	// with their next out-edge, and path the edges leading to them.
+
+	struct dfs_workspace_t {
+		struct frame_t {
+			kb_index_t u;
+			kb_index_t e;      // next out-edge
+			kb_index_t e_end;
+		};
+
+		std::vector<boost::uint32_t> seen;
+		std::vector<frame_t>         stack;
+		std::vector<kb_index_t>      path;
+		boost::uint32_t              epoch;
+
+		dfs_workspace_t() : epoch(0) {}
+
+		// prepare for a new DFS over a graph with N vertices
+		void start(size_t N);
+	};
+
+	// Reusable buffers for the sparse PageRank-nibble (see prank.h).
+	//
+	// r (residual) and p (estimate) are dense, but only entries stamped with
+	// the current epoch in seen are valid, so nothing has to be cleared
+	// between queries and each query costs O(touched vertices). inq marks
+	// the vertices currently in the queue the same way.
+
+	struct nibble_workspace_t {
+		std::vector<float>           r;
+		std::vector<float>           p;
+		std::vector<boost::uint32_t> seen;
+		std::vector<boost::uint32_t> inq;
+		std::vector<size_t>          touched;
+		std::deque<size_t>           Q;
+		boost::uint32_t              epoch;
+
+		nibble_workspace_t() : epoch(0) {}
+
+		// prepare for a new query over a graph with N vertices
+		void start(size_t N);
+
+		// make v valid in the current query, with zero residual and estimate
+		void touch(size_t v) {
+			if (seen[v] == epoch) return;
+			seen[v] = epoch;
+			r[v] = 0.0f;
+			p[v] = 0.0f;
+			touched.push_back(v);
+		}
+	};
+
+	// Buffers for computing personalized PageRank vectors (see
+	// Kb::pageRank_ppv).
+	//
+	// Each PPV computation needs some |V|-sized auxiliary vectors. Callers
+	// which compute many PPVs (e.g. one per context) should keep one
+	// workspace per thread and pass it to every call, so that nothing is
+	// allocated once the buffers have grown to the size of the graph.
+	//
+	// Kb never uses rank, which is there for the callers to hold the
+	// resulting ranks.
+
+	struct PrankWorkspace {
+		std::vector<float> rank;     // ranks (for the caller)
+		std::vector<float> tmp;      // auxiliary rank vector of the power method
+		std::vector<float> pv;       // dense PV, all zeros between calls
+		sparse_vector_t    spv;      // sparse PV
+		sparse_vector_t    out;      // sparse ranks of PageRank-nibble
+		nibble_workspace_t nibble;
+	};
+
 	// temporary class used for creating CSR graphs. When reading (or converting)
 	// a graph, we first fill this structure and then initialize the graph.
 
@@ -106,7 +510,7 @@ namespace ukb {
 	public:
 
 		std::vector<vertex_pair_t>             E;
-		std::vector<vertex_prop_t>             vProp;
+		vertex_names_t                         vNames;
 		std::vector<edge_prop_t>               eProp;
 
 		etype_t                                m_rtypes;
@@ -121,10 +525,8 @@ namespace ukb {
 		typedef boost::unordered_map<vertex_pair_t, size_t,
 									 precsr_edge_hash,
 									 precsr_edge_comp> edge_map_t;
-		typedef std::map<std::string, size_t> vertex_map_t;
 
 		edge_map_t m_eMap;
-		vertex_map_t m_vMap;
 
 		size_t insert_vertex(const std::string & ustr);
 
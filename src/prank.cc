@@ -0,0 +1,290 @@
+#include "prank.h"
+
+#include <cmath>
+#include <cstring>
+
+// Vectorized kernels for the flat in-edge CSR power method.
+//
+// The AVX2 and SSE2 versions are compiled with the corresponding target
+// attribute, so the rest of ukb does not need any special compiler flag. The
+// kernel is chosen once, at runtime, according to the features of the CPU.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UKB_PRANK_X86
+#include <immintrin.h>
+#endif
+
+namespace ukb {
+
+	namespace prank {
+
+		typedef float (*row_sum_fn)(const boost::uint32_t * src,
+									const float * w,
+									size_t n,
+									const float * rank);
+
+		// sum(rank[src[i]] * w[i]) for i in [0, n)
+
+		static float row_sum_scalar(const boost::uint32_t * src,
+									const float * w,
+									size_t n,
+									const float * rank) {
+			float res = 0.0f;
+			for(size_t i = 0; i < n; ++i) {
+				res += rank[src[i]] * w[i];
+			}
+			return res;
+		}
+
+#ifdef UKB_PRANK_X86
+
+		__attribute__((target("sse2")))
+		static float row_sum_sse2(const boost::uint32_t * src,
+								  const float * w,
+								  size_t n,
+								  const float * rank) {
+			__m128 acc = _mm_setzero_ps();
+			size_t i = 0;
+			for(; i + 4 <= n; i += 4) {
+				// no gather in SSE, load the four ranks by hand
+				__m128 r = _mm_set_ps(rank[src[i + 3]], rank[src[i + 2]],
+									  rank[src[i + 1]], rank[src[i]]);
+				acc = _mm_add_ps(acc, _mm_mul_ps(r, _mm_loadu_ps(w + i)));
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, acc);
+			float res = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+			for(; i < n; ++i) {
+				res += rank[src[i]] * w[i];
+			}
+			return res;
+		}
+
+		__attribute__((target("avx2,fma")))
+		static float row_sum_avx2(const boost::uint32_t * src,
+								  const float * w,
+								  size_t n,
+								  const float * rank) {
+			__m256 acc = _mm256_setzero_ps();
+			size_t i = 0;
+			for(; i + 8 <= n; i += 8) {
+				__m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+				__m256 r = _mm256_i32gather_ps(rank, idx, 4);
+				acc = _mm256_fmadd_ps(r, _mm256_loadu_ps(w + i), acc);
+			}
+			__m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+			for(; i + 4 <= n; i += 4) {
+				__m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+				__m128 r = _mm_i32gather_ps(rank, idx, 4);
+				acc4 = _mm_fmadd_ps(r, _mm_loadu_ps(w + i), acc4);
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, acc4);
+			float res = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+			for(; i < n; ++i) {
+				res += rank[src[i]] * w[i];
+			}
+			return res;
+		}
+
+#endif
+
+		// Same with quantized weights. Plain scalar code: the codebook lookup
+		// is one more gather.
+
+		static float row_sum_quant(const boost::uint32_t * src,
+								   const boost::uint16_t * wq,
+								   const float * wtab,
+								   size_t n,
+								   const float * rank) {
+			float res = 0.0f;
+			for(size_t i = 0; i < n; ++i) {
+				res += rank[src[i]] * wtab[wq[i]];
+			}
+			return res;
+		}
+
+		struct row_sum_kernel_t {
+			row_sum_fn fn;
+			const char * name;
+		};
+
+		static row_sum_kernel_t select_row_sum_kernel() {
+			row_sum_kernel_t k;
+			k.fn = &row_sum_scalar;
+			k.name = "scalar";
+#ifdef UKB_PRANK_X86
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+				k.fn = &row_sum_avx2;
+				k.name = "avx2";
+			} else if (__builtin_cpu_supports("sse2")) {
+				k.fn = &row_sum_sse2;
+				k.name = "sse2";
+			}
+#endif
+			return k;
+		}
+
+		// Initialized before main, so there is no race when threads use it
+		static const row_sum_kernel_t row_sum_kernel = select_row_sum_kernel();
+
+		const char * update_pRank_csr_kernel() {
+			return row_sum_kernel.name;
+		}
+
+		float update_pRank_csr(const in_csr_t & csr,
+							   size_t v_begin, size_t v_end,
+							   float damping,
+							   const float * ppv_V,
+							   const float * out_coef,
+							   const float * rank_map1,
+							   float * rank_map2) {
+
+			row_sum_fn row_sum = row_sum_kernel.fn;
+			const kb_index_t * rowstart = &csr.rowstart[0];
+			const boost::uint32_t * src = csr.src.empty() ? 0 : &csr.src[0];
+			const float * w = csr.w.empty() ? 0 : &csr.w[0];
+			const boost::uint16_t * wq = csr.wq.empty() ? 0 : &csr.wq[0];
+			const float * wtab = csr.wtab.empty() ? 0 : &csr.wtab[0];
+
+			float norm = 0.0;
+			for (size_t v = v_begin; v != v_end; ++v) {
+				if (-1.0 == out_coef[v]) continue;
+				size_t first = rowstart[v];
+				size_t n = rowstart[v + 1] - first;
+				float rank = wq ? row_sum_quant(src + first, wq + first, wtab, n, rank_map1)
+					: row_sum(src + first, w + first, n, rank_map1);
+				float dangling_factor = 0.0;
+				if (0.0 == out_coef[v]) {
+					// dangling link
+					dangling_factor = damping * rank_map1[v];
+				}
+				rank_map2[v] = damping * rank + (dangling_factor + 1.0 - damping ) * ppv_V[v];
+				norm += fabs(rank_map2[v] - rank_map1[v]);
+			}
+			return norm;
+		}
+
+		float update_pRank_sym(const sym_csr_t & csr,
+							   size_t v_begin, size_t v_end,
+							   float damping,
+							   const float * ppv_V,
+							   const float * out_coef,
+							   const float * rank_map1,
+							   float * rank_map2) {
+
+			const kb_index_t * rowstart = csr.rowstart;
+			const kb_index_t * column = csr.column;
+			const kb_edge_t * prop = csr.prop;
+
+			float norm = 0.0;
+			for (size_t v = v_begin; v != v_end; ++v) {
+				if (-1.0 == out_coef[v]) continue;
+				float rank = 0.0f;
+				if (prop) {
+					for(size_t i = rowstart[v], i_end = rowstart[v + 1]; i < i_end; ++i) {
+						size_t u = column[i];
+						rank += rank_map1[u] * (prop[i].weight * out_coef[u]);
+					}
+				} else {
+					for(size_t i = rowstart[v], i_end = rowstart[v + 1]; i < i_end; ++i) {
+						size_t u = column[i];
+						rank += rank_map1[u] * out_coef[u];
+					}
+				}
+				float dangling_factor = 0.0;
+				if (0.0 == out_coef[v]) {
+					// dangling link
+					dangling_factor = damping * rank_map1[v];
+				}
+				rank_map2[v] = damping * rank + (dangling_factor + 1.0 - damping ) * ppv_V[v];
+				norm += fabs(rank_map2[v] - rank_map1[v]);
+			}
+			return norm;
+		}
+
+		//
+		// Weight quantization
+		//
+
+		// IEEE half precision, with round to nearest even
+
+		static boost::uint16_t float_to_half(float f) {
+			boost::uint32_t x;
+			std::memcpy(&x, &f, sizeof(x));
+			boost::uint16_t sign = (x >> 16) & 0x8000;
+			boost::uint32_t absx = x & 0x7FFFFFFF;
+			if (absx >= 0x7F800000) // inf or nan
+				return sign | 0x7C00 | (absx > 0x7F800000 ? 0x200 : 0);
+			if (absx >= 0x477FF000) // overflow (rounds to >= 65520)
+				return sign | 0x7C00;
+			if (absx < 0x38800000) { // subnormal half (or zero)
+				if (absx < 0x33000000) return sign;
+				boost::uint32_t mant = (absx & 0x7FFFFF) | 0x800000;
+				int shift = 126 - (absx >> 23);  // 14 .. 24
+				boost::uint32_t h = mant >> shift;
+				boost::uint32_t rem = mant & ((1u << shift) - 1);
+				boost::uint32_t half = 1u << (shift - 1);
+				if (rem > half || (rem == half && (h & 1))) ++h;
+				return sign | h;
+			}
+			boost::uint32_t h = ((absx - 0x38000000) >> 13);
+			boost::uint32_t rem = absx & 0x1FFF;
+			if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+			return sign | h;
+		}
+
+		static float half_to_float(boost::uint16_t h) {
+			boost::uint32_t sign = boost::uint32_t(h & 0x8000) << 16;
+			boost::uint32_t e = (h >> 10) & 0x1F;
+			boost::uint32_t m = h & 0x3FF;
+			if (e == 0) {
+				// zero or subnormal
+				float f = std::ldexp(static_cast<float>(m), -24);
+				return sign ? -f : f;
+			}
+			boost::uint32_t x = sign | (e == 31 ? (0xFF << 23) | (m << 13) : ((e + 112) << 23) | (m << 13));
+			float f;
+			std::memcpy(&f, &x, sizeof(f));
+			return f;
+		}
+
+		void quantize_in_csr(in_csr_t & csr, bool log_scale) {
+
+			const size_t ncodes = 65536;
+			size_t E = csr.w.size();
+			std::vector<boost::uint16_t> wq(E);
+			std::vector<float> wtab(ncodes, 0.0f);
+
+			if (!log_scale) {
+				for(size_t c = 0; c < ncodes; ++c) wtab[c] = half_to_float(c);
+				for(size_t i = 0; i < E; ++i) wq[i] = float_to_half(csr.w[i]);
+			} else {
+				// code 0 is zero, and code c > 0 is exp(lmin + (c - 1) * step)
+				float wmin = 0.0f, wmax = 0.0f;
+				for(size_t i = 0; i < E; ++i) {
+					float w = csr.w[i];
+					if (w <= 0.0f) continue;
+					if (wmin == 0.0f || w < wmin) wmin = w;
+					if (w > wmax) wmax = w;
+				}
+				if (wmax > 0.0f) {
+					double lmin = std::log(static_cast<double>(wmin));
+					double step = (std::log(static_cast<double>(wmax)) - lmin) / (ncodes - 2);
+					for(size_t c = 1; c < ncodes; ++c) wtab[c] = std::exp(lmin + (c - 1) * step);
+					for(size_t i = 0; i < E; ++i) {
+						float w = csr.w[i];
+						if (w <= 0.0f) continue;
+						size_t c = 1;
+						if (step > 0.0) c += static_cast<size_t>((std::log(static_cast<double>(w)) - lmin) / step + 0.5);
+						wq[i] = static_cast<boost::uint16_t>(std::min(c, ncodes - 1));
+					}
+				}
+			}
+			csr.wq.swap(wq);
+			csr.wtab.swap(wtab);
+			std::vector<float>().swap(csr.w);
+		}
+	}
+}
@@ -6,9 +6,13 @@
 #include <boost/graph/graph_concepts.hpp>
 #include <boost/unordered_set.hpp>
 #include <queue>
+#include <algorithm>
 #include <boost/tuple/tuple.hpp> // for "tie"
 #include <iosfwd>
 
+#include "kbGraph_common.h"
+#include "ukbThreads.h"
+
 /////////////////////////////////////////////////////////////////////
 // pageRank
 //
@@ -202,6 +206,486 @@ namespace ukb {
 		}
 
 
+		//
+		// Flat in-edge CSR (see in_csr_t in kbGraph_common.h)
+		//
+
+		template<typename G, typename wmap_t>
+		void init_in_csr(const G & g,
+						 wmap_t wmap,
+						 const std::vector<float> & out_coef,
+						 in_csr_t & csr) {
+
+			typedef typename graph_traits<G>::vertex_descriptor vertex_descriptor;
+
+			size_t nv = num_vertices(g);
+			if (nv > std::numeric_limits<boost::uint32_t>::max())
+				throw std::runtime_error("init_in_csr: too many vertices");
+
+			in_csr_t res;
+			res.rowstart.reserve(nv + 1);
+			res.src.reserve(num_edges(g));
+			res.w.reserve(num_edges(g));
+			res.rowstart.push_back(0);
+			typename graph_traits<G>::vertex_iterator v, end;
+			for (boost::tie(v, end) = vertices(g); v != end; ++v) {
+				typename graph_traits<G>::in_edge_iterator e, e_end;
+				for (boost::tie(e, e_end) = in_edges(*v, g); e != e_end; ++e) {
+					vertex_descriptor u = source(*e, g);
+					res.src.push_back(static_cast<boost::uint32_t>(u));
+					res.w.push_back(wmap[*e] * out_coef[u]);
+				}
+				res.rowstart.push_back(res.src.size());
+			}
+			csr.swap(res);
+		}
+
+		// One step of the power method over vertices [v_begin, v_end) of a flat
+		// in-edge CSR. Returns the L1 norm of the difference between rank_map1
+		// and rank_map2 over the range.
+		//
+		// The implementation (AVX2, SSE2 or plain scalar code) is chosen at
+		// runtime according to the features of the CPU (see prank.cc).
+
+		float update_pRank_csr(const in_csr_t & csr,
+							   size_t v_begin, size_t v_end,
+							   float damping,
+							   const float * ppv_V,
+							   const float * out_coef,
+							   const float * rank_map1,
+							   float * rank_map2);
+
+		// Name of the kernel used by update_pRank_csr
+		const char * update_pRank_csr_kernel();
+
+		// Quantize the weights of csr to 16 bits, either as IEEE half
+		// precision floats or as codes of a logarithmic scale spanning the
+		// positive weights of csr (log_scale). The latter has the same
+		// relative error (below 1e-4 for usual graphs) for all weights,
+		// whereas half floats lose precision below 6e-5. Non-positive weights
+		// become zero in the log scale.
+
+		void quantize_in_csr(in_csr_t & csr, bool log_scale);
+
+		// Same, for symmetric graphs (see sym_csr_t). Plain scalar code: the
+		// out-degree coefficients are gathered along with the ranks, and
+		// vector gathers do not pay off.
+
+		float update_pRank_sym(const sym_csr_t & csr,
+							   size_t v_begin, size_t v_end,
+							   float damping,
+							   const float * ppv_V,
+							   const float * out_coef,
+							   const float * rank_map1,
+							   float * rank_map2);
+
+		//
+		// Sweeps
+		//
+		// A sweep applies one step of the power method to the vertices in
+		// [v_begin, v_end), reading ranks from rank_map1 and writing them into
+		// rank_map2, and returns the L1 residual over the range. work(v)
+		// estimates the cost of updating v, and is used for balancing threads.
+		// Vertices are identified by their index.
+		//
+
+		template<typename G, typename ppvMap_t, typename wMap_t>
+		struct graph_sweep {
+
+			typedef typename graph_traits<G>::vertex_iterator vertex_iterator;
+
+			graph_sweep(G & g_, ppvMap_t ppv_V_, wMap_t & wmap_,
+						const std::vector<float> & out_coef_, float damping_)
+				: g(g_), ppv_V(ppv_V_), wmap(wmap_), out_coef(out_coef_), damping(damping_) {}
+
+			size_t size() const { return num_vertices(g); }
+			size_t work(size_t v) const { return in_degree(v, g) + 1; }
+
+			template<typename map1_t, typename map2_t>
+			float operator()(size_t v_begin, size_t v_end, map1_t rank_map1, map2_t rank_map2) const {
+				vertex_iterator first = vertices(g).first;
+				vertex_iterator last = first;
+				std::advance(first, v_begin);
+				std::advance(last, v_end);
+				return update_pRank(g, std::make_pair(first, last), damping, ppv_V, out_coef, wmap, rank_map1, rank_map2);
+			}
+
+			G & g;
+			ppvMap_t ppv_V;
+			wMap_t & wmap;
+			const std::vector<float> & out_coef;
+			float damping;
+		};
+
+		struct csr_sweep {
+
+			csr_sweep(const in_csr_t & csr_, const float * ppv_V_,
+					  const std::vector<float> & out_coef_, float damping_)
+				: csr(csr_), ppv_V(ppv_V_), out_coef(out_coef_), damping(damping_) {}
+
+			size_t size() const { return csr.size(); }
+			size_t work(size_t v) const { return csr.rowstart[v + 1] - csr.rowstart[v] + 1; }
+
+			float operator()(size_t v_begin, size_t v_end, const float * rank_map1, float * rank_map2) const {
+				return update_pRank_csr(csr, v_begin, v_end, damping, ppv_V, &out_coef[0], rank_map1, rank_map2);
+			}
+
+			const in_csr_t & csr;
+			const float * ppv_V;
+			const std::vector<float> & out_coef;
+			float damping;
+		};
+
+		struct sym_csr_sweep {
+
+			sym_csr_sweep(const sym_csr_t & csr_, const float * ppv_V_,
+						  const std::vector<float> & out_coef_, float damping_)
+				: csr(csr_), ppv_V(ppv_V_), out_coef(out_coef_), damping(damping_) {}
+
+			size_t size() const { return csr.size(); }
+			size_t work(size_t v) const { return csr.rowstart[v + 1] - csr.rowstart[v] + 1; }
+
+			float operator()(size_t v_begin, size_t v_end, const float * rank_map1, float * rank_map2) const {
+				return update_pRank_sym(csr, v_begin, v_end, damping, ppv_V, &out_coef[0], rank_map1, rank_map2);
+			}
+
+			const sym_csr_t & csr;
+			const float * ppv_V;
+			const std::vector<float> & out_coef;
+			float damping;
+		};
+
+		//
+		// Power method, possibly multithreaded
+		//
+		// The vertex set is split into nthreads contiguous ranges carrying
+		// (roughly) the same amount of work, that is, the same number of
+		// in-edges. Each thread applies the sweep to its own range. Threads
+		// meet at a barrier after each iteration, and every thread then reduces
+		// the per-thread residuals in the same order, so all of them take the
+		// same decision about convergence. The threads are those of pool, if
+		// given (see thr::worker_pool), or new ones otherwise.
+		//
+
+		// Split vertices [0, nv) into ranges.size() ranges with the same work
+		// (as given by w.work(v)).
+
+		template<typename W>
+		void split_work(const W & w, size_t nv, std::vector<std::pair<size_t, size_t> > & ranges) {
+			size_t nthreads = ranges.size();
+			size_t total_work = 0;
+			if (nthreads > 1) {
+				for(size_t v = 0; v < nv; ++v) total_work += w.work(v);
+			}
+			size_t acc = 0;
+			size_t tid = 0;
+			size_t range_begin = 0;
+			for(size_t v = 0; v < nv && tid + 1 < nthreads; ++v) {
+				acc += w.work(v);
+				if (acc >= (tid + 1) * total_work / nthreads) {
+					ranges[tid++] = std::make_pair(range_begin, v + 1);
+					range_begin = v + 1;
+				}
+			}
+			for(; tid < nthreads; ++tid) {
+				ranges[tid] = std::make_pair(range_begin, nv);
+				range_begin = nv;
+			}
+		}
+
+		template<typename Sweep, typename map1_t, typename map2_t>
+		struct power_method_worker {
+
+			// Residuals are double buffered (by iteration parity) and padded to
+			// avoid false sharing among threads.
+			struct residual_t {
+				float r;
+				char pad[64 - sizeof(float)];
+			};
+
+			power_method_worker(const Sweep & sweep_, size_t nthreads_,
+								map1_t rank_map1_, map2_t rank_map2_,
+								int iterations_, float threshold_, float init_value_)
+				: sweep(sweep_), nthreads(nthreads_),
+				  rank_map1(rank_map1_), rank_map2(rank_map2_),
+				  iterations(iterations_), threshold(threshold_), init_value(init_value_),
+				  ranges(nthreads_), residual(2 * nthreads_), sync(nthreads_) {}
+
+			void operator()(size_t tid) {
+
+				size_t v_begin = ranges[tid].first;
+				size_t v_end = ranges[tid].second;
+				for (size_t v = v_begin; v != v_end; ++v) {
+					rank_map1[v] = init_value;
+				}
+				sync.wait();
+
+				bool to_map_2 = true;
+				size_t parity = 0;
+				int iter_left = iterations;
+				while(iter_left--) {
+					if (to_map_2)
+						residual[parity * nthreads + tid].r = sweep(v_begin, v_end, rank_map1, rank_map2);
+					else
+						residual[parity * nthreads + tid].r = sweep(v_begin, v_end, rank_map2, rank_map1);
+					sync.wait();
+					float res = 0.0;
+					for(size_t i = 0; i < nthreads; ++i)
+						res += residual[parity * nthreads + i].r;
+					to_map_2 = !to_map_2;
+					parity = 1 - parity;
+					if (res < threshold) break;
+				}
+				if (!to_map_2) {
+					for (size_t v = v_begin; v != v_end; ++v) {
+						rank_map1[v] = rank_map2[v];
+					}
+				}
+			}
+
+			const Sweep & sweep;
+			size_t nthreads;
+			map1_t rank_map1;
+			map2_t rank_map2;
+			int iterations;
+			float threshold;
+			float init_value;
+			std::vector<std::pair<size_t, size_t> > ranges;
+			std::vector<residual_t> residual;
+			thr::barrier sync;
+		};
+
+		template<typename Sweep, typename map1_t, typename map2_t>
+		void power_method(const Sweep & sweep,
+						  size_t N,
+						  map1_t rank_map1,
+						  map2_t rank_map2,
+						  int iterations,
+						  float threshold,
+						  size_t nthreads,
+						  thr::worker_pool * pool = NULL) {
+
+			if (N == 0) return;
+			if (iterations == 0 && threshold == 0.0)
+				throw std::runtime_error("prank error: iterations and threshold are set to zero!\n");
+			if (!iterations) iterations = std::numeric_limits<int>::max();
+
+			size_t nv = sweep.size();
+			if (pool && nthreads > pool->size()) nthreads = pool->size();
+			if (nthreads > nv) nthreads = nv;
+			if (nthreads < 1) nthreads = 1;
+
+			power_method_worker<Sweep, map1_t, map2_t> worker(sweep, nthreads,
+															  rank_map1, rank_map2,
+															  iterations, threshold,
+															  1.0f/static_cast<float>(N));
+
+			split_work(sweep, nv, worker.ranges);
+			if (pool)
+				pool->run(nthreads, worker);
+			else
+				thr::run_parallel(nthreads, worker);
+		}
+
+		template<typename G, typename ppvMap_t, typename wMap_t, typename map1_t, typename map2_t>
+		void do_pageRank_mt(G & g,
+							size_t N,
+							ppvMap_t ppv_V,
+							wMap_t & wmap,
+							map1_t rank_map1,
+							map2_t rank_map2,
+							int iterations,
+							float threshold,
+							float damping,
+							const std::vector<float> & out_coef,
+							size_t nthreads) {
+
+			graph_sweep<G, ppvMap_t, wMap_t> sweep(g, ppv_V, wmap, out_coef, damping);
+			power_method(sweep, N, rank_map1, rank_map2, iterations, threshold, nthreads);
+		}
+
+		//
+		// Batched power method
+		//
+		// Compute K personalized PageRank vectors at once. Ranks are stored in
+		// K-wide blocks per vertex (rank[v * K + k]), so that each in-edge is
+		// visited once per iteration for all the K vectors. Convergence is
+		// checked independently for each column, exactly as do_pageRank does;
+		// once a column converges it is copied to its output vector and dropped
+		// from the active set.
+		//
+		// The in-edges come either from a flat in-edge CSR or from a symmetric
+		// graph (in_src and in_weight give the source and weight of the i-th
+		// in-edge).
+		//
+
+		inline size_t in_src(const in_csr_t & csr, size_t i) { return csr.src[i]; }
+
+		inline float in_weight(const in_csr_t & csr, size_t i, const std::vector<float> &) {
+			return csr.weight(i);
+		}
+
+		inline size_t in_src(const sym_csr_t & csr, size_t i) { return csr.column[i]; }
+
+		inline float in_weight(const sym_csr_t & csr, size_t i, const std::vector<float> & out_coef) {
+			return (csr.prop ? csr.prop[i].weight : 1.0f) * out_coef[csr.column[i]];
+		}
+
+		template<typename Csr>
+		void update_pRank_batch(const Csr & csr,
+								size_t v_begin, size_t v_end,
+								size_t K,
+								const std::vector<size_t> & active,
+								float damping,
+								const std::vector<const float *> & ppvs,
+								const std::vector<float> & out_coef,
+								const float * rank_map1,
+								float * rank_map2,
+								std::vector<float> & acc,
+								float * norm) {
+
+			size_t A = active.size();
+			std::fill(norm, norm + A, 0.0f);
+
+			for (size_t v = v_begin; v < v_end; ++v) {
+				if (-1.0 == out_coef[v]) continue;
+				std::fill(acc.begin(), acc.begin() + A, 0.0f);
+				for(size_t i = csr.rowstart[v], i_end = csr.rowstart[v + 1]; i < i_end; ++i) {
+					float w = in_weight(csr, i, out_coef);
+					const float * r1 = rank_map1 + in_src(csr, i) * K;
+					for(size_t j = 0; j < A; ++j) {
+						acc[j] += r1[active[j]] * w;
+					}
+				}
+				const float * r1 = rank_map1 + v * K;
+				float * r2 = rank_map2 + v * K;
+				bool dangling = (0.0 == out_coef[v]);
+				for(size_t j = 0; j < A; ++j) {
+					size_t k = active[j];
+					float dangling_factor = dangling ? damping * r1[k] : 0.0f;
+					r2[k] = damping * acc[j] + (dangling_factor + 1.0 - damping ) * ppvs[k][v];
+					norm[j] += fabs(r2[k] - r1[k]);
+				}
+			}
+		}
+
+		// As power_method_worker, each thread updates a range of vertices and
+		// threads meet at a barrier after each iteration. Every thread then
+		// adds the per-thread norms of the active columns in the same order,
+		// so all of them retire the same columns, and copies its range of the
+		// retired columns to the output vectors.
+
+		template<typename Csr>
+		struct batch_worker {
+
+			batch_worker(const Csr & csr_, size_t nthreads_,
+						 const std::vector<const float *> & ppvs_,
+						 const std::vector<float *> & ranks_,
+						 int iterations_, float threshold_, float damping_,
+						 const std::vector<float> & out_coef_,
+						 float * rank1_, float * rank2_)
+				: csr(csr_), nthreads(nthreads_), K(ppvs_.size()),
+				  stride((K + 15) / 16 * 16), // keep threads on different cache lines
+				  ppvs(ppvs_), ranks(ranks_),
+				  iterations(iterations_), threshold(threshold_), damping(damping_),
+				  out_coef(out_coef_), rank1(rank1_), rank2(rank2_),
+				  ranges(nthreads_), norm(2 * nthreads_ * stride), sync(nthreads_) {}
+
+			size_t work(size_t v) const { return csr.rowstart[v + 1] - csr.rowstart[v] + 1; }
+
+			void operator()(size_t tid) {
+
+				size_t v_begin = ranges[tid].first;
+				size_t v_end = ranges[tid].second;
+				std::vector<float> acc(K);
+				std::vector<size_t> active(K);
+				for(size_t k = 0; k < K; ++k) active[k] = k;
+
+				bool to_map_2 = true;
+				size_t parity = 0;
+				int iter_left = iterations;
+				while(iter_left-- && active.size()) {
+					float *src = to_map_2 ? rank1 : rank2;
+					float *dst = to_map_2 ? rank2 : rank1;
+					float *nbuf = &norm[parity * nthreads * stride];
+					update_pRank_batch(csr, v_begin, v_end, K, active, damping, ppvs, out_coef,
+									   src, dst, acc, nbuf + tid * stride);
+					sync.wait();
+					to_map_2 = !to_map_2;
+					parity = 1 - parity;
+					// retire converged columns
+					size_t A = 0;
+					for(size_t j = 0, m = active.size(); j < m; ++j) {
+						size_t k = active[j];
+						float res = 0.0f;
+						for(size_t i = 0; i < nthreads; ++i) res += nbuf[i * stride + j];
+						if (res < threshold) {
+							for(size_t v = v_begin; v < v_end; ++v) ranks[k][v] = dst[v * K + k];
+						} else {
+							active[A++] = k;
+						}
+					}
+					active.resize(A);
+				}
+				// columns still active when the iterations are exhausted
+				const float *last = to_map_2 ? rank1 : rank2;
+				for(size_t j = 0, m = active.size(); j < m; ++j) {
+					size_t k = active[j];
+					for(size_t v = v_begin; v < v_end; ++v) ranks[k][v] = last[v * K + k];
+				}
+			}
+
+			const Csr & csr;
+			size_t nthreads;
+			size_t K;
+			size_t stride;
+			const std::vector<const float *> & ppvs;
+			const std::vector<float *> & ranks;
+			int iterations;
+			float threshold;
+			float damping;
+			const std::vector<float> & out_coef;
+			float * rank1;
+			float * rank2;
+			std::vector<std::pair<size_t, size_t> > ranges;
+			std::vector<float> norm;
+			thr::barrier sync;
+		};
+
+		template<typename Csr>
+		void do_pageRank_batch(const Csr & csr,
+							   size_t N,
+							   const std::vector<const float *> & ppvs,
+							   const std::vector<float *> & ranks,
+							   int iterations,
+							   float threshold,
+							   float damping,
+							   const std::vector<float> & out_coef,
+							   size_t nthreads = 1,
+							   thr::worker_pool * pool = NULL) {
+
+			size_t K = ppvs.size();
+			size_t nv = csr.size();
+			if (N == 0 || K == 0 || nv == 0) return;
+			if (iterations == 0 && threshold == 0.0)
+				throw std::runtime_error("prank error: iterations and threshold are set to zero!\n");
+			if (!iterations) iterations = std::numeric_limits<int>::max();
+
+			if (pool && nthreads > pool->size()) nthreads = pool->size();
+			if (nthreads > nv) nthreads = nv;
+			if (nthreads < 1) nthreads = 1;
+
+			std::vector<float> rank1(nv * K, 1.0f/static_cast<float>(N));
+			std::vector<float> rank2(nv * K, 0.0f);
+			batch_worker<Csr> worker(csr, nthreads, ppvs, ranks, iterations, threshold, damping,
+									 out_coef, &rank1[0], &rank2[0]);
+			split_work(worker, nv, worker.ranges);
+			if (pool)
+				pool->run(nthreads, worker);
+			else
+				thr::run_parallel(nthreads, worker);
+		}
+
 		/////////////////////////////////////////////////////////////////
 		// PageRank iteration
 		//
@@ -357,6 +841,90 @@ namespace ukb {
 			}
 		}
 
+		// Sparse version of pageRank_nibble_lazy.
+		//
+		// The seeds are given as a sparse vector and the result is returned as
+		// a sparse vector (sorted by vertex). The out-edges in delta, if
+		// given, are walked too. All the buffers live in the
+		// workspace ws, which can be reused across calls, so that the cost of
+		// each call depends only on the number of vertices touched by the
+		// algorithm, and not on the size of the graph.
+		//
+		// Given the same (sorted) seeds, the result is the same as the one of
+		// pageRank_nibble_lazy.
+
+		template<class G>
+		void pageRank_nibble_lazy(G & g,
+								  const sparse_vector_t & seeds,
+								  const std::vector<float> & out_coefs,
+								  float damping,
+								  float epsilon,
+								  nibble_workspace_t & ws,
+								  sparse_vector_t & p,
+								  const kb_delta_t * delta = NULL) {
+
+			typedef typename boost::graph_traits<G>::adjacency_iterator adjacency_iterator;
+
+			ws.start(num_vertices(g));
+			std::vector<float> & r = ws.r;
+			std::vector<float> & pv = ws.p;
+			std::vector<boost::uint32_t> & inq = ws.inq;
+			std::deque<size_t> & Q = ws.Q;
+			boost::uint32_t epoch = ws.epoch;
+
+			sparse_vector_t::const_iterator s_it = seeds.begin();
+			sparse_vector_t::const_iterator s_end = seeds.end();
+			for(; s_it != s_end; ++s_it) {
+				ws.touch(s_it->first);
+				r[s_it->first] += s_it->second;
+			}
+			for(s_it = seeds.begin(); s_it != s_end; ++s_it) {
+				size_t v = s_it->first;
+				if (inq[v] != epoch && r[v] * out_coefs[v] >= epsilon) {
+					inq[v] = epoch; Q.push_back(v);
+				}
+			}
+			while(Q.size()) {
+				typename boost::graph_traits<G>::vertex_descriptor u = Q.front();
+				Q.pop_front();
+				inq[u] = 0;
+				do {
+					// Push
+					adjacency_iterator it, end;
+					boost::tie(it, end) = adjacent_vertices(u, g);
+					float pushVal = r[u] - 0.5 * epsilon;
+					float putVal = damping * (r[u] - 0.5 * epsilon) * out_coefs[u];
+					pv[u] += (1.0 - damping) * pushVal;
+					r[u] = 0.5 * epsilon;
+					for(; it != end; ++it) {
+						size_t v = *it;
+						ws.touch(v);
+						r[v] += putVal;
+						if (inq[v] != epoch && r[v] * out_coefs[v] >= epsilon) {
+							inq[v] = epoch; Q.push_back(v);
+						}
+					}
+					const std::vector<size_t> * dout = delta ? delta->out_edges(u) : NULL;
+					for(size_t j = 0; dout && j < dout->size(); ++j) {
+						size_t v = delta->E[(*dout)[j]].second;
+						ws.touch(v);
+						r[v] += putVal;
+						if (inq[v] != epoch && r[v] * out_coefs[v] >= epsilon) {
+							inq[v] = epoch; Q.push_back(v);
+						}
+					}
+				} while(r[u] * out_coefs[u] >= epsilon);
+			}
+
+			p.clear();
+			std::sort(ws.touched.begin(), ws.touched.end());
+			std::vector<size_t>::const_iterator v_it = ws.touched.begin();
+			std::vector<size_t>::const_iterator v_end = ws.touched.end();
+			for(; v_it != v_end; ++v_it) {
+				if (pv[*v_it] != 0.0f) p.push_back(std::make_pair(*v_it, pv[*v_it]));
+			}
+		}
+
 		template<class G>
 		void pageRank_nibble_snap(G & g,
 								  const std::vector<float> & ppv_map,
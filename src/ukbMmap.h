@@ -0,0 +1,185 @@
+// -*-C++-*-
+
+#ifndef UKBMMAP_H
+#define UKBMMAP_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/////////////////////////////////////////////////////////////////////
+// Read-only memory mapped files.
+//
+// The file is mapped shared, so all processes mapping the same file use
+// the same pages of the page cache.
+
+namespace ukb {
+
+	class mmap_file {
+	public:
+
+		explicit mmap_file(const std::string & fname) : m_data(NULL), m_size(0) {
+			int fd = ::open(fname.c_str(), O_RDONLY);
+			if (fd == -1)
+				throw std::runtime_error("mmap_file: can not open " + fname);
+			struct stat st;
+			if (::fstat(fd, &st) == -1) {
+				::close(fd);
+				throw std::runtime_error("mmap_file: can not stat " + fname);
+			}
+			m_size = static_cast<size_t>(st.st_size);
+			if (m_size) {
+				void *p = ::mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED) {
+					::close(fd);
+					throw std::runtime_error("mmap_file: can not map " + fname);
+				}
+				m_data = static_cast<const char *>(p);
+			}
+			::close(fd); // the mapping stays valid
+		}
+
+		~mmap_file() {
+			if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+		}
+
+		const char *data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		mmap_file(const mmap_file &);
+		mmap_file &operator=(const mmap_file &);
+		const char *m_data;
+		size_t m_size;
+	};
+
+	/////////////////////////////////////////////////////////////////////
+	// Sections of memory mappable files.
+	//
+	// A mappable file starts with a header of boost::uint64_t values, the
+	// first being a magic id and the last the number of sections, followed
+	// by an (id, offset, size) triplet for each section. Sections hold raw
+	// arrays and start at multiples of map_align bytes from the beginning of
+	// the file, so that the arrays can be used in place once the file is
+	// mapped. Readers skip the sections they do not know.
+
+	static const size_t map_align = 4096;
+
+	struct map_section_t {
+		boost::uint64_t id;
+		boost::uint64_t offset;
+		boost::uint64_t size;
+		const char *data;   // only used when writing
+
+		map_section_t(boost::uint64_t i, const void *p, size_t s)
+			: id(i), offset(0), size(s), data(static_cast<const char *>(p)) {}
+	};
+
+	inline bool is_map_file(const char *p, size_t n, boost::uint64_t magic) {
+		if (n < sizeof(boost::uint64_t)) return false;
+		boost::uint64_t id;
+		std::memcpy(&id, p, sizeof(id));
+		return id == magic;
+	}
+
+	// read the header (hdr_n values) and the section table of a mapped file
+
+	inline void read_map_sections(const char *base, size_t fsize,
+								  boost::uint64_t *h, size_t hdr_n,
+								  std::vector<map_section_t> & secs) {
+		if (fsize < hdr_n * sizeof(boost::uint64_t)) throw std::runtime_error("truncated header");
+		std::memcpy(h, base, hdr_n * sizeof(boost::uint64_t));
+		size_t sec_n = h[hdr_n - 1];
+		if (sec_n > (fsize - hdr_n * sizeof(boost::uint64_t)) / (3 * sizeof(boost::uint64_t)))
+			throw std::runtime_error("truncated section table");
+		secs.clear();
+		const char *p = base + hdr_n * sizeof(boost::uint64_t);
+		for(size_t i = 0; i < sec_n; ++i) {
+			boost::uint64_t s[3];
+			std::memcpy(s, p, sizeof(s));
+			p += sizeof(s);
+			secs.push_back(map_section_t(s[0], NULL, s[2]));
+			secs.back().offset = s[1];
+		}
+	}
+
+	// get the data of section id, checking that it has n elements of type T
+
+	template<class T>
+	const T *map_section_data(const char *base, size_t fsize,
+							  const std::vector<map_section_t> & secs,
+							  boost::uint64_t id, size_t n) {
+		for(size_t i = 0; i < secs.size(); ++i) {
+			if (secs[i].id != id) continue;
+			if (secs[i].size != n * sizeof(T) ||
+				secs[i].offset > fsize || secs[i].size > fsize - secs[i].offset ||
+				secs[i].offset % boost::alignment_of<T>::value)
+				throw std::runtime_error("bad section " + boost::lexical_cast<std::string>(id));
+			return reinterpret_cast<const T *>(base + secs[i].offset);
+		}
+		throw std::runtime_error("missing section " + boost::lexical_cast<std::string>(id));
+	}
+
+	inline size_t map_section_size(const std::vector<map_section_t> & secs, boost::uint64_t id) {
+		for(size_t i = 0; i < secs.size(); ++i) {
+			if (secs[i].id == id) return secs[i].size;
+		}
+		return 0;
+	}
+
+	// write a mappable file with header h (hdr_n values, the last of which
+	// is set to the number of sections) and sections secs
+
+	inline std::ostream & write_map_sections(std::ostream & o,
+											 boost::uint64_t *h, size_t hdr_n,
+											 std::vector<map_section_t> & secs) {
+		static const char zeros[64] = { 0 };
+
+		// place sections
+
+		size_t hdr_bytes = (hdr_n + 3 * secs.size()) * sizeof(boost::uint64_t);
+		size_t pos = hdr_bytes;
+		for(size_t i = 0; i < secs.size(); ++i) {
+			pos = (pos + map_align - 1) / map_align * map_align;
+			secs[i].offset = pos;
+			pos += secs[i].size;
+		}
+
+		// header
+
+		h[hdr_n - 1] = secs.size();
+		o.write(reinterpret_cast<const char *>(h), hdr_n * sizeof(boost::uint64_t));
+		for(size_t i = 0; i < secs.size(); ++i) {
+			boost::uint64_t s[3] = { secs[i].id, secs[i].offset, secs[i].size };
+			o.write(reinterpret_cast<const char *>(s), sizeof(s));
+		}
+		pos = hdr_bytes;
+
+		// sections
+
+		for(size_t i = 0; i < secs.size(); ++i) {
+			while (pos < secs[i].offset) {
+				size_t n = std::min(size_t(secs[i].offset - pos), sizeof(zeros));
+				o.write(zeros, n);
+				pos += n;
+			}
+			if (secs[i].size) o.write(secs[i].data, secs[i].size);
+			pos += secs[i].size;
+		}
+		return o;
+	}
+}
+
+#endif
@@ -0,0 +1,488 @@
+// -*-C++-*-
+
+#ifndef UKBTHREADS_H
+#define UKBTHREADS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <pthread.h>
+#include <unistd.h>
+
+/////////////////////////////////////////////////////////////////////
+// Thin wrappers over POSIX threads.
+//
+// ukb is linked against pthread anyway (see Makefile.in), so we use it
+// directly instead of pulling yet another boost library.
+
+namespace ukb {
+
+	namespace thr {
+
+		// number of online processors (at least 1)
+
+		inline size_t hardware_threads() {
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			return n > 0 ? static_cast<size_t>(n) : 1;
+		}
+
+		class mutex {
+		public:
+			mutex() { pthread_mutex_init(&m_m, NULL); }
+			~mutex() { pthread_mutex_destroy(&m_m); }
+			void lock() { pthread_mutex_lock(&m_m); }
+			void unlock() { pthread_mutex_unlock(&m_m); }
+			friend class condition;
+		private:
+			mutex(const mutex &);
+			mutex &operator=(const mutex &);
+			pthread_mutex_t m_m;
+		};
+
+		class scoped_lock {
+		public:
+			explicit scoped_lock(mutex & m) : m_m(m) { m_m.lock(); }
+			~scoped_lock() { m_m.unlock(); }
+		private:
+			scoped_lock(const scoped_lock &);
+			scoped_lock &operator=(const scoped_lock &);
+			mutex & m_m;
+		};
+
+		class condition {
+		public:
+			condition() { pthread_cond_init(&m_c, NULL); }
+			~condition() { pthread_cond_destroy(&m_c); }
+			void wait(mutex & m) { pthread_cond_wait(&m_c, &m.m_m); }
+			void signal() { pthread_cond_signal(&m_c); }
+			void broadcast() { pthread_cond_broadcast(&m_c); }
+		private:
+			condition(const condition &);
+			condition &operator=(const condition &);
+			pthread_cond_t m_c;
+		};
+
+		// Reusable barrier for a fixed number of threads (pthread_barrier_t is
+		// not available everywhere, so roll our own).
+
+		class barrier {
+		public:
+			explicit barrier(size_t n) : m_n(n), m_waiting(0), m_gen(0) {}
+			void wait() {
+				scoped_lock lock(m_mutex);
+				size_t gen = m_gen;
+				if (++m_waiting == m_n) {
+					m_waiting = 0;
+					++m_gen;
+					m_cond.broadcast();
+					return;
+				}
+				while (gen == m_gen) m_cond.wait(m_mutex);
+			}
+		private:
+			barrier(const barrier &);
+			barrier &operator=(const barrier &);
+			size_t m_n;
+			size_t m_waiting;
+			size_t m_gen;
+			mutex m_mutex;
+			condition m_cond;
+		};
+
+		// Bounded FIFO queue for pipelines. push blocks while the queue is full
+		// (so that fast producers wait for slow consumers) and pop blocks while
+		// it is empty. After close(), pop returns false once the queue is
+		// drained. After abort(), both push and pop return false right away.
+
+		template<typename T>
+		class bounded_queue {
+		public:
+			explicit bounded_queue(size_t capacity)
+				: m_cap(capacity ? capacity : 1), m_closed(false), m_aborted(false) {}
+
+			bool push(const T & x) {
+				scoped_lock lock(m_mutex);
+				while (!m_aborted && m_q.size() >= m_cap) m_not_full.wait(m_mutex);
+				if (m_aborted || m_closed) return false;
+				m_q.push_back(x);
+				m_not_empty.signal();
+				return true;
+			}
+
+			bool pop(T & x) {
+				scoped_lock lock(m_mutex);
+				while (!m_aborted && !m_closed && m_q.empty()) m_not_empty.wait(m_mutex);
+				if (m_aborted || m_q.empty()) return false;
+				x = m_q.front();
+				m_q.pop_front();
+				m_not_full.signal();
+				return true;
+			}
+
+			void close() {
+				scoped_lock lock(m_mutex);
+				m_closed = true;
+				m_not_empty.broadcast();
+			}
+
+			void abort() {
+				scoped_lock lock(m_mutex);
+				m_aborted = true;
+				m_not_empty.broadcast();
+				m_not_full.broadcast();
+			}
+
+		private:
+			bounded_queue(const bounded_queue &);
+			bounded_queue &operator=(const bounded_queue &);
+			size_t m_cap;
+			bool m_closed;
+			bool m_aborted;
+			std::deque<T> m_q;
+			mutex m_mutex;
+			condition m_not_empty;
+			condition m_not_full;
+		};
+
+		// Reorder buffer. Items carry a sequence number (0, 1, 2 ...) and may be
+		// pushed in any order, but pop returns them in sequence order. push
+		// blocks while the item is capacity or more positions ahead of the next
+		// one to pop, which bounds the memory used by the buffer. close(n) tells
+		// that there are n items in total, and pop returns false after the last
+		// one. abort() works as in bounded_queue.
+
+		template<typename T>
+		class ordered_queue {
+		public:
+			explicit ordered_queue(size_t capacity)
+				: m_cap(capacity ? capacity : 1), m_next(0), m_total(0),
+				  m_closed(false), m_aborted(false) {}
+
+			bool push(size_t seq, const T & x) {
+				scoped_lock lock(m_mutex);
+				while (!m_aborted && seq >= m_next + m_cap) m_cond.wait(m_mutex);
+				if (m_aborted) return false;
+				m_items.insert(std::make_pair(seq, x));
+				m_cond.broadcast();
+				return true;
+			}
+
+			bool pop(T & x) {
+				scoped_lock lock(m_mutex);
+				typename std::map<size_t, T>::iterator it;
+				while(1) {
+					if (m_aborted) return false;
+					if (m_closed && m_next == m_total) return false;
+					it = m_items.find(m_next);
+					if (it != m_items.end()) break;
+					m_cond.wait(m_mutex);
+				}
+				x = it->second;
+				m_items.erase(it);
+				++m_next;
+				m_cond.broadcast();
+				return true;
+			}
+
+			void close(size_t total) {
+				scoped_lock lock(m_mutex);
+				m_total = total;
+				m_closed = true;
+				m_cond.broadcast();
+			}
+
+			void abort() {
+				scoped_lock lock(m_mutex);
+				m_aborted = true;
+				m_cond.broadcast();
+			}
+
+		private:
+			ordered_queue(const ordered_queue &);
+			ordered_queue &operator=(const ordered_queue &);
+			size_t m_cap;
+			size_t m_next;
+			size_t m_total;
+			bool m_closed;
+			bool m_aborted;
+			std::map<size_t, T> m_items;
+			mutex m_mutex;
+			condition m_cond;
+		};
+
+		// run_parallel
+		//
+		// Call f(tid) for tid in [0, n), each call in its own thread. The calling
+		// thread executes f(0) and waits for the rest to finish. No call starts
+		// until all threads are created, so f may safely synchronize with the
+		// others (e.g. with a barrier). If any of the calls throws, a
+		// runtime_error with the (first) message is thrown after all threads are
+		// joined.
+
+		struct start_gate_t {
+			start_gate_t() : state(0) {}
+			void open(int st) {
+				scoped_lock lock(m);
+				state = st;
+				c.broadcast();
+			}
+			int wait() {
+				scoped_lock lock(m);
+				while (!state) c.wait(m);
+				return state;
+			}
+			mutex m;
+			condition c;
+			int state; // 0 -> wait, 1 -> go, 2 -> abort
+		};
+
+		template<typename F>
+		struct thread_arg_t {
+			F * f;
+			size_t tid;
+			start_gate_t * gate;
+			std::string err;
+		};
+
+		template<typename F>
+		void run_thread_arg(thread_arg_t<F> & arg) {
+			try {
+				(*arg.f)(arg.tid);
+			} catch (std::exception & e) {
+				arg.err = e.what();
+				if (arg.err.empty()) arg.err = "unknown error";
+			} catch (...) {
+				arg.err = "unknown error";
+			}
+		}
+
+		template<typename F>
+		void *thread_trampoline(void *p) {
+			thread_arg_t<F> & arg = *static_cast<thread_arg_t<F> *>(p);
+			if (arg.gate->wait() == 1) run_thread_arg(arg);
+			return NULL;
+		}
+
+		template<typename F>
+		void run_parallel(size_t n, F & f) {
+			if (n == 0) return;
+			if (n == 1) {
+				f(0);
+				return;
+			}
+			start_gate_t gate;
+			std::vector<thread_arg_t<F> > args(n);
+			std::vector<pthread_t> tids(n);
+			for(size_t i = 0; i < n; ++i) {
+				args[i].f = &f;
+				args[i].tid = i;
+				args[i].gate = &gate;
+			}
+			size_t started = 1;
+			for(; started < n; ++started) {
+				if (pthread_create(&tids[started], NULL, &thread_trampoline<F>, &args[started])) break;
+			}
+			if (started < n) {
+				gate.open(2);
+				for(size_t i = 1; i < started; ++i) pthread_join(tids[i], NULL);
+				throw std::runtime_error("run_parallel: can not create thread");
+			}
+			gate.open(1);
+			run_thread_arg(args[0]);
+			for(size_t i = 1; i < n; ++i) pthread_join(tids[i], NULL);
+			for(size_t i = 0; i < n; ++i) {
+				if (!args[i].err.empty()) throw std::runtime_error(args[i].err);
+			}
+		}
+
+		// worker_pool
+		//
+		// A fixed set of threads, started once, that run jobs like run_parallel
+		// does: run(n, f) calls f(tid) for tid in [0, n), n <= size(), with f(0)
+		// in the calling thread and the rest in the pool threads, all of them
+		// at the same time. It then waits for the calls to finish, and throws
+		// the (first) error of any of them. A pool runs one job at a time, so
+		// it must not be shared among threads (see pool_set).
+
+		class worker_pool {
+		public:
+			explicit worker_pool(size_t n)
+				: m_size(n ? n : 1), m_gen(0), m_n(0), m_pending(0), m_stop(false),
+				  m_job(NULL), m_f(NULL), m_err(m_size) {
+				m_args.resize(m_size);
+				size_t started = 1;
+				for(; started < m_size; ++started) {
+					m_args[started].pool = this;
+					m_args[started].tid = started;
+					if (pthread_create(&m_args[started].id, NULL, &worker_pool::trampoline, &m_args[started])) break;
+				}
+				if (started < m_size) {
+					stop(started);
+					throw std::runtime_error("worker_pool: can not create thread");
+				}
+			}
+
+			~worker_pool() { stop(m_size); }
+
+			size_t size() const { return m_size; }
+
+			template<typename F>
+			void run(size_t n, F & f) {
+				if (n > m_size) n = m_size;
+				if (n == 0) return;
+				if (n == 1) {
+					f(0);
+					return;
+				}
+				{
+					scoped_lock lock(m_mutex);
+					m_job = &worker_pool::call<F>;
+					m_f = &f;
+					m_n = n;
+					m_pending = n - 1;
+					for(size_t i = 0; i < n; ++i) m_err[i].clear();
+					++m_gen;
+					m_cond.broadcast();
+				}
+				run_job(0);
+				{
+					scoped_lock lock(m_mutex);
+					while (m_pending) m_done.wait(m_mutex);
+				}
+				for(size_t i = 0; i < n; ++i) {
+					if (!m_err[i].empty()) throw std::runtime_error(m_err[i]);
+				}
+			}
+
+		private:
+			worker_pool(const worker_pool &);
+			worker_pool &operator=(const worker_pool &);
+
+			struct thread_t {
+				worker_pool * pool;
+				size_t tid;
+				pthread_t id;
+			};
+
+			template<typename F>
+			static void call(void * f, size_t tid) { (*static_cast<F *>(f))(tid); }
+
+			void run_job(size_t tid) {
+				try {
+					m_job(m_f, tid);
+				} catch (std::exception & e) {
+					m_err[tid] = e.what();
+					if (m_err[tid].empty()) m_err[tid] = "unknown error";
+				} catch (...) {
+					m_err[tid] = "unknown error";
+				}
+			}
+
+			static void *trampoline(void *p) {
+				thread_t & t = *static_cast<thread_t *>(p);
+				t.pool->work(t.tid);
+				return NULL;
+			}
+
+			void work(size_t tid) {
+				size_t seen = 0;
+				while(1) {
+					{
+						scoped_lock lock(m_mutex);
+						while (!m_stop && m_gen == seen) m_cond.wait(m_mutex);
+						if (m_stop) return;
+						seen = m_gen;
+						if (tid >= m_n) continue;
+					}
+					run_job(tid);
+					scoped_lock lock(m_mutex);
+					if (--m_pending == 0) m_done.signal();
+				}
+			}
+
+			// stop and join threads [1, n)
+			void stop(size_t n) {
+				{
+					scoped_lock lock(m_mutex);
+					m_stop = true;
+					m_cond.broadcast();
+				}
+				for(size_t i = 1; i < n; ++i) pthread_join(m_args[i].id, NULL);
+			}
+
+			size_t m_size;
+			size_t m_gen;      // job number, workers wait for a new one
+			size_t m_n;        // threads of the current job
+			size_t m_pending;  // pool threads still running the current job
+			bool m_stop;
+			void (*m_job)(void *, size_t);
+			void * m_f;
+			std::vector<std::string> m_err;
+			std::vector<thread_t> m_args;
+			mutex m_mutex;
+			condition m_cond;  // new job or stop
+			condition m_done;  // job finished
+		};
+
+		// Pools kept for reuse by many threads. acquire returns an idle pool
+		// of n threads, creating it if there is none, and release returns it
+		// to the set. Pools are destroyed with the set.
+
+		class pool_set {
+		public:
+			pool_set() {}
+			~pool_set() {
+				for(size_t i = 0; i < m_all.size(); ++i) delete m_all[i];
+			}
+
+			worker_pool * acquire(size_t n) {
+				{
+					scoped_lock lock(m_mutex);
+					for(size_t i = 0; i < m_idle.size(); ++i) {
+						if (m_idle[i]->size() == n) {
+							worker_pool * p = m_idle[i];
+							m_idle.erase(m_idle.begin() + i);
+							return p;
+						}
+					}
+				}
+				worker_pool * p = new worker_pool(n);
+				scoped_lock lock(m_mutex);
+				m_all.push_back(p);
+				return p;
+			}
+
+			void release(worker_pool * p) {
+				scoped_lock lock(m_mutex);
+				m_idle.push_back(p);
+			}
+
+		private:
+			pool_set(const pool_set &);
+			pool_set &operator=(const pool_set &);
+			std::vector<worker_pool *> m_all;
+			std::vector<worker_pool *> m_idle;
+			mutex m_mutex;
+		};
+
+		// acquire a pool of n threads of a pool_set for the lifetime of the
+		// object. There is no pool (get() returns NULL) if n <= 1.
+
+		class pool_lease {
+		public:
+			pool_lease(pool_set & s, size_t n) : m_set(s), m_pool(n > 1 ? s.acquire(n) : NULL) {}
+			~pool_lease() { if (m_pool) m_set.release(m_pool); }
+			worker_pool * get() const { return m_pool; }
+		private:
+			pool_lease(const pool_lease &);
+			pool_lease &operator=(const pool_lease &);
+			pool_set & m_set;
+			worker_pool * m_pool;
+		};
+	}
+}
+
+#endif
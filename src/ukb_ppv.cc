@@ -6,6 +6,7 @@
 #include "disambGraph.h"
 #include "wdict.h"
 #include "ukbServer.h"
+#include "ukbThreads.h"
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -42,6 +43,7 @@ static bool output_control_line = false;
 static bool output_variants_ppv = false;
 static float trunc_ppv = 0.0;
 static bool opt_nozero = false;
+static size_t opt_threads = 1;
 static string ppv_prefix;
 static string cmdline("!! -v ");
 
@@ -122,24 +124,22 @@ static void post_process_ranks(vector<float> & theranks) {
 			// For top k calculation
 			//
 			//  - fill with zeros all values except top k
-			//  - set opt_nozero = 1 so only top k are printed
+			//  - opt_nozero is set when parsing options, so only top k are
+			//    printed
 			//
 			// * could be a problem if top k had zeros in it, as they
 			//   will not be properly printed.
 			top_k(theranks, lexical_cast<size_t>(trunc_ppv));
-			opt_nozero = true;
 		}
 	}
 }
 
-// write a rank vector to an ostream
+// write an already post-processed rank vector to an ostream
 
-static void write_ppv_stream(vector<float> & ranks, ostream & os) {
+static void write_ppv_ranks(const vector<float> & ranks, ostream & os) {
 
 	Kb & kb = Kb::instance();
 
-	post_process_ranks(ranks);
-
 	if (output_control_line)
 		os << cmdline << "\n";
 	for(size_t i = 0, m = ranks.size(); i < m; ++i) {
@@ -153,6 +153,13 @@ static void write_ppv_stream(vector<float> & ranks, ostream & os) {
 	}
 }
 
+// write a rank vector to an ostream
+
+static void write_ppv_stream(vector<float> & ranks, ostream & os) {
+	post_process_ranks(ranks);
+	write_ppv_ranks(ranks, os);
+}
+
 static void write_ppv_stream(const vector<float> & outranks, ostream & os) {
 	vector<float> newranks(outranks);
 	write_ppv_stream(newranks, os);
@@ -183,16 +190,138 @@ static void maybe_postproc_ranks(vector<float> & ranks) {
 
 // Compute ppv given a CSentence
 
-bool compute_cs_ppv(CSentence & cs, vector<float> & ranks) {
-	if (!calculate_kb_ppr(cs,ranks)) return false;
+bool compute_cs_ppv(CSentence & cs, vector<float> & ranks, PrankWorkspace & ws) {
+	if (!calculate_kb_ppr(cs, ranks, ws)) return false;
 	maybe_postproc_ranks(ranks);
 	return true;
 }
 
+// Multithreaded version of compute_sentence_vectors (--threads)
+//
+// The calling thread reads and parses the contexts, compute workers
+// calculate and post-process the PPVs (each with its own PrankWorkspace),
+// and writer threads create the output files. The queues between stages
+// are bounded, so a slow stage makes the previous ones wait. A bad context
+// stops the reading, as in the serial version, so the same files are
+// written.
+
+struct ppv_out_t {
+	string id;
+	boost::shared_ptr<vector<float> > ranks;
+};
+
+struct ppv_pipeline_t {
+
+	ppv_pipeline_t(istream & is_, const string & out_dir_, size_t workers_, size_t writers_)
+		: is(is_), out_dir(out_dir_), workers(workers_), writers(writers_),
+		  jobs(2 * workers_), outs(workers_ + writers_), workers_left(workers_) {}
+
+	// tid 0 reads, tids [1, workers] compute, the rest write
+
+	void operator()(size_t tid) {
+		try {
+			if (tid == 0) read();
+			else if (tid <= workers) work();
+			else write();
+		} catch (...) {
+			jobs.abort();
+			outs.abort();
+			throw;
+		}
+	}
+
+	// Errors stop the reading but not the pipeline, so that the contexts
+	// already read are still written (as in the serial version). They are
+	// thrown again after the other threads finish.
+
+	void read() {
+		try {
+			read_contexts();
+		} catch (std::exception & e) {
+			fatal_msg = e.what();
+		}
+		jobs.close();
+	}
+
+	void read_contexts() {
+		size_t l_n  = 0;
+		string cid, ctx;
+		while (read_ukb_ctx(is, l_n, cid, ctx)) {
+			try {
+				boost::shared_ptr<CSentence> cs(new CSentence(cid, ctx));
+				if(ctx.size()) {
+					if (!jobs.push(cs)) return; // aborted
+				} else {
+					if (glVars::debug::warning) {
+						cerr << "[W] empty context " << cs->id() + " in line " + lexical_cast<string>(l_n) + "\n";
+					}
+				}
+			} catch (ukb::wdict_error & e) {
+				throw;
+			} catch (std::logic_error & e) {
+				string msg = "[E] Bad context in line " + lexical_cast<string>(l_n) + "\n" + e.what();
+				if (!glVars::input::swallow) throw std::runtime_error(msg);
+				if (glVars::debug::warning) {
+					cerr << msg << "\n";
+				}
+			}
+		}
+	}
+
+	void work() {
+		PrankWorkspace ws;
+		boost::shared_ptr<CSentence> cs;
+		while (jobs.pop(cs)) {
+			ppv_out_t out;
+			out.id = cs->id();
+			out.ranks.reset(new vector<float>);
+			if (!compute_cs_ppv(*cs, *out.ranks, ws)) {
+				cerr << "[W] Error when calculating ranks for csentence " << cs->id() << endl;
+				continue;
+			}
+			post_process_ranks(*out.ranks);
+			if (!outs.push(out)) return; // aborted
+		}
+		thr::scoped_lock lock(workers_mutex);
+		if (!--workers_left) outs.close();
+	}
+
+	void write() {
+		File_elem fout("lala", out_dir, ".ppv");
+		ppv_out_t out;
+		while (outs.pop(out)) {
+			boost::shared_ptr<ofstream> fo(output_ppv_fname(ppv_prefix + out.id, fout));
+			write_ppv_ranks(*out.ranks, *fo);
+		}
+	}
+
+	istream & is;
+	string out_dir;
+	size_t workers;
+	size_t writers;
+	thr::bounded_queue<boost::shared_ptr<CSentence> > jobs;
+	thr::bounded_queue<ppv_out_t> outs;
+	thr::mutex workers_mutex;
+	size_t workers_left;
+	string fatal_msg;
+};
+
+void compute_sentence_vectors_mt(istream & is, const string & out_dir, size_t workers) {
+	size_t writers = (workers + 3) / 4;
+	ppv_pipeline_t pipeline(is, out_dir, workers, writers);
+	thr::run_parallel(1 + workers + writers, pipeline);
+	if (pipeline.fatal_msg.size()) throw std::runtime_error(pipeline.fatal_msg);
+}
+
 // Get input from is, compute ppv and create output files under out_dir
 
 void compute_sentence_vectors(istream & is, string & out_dir) {
 
+	if (opt_threads > 1) {
+		compute_sentence_vectors_mt(is, out_dir, opt_threads);
+		return;
+	}
+
 	File_elem fout("lala", out_dir, ".ppv");
 
 	CSentence cs;
@@ -200,13 +329,13 @@ void compute_sentence_vectors(istream & is, string & out_dir) {
 	// Read sentences and compute rank vectors
 	size_t l_n  = 0;
 	string cid, ctx;
+	PrankWorkspace ws; // reused for all contexts
 	while (read_ukb_ctx(is, l_n, cid, ctx)) {
 		try {
 			CSentence cs(cid, ctx);
 			if(ctx.size()) {
-				vector<float> ranks;
-				// Initialize rank vector
-				if (!compute_cs_ppv(cs, ranks)) {
+				vector<float> & ranks = ws.rank;
+				if (!compute_cs_ppv(cs, ranks, ws)) {
 					cerr << "[W] Error when calculating ranks for csentence " << cs.id() << endl;
 					continue;
 				}
@@ -276,12 +405,13 @@ bool handle_server_read(sSession & session) {
 		if (!session.receive(ctx)) return true;
 		if (ctx == "stop") return false;
 		// TODO Check command is ppv
+		PrankWorkspace ws;
 		while(1) {
 			if (!session.receive(ctx_id)) break;
 			if (!session.receive(ctx)) break;
 			CSentence cs(ctx_id, ctx);
-			vector<float> ranks;
-			if (!compute_cs_ppv(cs, ranks)) {
+			vector<float> & ranks = ws.rank;
+			if (!compute_cs_ppv(cs, ranks, ws)) {
 				// throw "Error when calculating ranks for csentence " << cs.id() << endl;
 				// throw std::runtime_error(std::string("[E] when calculating ranks for csentence ") + cs.id() + ":" + this->error_str());
 				string aux("Error processing context " + ctx_id);
@@ -450,6 +580,9 @@ int main(int argc, char *argv[]) {
 		("prank_iter", value<size_t>(), "Number of iterations in pageRank. Default is 30.")
 		("prank_threshold", value<float>(), "Threshold for pageRank convergence. Default is 0.0001.")
 		("prank_damping", value<float>(), "Set damping factor in PageRank equation. Default is 0.85.")
+		("prank_threads", value<size_t>(), "Number of threads used by the PageRank power method. Zero means one per core. Default is 1.")
+		("prank_quant", value<string>(), "Quantize the edge weights used by the PageRank power method to 16 bits. Options are: none(default), fp16, log16.")
+		("threads", value<size_t>(), "Number of threads computing the PPVs of the input contexts in parallel. Zero means one per core. Default is 1.")
 		("nibble_epsilon", value<float>(), "Error for approximate pageRank as computed by the nibble algorithm.")
 		;
 
@@ -621,10 +754,33 @@ int main(int argc, char *argv[]) {
 			glVars::prank::damping = dp;
 		}
 
+		if (vm.count("prank_threads")) {
+			size_t nt = vm["prank_threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			glVars::prank::threads = nt;
+		}
+
+		if (vm.count("threads")) {
+			size_t nt = vm["threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			opt_threads = nt;
+		}
+
 		if (vm.count("prank_nibble")) {
 			glVars::prank::impl = glVars::nibble;
 		}
 
+		if (vm.count("prank_quant")) {
+			string str = vm["prank_quant"].as<string>();
+			if (str == "none") glVars::prank::weight_quant = glVars::wq_none;
+			else if (str == "fp16") glVars::prank::weight_quant = glVars::wq_fp16;
+			else if (str == "log16") glVars::prank::weight_quant = glVars::wq_log16;
+			else {
+				cerr << "Error: invalid prank_quant value " << str << ". Should be one of: none fp16 log16\n";
+				exit(-1);
+			}
+		}
+
 		if (vm.count("nibble_epsilon")) {
 			float dp = vm["nibble_epsilon"].as<float>();
 			if (dp <= 0.0 || dp > 1.0) {
@@ -651,6 +807,11 @@ int main(int argc, char *argv[]) {
 			opt_nozero = true;
 		}
 
+		if (trunc_ppv >= 1.0f) {
+			// top k, print only the top k (see post_process_ranks)
+			opt_nozero = true;
+		}
+
 		if (vm.count("input-file")) {
 			fullname_in = vm["input-file"].as<string>();
 		}
@@ -226,6 +226,7 @@ int main(int argc, char *argv[]) {
 		("verbose,v", "Be verbose.")
 		("kb_binfile,K", value<string>(), "Binary file of KB (see compile_kb).")
 		("dict_file,D", value<string>(), "Dictionary text file.")
+		("dict_binfile", value<string>(), "Dictionary binary file (see compile_kb --serialize_dict).")
 		;
 
 	options_description po_desc_waprint("walk and print options");
@@ -324,6 +325,10 @@ int main(int argc, char *argv[]) {
 			glVars::dict::text_fname = vm["dict_file"].as<string>();
 		}
 
+		if (vm.count("dict_binfile")) {
+			glVars::dict::bin_fname = vm["dict_binfile"].as<string>();
+		}
+
 		if (vm.count("dict_strict")) {
 			glVars::dict::swallow = false;
 		}
@@ -10,6 +10,7 @@
 #include <syslog.h>
 
 #include "ukbServer.h"
+#include "ukbThreads.h"
 
 // Basename & friends
 #include <boost/filesystem/operations.hpp>
@@ -49,6 +50,8 @@ main_method opt_dmethod = m_ppr_w2w;
 string cmdline;
 bool opt_daemon = false;
 bool opt_dump_dgraph = false;
+size_t opt_threads = 1;
+vector<string> opt_kb_deltas;
 
 // Program options stuff
 
@@ -181,10 +184,10 @@ void dgraph_csent(CSentence & cs) {
 	}
 }
 
-void ppr_csent(CSentence & cs) {
+void ppr_csent(CSentence & cs, PrankWorkspace & ws) {
 
-	vector<float> ranks;
-	bool ok = calculate_kb_ppr(cs,ranks);
+	vector<float> & ranks = ws.rank;
+	bool ok = calculate_kb_ppr(cs, ranks, ws);
 	if (!ok && glVars::debug::warning) {
 		std::cerr << "ppr_csent: [W] Error in sentence " << cs.id() << "\n";
 		return;
@@ -198,20 +201,38 @@ void ppr_csent(CSentence & cs) {
 //   2. run Personalized Pagerank
 //   3. use rank for disambiguating word
 
+//
+// The PPVs of all target words are computed together (see
+// calculate_kb_ppr_by_words), so that the graph is traversed once per
+// iteration for the whole context.
+
 void ppr_w2w_csent(CSentence & cs) {
 
-	vector<float> ranks;
 	int success_n = 0;
 
+	vector<CSentence::const_iterator> tgtws;
+	for(CSentence::const_iterator it = cs.ubegin(), end = cs.uend();
+		it != end; ++it) {
+		// Target word must be distinguished.
+		if(!it->is_tgtword()) continue;
+		if(it->is_monosemous()) continue;
+		tgtws.push_back(it);
+	}
+	vector<vector<float> > ranks;
+	vector<int> ok;
+	calculate_kb_ppr_by_words(cs, tgtws, ranks, ok);
+
+	size_t tgt_i = 0;
 	vector<CWord>::iterator cw_it = cs.ubegin();
 	vector<CWord>::iterator cw_end = cs.uend();
 	for(; cw_it != cw_end; ++cw_it) {
-		// Target word must be distinguished.
 		if(!cw_it->is_tgtword()) continue;
-		if (!cw_it->is_monosemous() &&
-			calculate_kb_ppr_by_word(cs, cw_it, ranks)) {
-			success_n++;
-			cw_it->rank_synsets(ranks, glVars::csentence::mult_priors);
+		if (!cw_it->is_monosemous()) {
+			if (ok[tgt_i]) {
+				success_n++;
+				cw_it->rank_synsets(ranks[tgt_i], glVars::csentence::mult_priors);
+			}
+			++tgt_i;
 		}
 		cw_it->disamb_cword();
 	}
@@ -223,15 +244,14 @@ void ppr_w2w_csent(CSentence & cs) {
 
 void static_csent(CSentence &cs) {
 
-	static vector<float> ranks;
-	if (!ranks.size()) {
-		ranks = Kb::instance().static_prank();
-	}
+	const vector<float> & ranks = Kb::instance().static_prank();
 	disamb_csentence_kb(cs, ranks);
 }
 
 
-void dispatch_run_cs(CSentence & cs) {
+// ws holds the PageRank buffers, which are reused among contexts
+
+void dispatch_run_cs(CSentence & cs, PrankWorkspace & ws) {
 
 	switch(opt_dmethod) {
 	case m_bfs:
@@ -239,7 +259,7 @@ void dispatch_run_cs(CSentence & cs) {
 		dgraph_csent(cs);
 		break;
 	case m_ppr:
-		ppr_csent(cs);
+		ppr_csent(cs, ws);
 		break;
 	case m_ppr_w2w:
 		ppr_w2w_csent(cs);
@@ -250,15 +270,138 @@ void dispatch_run_cs(CSentence & cs) {
 	};
 }
 
+///////////////////////////////////////////////
+// Multithreaded batch mode (--threads)
+//
+// The calling thread reads the contexts and queues them to the workers,
+// which disambiguate whole CSentences, each one with its own
+// PrankWorkspace. A writer thread prints the results in input order. Queues
+// are bounded, so reading stops when the workers or the writer fall behind.
+
+struct wsd_job_t {
+	size_t seq;
+	size_t l_n;
+	string cid;
+	string ctx;
+};
+
+struct wsd_result_t {
+	wsd_result_t() : fatal(false) {}
+	string out;  // output of print_csent
+	string msg;  // warning message, or error if fatal
+	bool fatal;  // stop processing at this context
+};
+
+struct wsd_pipeline_t {
+
+	wsd_pipeline_t(istream & is_, ostream & os_, size_t workers)
+		: is(is_), os(os_), jobs(2 * workers), results(4 * workers) {}
+
+	// tid 0 reads, tid 1 writes, the rest are workers
+
+	void operator()(size_t tid) {
+		try {
+			if (tid == 0) read();
+			else if (tid == 1) write();
+			else work();
+		} catch (...) {
+			jobs.abort();
+			results.abort();
+			throw;
+		}
+	}
+
+	void read() {
+		size_t l_n = 0;
+		size_t seq = 0;
+		wsd_job_t job;
+		while (read_ukb_ctx(is, l_n, job.cid, job.ctx)) {
+			job.seq = seq++;
+			job.l_n = l_n;
+			if (!jobs.push(job)) return; // aborted
+		}
+		jobs.close();
+		results.close(seq);
+	}
+
+	void work() {
+		PrankWorkspace ws;
+		wsd_job_t job;
+		while (jobs.pop(job)) {
+			wsd_result_t res;
+			process(job, ws, res);
+			if (!results.push(job.seq, res)) return; // aborted
+		}
+	}
+
+	void write() {
+		wsd_result_t res;
+		while (results.pop(res)) {
+			if (res.fatal) throw std::runtime_error(res.msg);
+			os << res.out;
+			if (res.msg.size()) cerr << res.msg;
+		}
+	}
+
+	// same as the body of the serial dispatch_run loop, but the output and
+	// the messages are stored in res
+
+	void process(const wsd_job_t & job, PrankWorkspace & ws, wsd_result_t & res) {
+		try {
+			CSentence cs(job.cid, job.ctx);
+			if(job.ctx.size()) {
+				dispatch_run_cs(cs, ws);
+				ostringstream oss;
+				cs.print_csent(oss);
+				res.out = oss.str();
+			} else {
+				if (glVars::debug::warning) {
+					res.msg = "[W] empty context " + cs.id() + " in line " + lexical_cast<string>(job.l_n) + "\n";
+				}
+			}
+		} catch (ukb::wdict_error & e) {
+			res.msg = e.what();
+			res.fatal = true;
+		} catch (std::logic_error & e) {
+			string msg = "[E] Bad context in line " + lexical_cast<string>(job.l_n) + "\n" + e.what();
+			if (!glVars::input::swallow) {
+				res.msg = msg;
+				res.fatal = true;
+			} else if (glVars::debug::warning) {
+				res.msg = msg + "\n";
+			}
+		} catch (std::exception & e) {
+			res.msg = e.what();
+			res.fatal = true;
+		}
+	}
+
+	istream & is;
+	ostream & os;
+	thr::bounded_queue<wsd_job_t> jobs;
+	thr::ordered_queue<wsd_result_t> results;
+};
+
+void dispatch_run_mt(istream & is, ostream & os, size_t workers) {
+	wsd_pipeline_t pipeline(is, os, workers);
+	thr::run_parallel(workers + 2, pipeline);
+}
+
 void dispatch_run(istream & is, ostream & os) {
 
+	if (opt_threads > 1) {
+		dispatch_run_mt(is, os, opt_threads);
+		return;
+	}
+
 	size_t l_n = 0;
 	string cid, ctx;
+	PrankWorkspace ws;
 	while (read_ukb_ctx(is, l_n, cid, ctx)) {
 		try {
 			CSentence cs(cid, ctx);
 			if(ctx.size()) {
-				dispatch_run_cs(cs);
+				dispatch_run_cs(cs, ws);
 				cs.print_csent(os);
 			} else {
 				if (glVars::debug::warning) {
@@ -277,6 +420,14 @@ void dispatch_run(istream & is, ostream & os) {
 	}
 }
 
+// Add the relations in fname to the KB (see Kb::read_from_txt)
+
+void add_kb_delta(const string & fname) {
+	glVars::kb::v1_kb = false;
+	glVars::kb::filter_src = false;
+	Kb::instance().read_from_txt(fname, set<string>());
+}
+
 ///////////////////////////////////////////////
 // Server/clien functions
 
@@ -289,12 +440,24 @@ bool handle_server_read(sSession & session) {
 	try {
 		if (!session.receive(ctx)) return true;
 		if (ctx == "stop") return false;
+		if (ctx == "delta") {
+			// add relations to the KB (see client_apply_delta)
+			string fname;
+			if (!session.receive(fname)) return true;
+			syslog(LOG_INFO | LOG_USER, "Adding relations of %s", fname.c_str());
+			size_t n = Kb::instance().delta_size();
+			add_kb_delta(fname);
+			session.send("Delta overlay has " + lexical_cast<string>(Kb::instance().delta_size()) +
+						 " edges (" + lexical_cast<string>(Kb::instance().delta_size() - n) + " new)");
+			return true;
+		}
 		session.send(cmdline);
+		PrankWorkspace ws;
 		while(1) {
 			if (!session.receive(ctx_id)) break;
 			if (!session.receive(ctx)) break;
 			CSentence cs(ctx_id, ctx);
-			dispatch_run_cs(cs);
+			dispatch_run_cs(cs, ws);
 			ostringstream oss;
 			cs.print_csent(oss);
 			string oss_str(oss.str());
@@ -341,6 +504,27 @@ bool client(istream & is, ostream & os, unsigned int port) {
 }
 
 
+bool client_apply_delta(unsigned int port, const string & fname) {
+	// send the (absolute) name of a delta file to the ukb daemon
+	sClient client("localhost", port);
+	string delta("delta");
+	string res;
+	if (client.error()) {
+		std::cerr << "client_apply_delta: [E] Error when connecting: " << client.error_str() << std::endl;
+		return false;
+	}
+	try {
+		client.send(delta);
+		client.send(get_fname_absolute(fname));
+		client.receive(res);
+		std::cerr << res << std::endl;
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
 bool client_stop_server(unsigned int port) {
 	// connect to ukb port and tell it to stop
 	sClient client("localhost", port);
@@ -369,6 +553,16 @@ void load_kb_and_dict(bool from_daemon) {
 		cout << "Loading KB " + glVars::kb::fname + "\n";
 	}
 	Kb::create_from_binfile(glVars::kb::fname);
+	for(size_t i = 0; i < opt_kb_deltas.size(); ++i) {
+		if (from_daemon) {
+			string aux("Adding relations of ");
+			aux += opt_kb_deltas[i];
+			syslog(LOG_INFO | LOG_USER, "%s", aux.c_str());
+		} else if (glVars::verbose) {
+			cout << "Adding relations of " + opt_kb_deltas[i] + "\n";
+		}
+		add_kb_delta(opt_kb_deltas[i]);
+	}
 	// Explicitly load dictionary only if:
 	// - there is a dictionary name (textual or binary)
 	// - from_daemon is set
@@ -408,6 +602,7 @@ int main(int argc, char *argv[]) {
 	bool opt_do_test = false;
 	bool opt_client = false;
 	bool opt_shutdown = false;
+	string delta_fname;
 
 	cmdline = string("!! -v ");
 	cmdline += glVars::ukb_version;
@@ -443,6 +638,7 @@ int main(int argc, char *argv[]) {
 		("help,h", "This page")
 		("version", "Show version.")
 		("kb_binfile,K", value<string>(), "Binary file of KB (see compile_kb).")
+		("kb_delta", value<vector<string> >(), "Text file with relations to add to the KB after loading it (see README). Can be repeated.")
 		("dict_file,D", value<string>(), "Dictionary text file.")
 		("dict_binfile", value<string>(), "Dictionary binary file.")
 		;
@@ -456,6 +652,7 @@ int main(int argc, char *argv[]) {
 		("dgraph_dfs", "Given a text input file, disambiguate context using disambiguation graph mehod (dfs).")
 		("nostatic", "Substract static ppv to final ranks.")
 		("noprior", "Don't multiply priors to target word synsets if --ppr_w2w and --dict_weight are selected.")
+		("threads", value<size_t>(), "Number of threads for disambiguating the input contexts in parallel. Zero means one per core. Default is 1.")
 		;
 
 	options_description po_desc_input("Input options");
@@ -472,9 +669,12 @@ int main(int argc, char *argv[]) {
 		("prank_iter", value<size_t>(), "Number of iterations in pageRank. Default is 30.")
 		("prank_threshold", value<float>(), "Threshold for stopping PageRank. Default is zero. Good value is 0.0001.")
 		("prank_damping", value<float>(), "Set damping factor in PageRank equation. Default is 0.85.")
+		("prank_threads", value<size_t>(), "Number of threads used by the PageRank power method. Zero means one per core. Default is 1.")
+		("prank_quant", value<string>(), "Quantize the edge weights used by the PageRank power method to 16 bits. Options are: none(default), fp16, log16.")
 		("dgraph_rank", value<string>(), "Set disambiguation method for dgraphs. Options are: ppr(default), ppr_w2w, coherence, static, degree.")
 		("dgraph_maxdepth", value<size_t>(), "If --dgraph_dfs is set, specify the maximum depth (default is 6).")
 		("dgraph_nocosenses", "If --dgraph_dfs, stop DFS when finding one co-sense of target word in path.")
+		("dgraph_threads", value<size_t>(), "Number of threads for building the disambiguation graph of a context. Zero means one per core. Default is 1.")
 		("nibble_epsilon", value<float>(), "Error for approximate pageRank as computed by the nibble algorithm.")
 		;
 
@@ -503,6 +703,7 @@ int main(int argc, char *argv[]) {
 		("port", value<unsigned int>(), "Port to listen/send information.")
 		("client", "Use client mode to send contexts to the ukb daemon. Bare in mind that the configuration is that of the server.")
 		("shutdown", "Shutdown ukb daemon.")
+		("apply_delta", value<string>(), "Add the relations in this text file to the KB of the ukb daemon.")
 		;
 
 	options_description po_visible(desc_header);
@@ -603,10 +804,33 @@ int main(int argc, char *argv[]) {
 			glVars::prank::damping = dp;
 		}
 
+		if (vm.count("threads")) {
+			size_t nt = vm["threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			opt_threads = nt;
+		}
+
+		if (vm.count("prank_threads")) {
+			size_t nt = vm["prank_threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			glVars::prank::threads = nt;
+		}
+
 		if (vm.count("prank_nibble")) {
 			glVars::prank::impl = glVars::nibble;
 		}
 
+		if (vm.count("prank_quant")) {
+			string str = vm["prank_quant"].as<string>();
+			if (str == "none") glVars::prank::weight_quant = glVars::wq_none;
+			else if (str == "fp16") glVars::prank::weight_quant = glVars::wq_fp16;
+			else if (str == "log16") glVars::prank::weight_quant = glVars::wq_log16;
+			else {
+				cerr << "Error: invalid prank_quant value " << str << ". Should be one of: none fp16 log16\n";
+				exit(-1);
+			}
+		}
+
 		if (vm.count("nibble_epsilon")) {
 			float dp = vm["nibble_epsilon"].as<float>();
 			if (dp <= 0.0 || dp > 1.0) {
@@ -629,6 +853,12 @@ int main(int argc, char *argv[]) {
 			glVars::dGraph::stopCosenses = true;
 		}
 
+		if (vm.count("dgraph_threads")) {
+			size_t nt = vm["dgraph_threads"].as<size_t>();
+			if (nt == 0) nt = thr::hardware_threads();
+			glVars::dGraph::threads = nt;
+		}
+
 		if (vm.count("dgraph_rank")) {
 			string str = vm["dgraph_rank"].as<string>();
 			map<string, dgraph_rank>::iterator it = map_dgraph_ranks.find(str);
@@ -691,6 +921,10 @@ int main(int argc, char *argv[]) {
 			glVars::kb::fname = vm["kb_binfile"].as<string>();
 		}
 
+		if (vm.count("kb_delta")) {
+			opt_kb_deltas = vm["kb_delta"].as<vector<string> >();
+		}
+
 		if (vm.count("rank_alg")) {
 			glVars::RankAlg alg = glVars::get_algEnum(vm["rank_alg"].as<string>());
 			if (alg == glVars::no_alg) {
@@ -777,11 +1011,26 @@ int main(int argc, char *argv[]) {
 #endif
 		}
 
+		if (vm.count("apply_delta")) {
+#ifdef UKB_SERVER
+			delta_fname = vm["apply_delta"].as<string>();
+#else
+			cerr << "[E] server not available (compile ukb without -DUKB_SERVER switch)\n";
+			exit(1);
+#endif
+		}
+
 	} catch(std::exception& e) {
 		cerr << e.what() << "\n";
 		exit(-1);
 	}
 
+	if(delta_fname.size()) {
+#ifdef UKB_SERVER
+		return !client_apply_delta(port, delta_fname);
+#endif
+	}
+
 	if(opt_shutdown) {
 #ifdef UKB_SERVER
 		if (client_stop_server(port)) {
@@ -811,6 +1060,9 @@ int main(int argc, char *argv[]) {
 			glVars::kb::fname =  get_fname_absolute(glVars::kb::fname);
 			glVars::dict::text_fname = get_fname_absolute(glVars::dict::text_fname);
 			glVars::dict::altdict_fname = get_fname_absolute(glVars::dict::altdict_fname);
+			for(size_t i = 0; i < opt_kb_deltas.size(); ++i) {
+				opt_kb_deltas[i] = get_fname_absolute(opt_kb_deltas[i]);
+			}
 		} catch(std::exception& e) {
 			cerr << e.what() << "\n";
 			return 1;
@@ -846,6 +1098,9 @@ int main(int argc, char *argv[]) {
 		cmdline += " <STDIN>";
 		fullname_in = "<STDIN>";
 	} else {
+		// read the input in big chunks (the buffer has to be set before opening)
+		static char input_buf[1 << 20];
+		input_ifs.rdbuf()->pubsetbuf(input_buf, sizeof(input_buf));
 		input_ifs.open(fullname_in.c_str(), ofstream::in);
 		if (!input_ifs) {
 			cerr << "[E] Can't open " << fullname_in << endl;
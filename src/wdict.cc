@@ -4,6 +4,8 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <limits>
 
 #include<boost/tuple/tuple.hpp> // for "tie"
 
@@ -20,17 +22,11 @@ namespace ukb {
 	// Global variables
 	//const std::string text_fname = "kb_source/enWN16";
 
-	std::ostream & operator<<(std::ostream & o, const wdict_rhs_t & rhs) {
-		Kb & kb = Kb::instance();
-		for(size_t i = 0, n = rhs.m_items.size(); i != n; ++i) {
-			o << " " << kb.get_vertex_name(rhs.m_items[i].m_syn);
-			if (glVars::dict::use_weight)  o << ":" << rhs.m_items[i].m_count;
-		}
-		return o;
-	};
-
 	std::ostream & operator<<(std::ostream & o, const WDict_entries & entry) {
-		o << entry.m_rhs;
+		for(const wdict_item_t * it = entry.begin(), * end = entry.end(); it != end; ++it) {
+			o << " " << Kb::instance().get_vertex_name(it->m_syn);
+			if (glVars::dict::use_weight)  o << ":" << it->m_count;
+		}
 		return o;
 	}
 
@@ -215,11 +211,46 @@ namespace ukb {
 	};
 
 
-	static void fill_wdict_hw(wdict_rhs_t & rhs,
-							  vector<concept_parse_t> & V) {
-		sort(V.begin(), V.end(), pos_order());
+	// Flat dictionary arrays under construction (see WDict). Headwords are
+	// added one after the other: add_hw, then its items and ranges, then
+	// close_hw.
+
+	struct wdict_builder_t {
+		vertex_names_t hws;
+		vector<string> pos;
+		vector<boost::uint64_t> item_ofs;
 		vector<wdict_item_t> items;
-		vector<wdict_range_t> pos_ranges;
+		vector<boost::uint64_t> range_ofs;
+		vector<wdict_range_t> ranges;
+
+		wdict_builder_t() : item_ofs(1, 0), range_ofs(1, 0) {}
+
+		boost::uint8_t pos_code(const string & p) {
+			for(size_t i = 0; i < pos.size(); ++i) {
+				if (pos[i] == p) return i;
+			}
+			if (pos.size() == 256)
+				throw ukb::wdict_error("Too many POS in dictionary (max. 256)");
+			pos.push_back(p);
+			return pos.size() - 1;
+		}
+
+		void add_hw(const string & hw) {
+			if (hws.insert(hw) != item_ofs.size() - 1)
+				throw ukb::wdict_error("Repeated headword " + hw);
+		}
+
+		void close_hw() {
+			item_ofs.push_back(items.size());
+			range_ofs.push_back(ranges.size());
+		}
+
+		// add the concepts in V, grouped by POS
+		void add_concepts(vector<concept_parse_t> & V);
+	};
+
+	void wdict_builder_t::add_concepts(vector<concept_parse_t> & V) {
+		sort(V.begin(), V.end(), pos_order());
 		set<Kb::vertex_descriptor> U;
 		size_t idx = 0;
 		size_t left = 0;
@@ -228,7 +259,7 @@ namespace ukb {
 			if (!U.insert(V[i].u).second) continue; // Concept previously there
 			if (V[i].pos != old_pos) {
 				if (left != idx) {
-					pos_ranges.push_back(wdict_range_t(old_pos, left, idx));
+					ranges.push_back(wdict_range_t(pos_code(old_pos), left, idx));
 					left = idx;
 				}
 				old_pos = V[i].pos;
@@ -238,12 +269,8 @@ namespace ukb {
 		}
 		// insert last range
 		if (left != idx) {
-			pos_ranges.push_back(wdict_range_t(old_pos, left, idx));
+			ranges.push_back(wdict_range_t(pos_code(old_pos), left, idx));
 		}
-		// swap vectors from temporary, so they don't take more space than neccesary
-		//vector<wdict_item_t> (items).swap(rhs.m_items);
-		rhs.m_items.assign(items);
-		rhs.m_pos_ranges.assign(pos_ranges);
 	}
 
 	static size_t read_dictfile_1pass(const string & fname,
@@ -308,43 +335,85 @@ namespace ukb {
 
 		map<string, ccache_map_t> concept_cache;
 
-		m_N = read_dictfile_1pass(fname, concept_cache);
-		if(m_N == 0)
+		size_t N = read_dictfile_1pass(fname, concept_cache);
+		if(N == 0)
 			throw ukb::wdict_error("Error reading dict. No headwords linked to KB");
 
 		// Now, create the actual dictionary given a concept_cache (which is
 		// temporary, and is used to remove possible duplicated entries)
 
+		wdict_builder_t b;
 		for (map<string, ccache_map_t>::iterator it = concept_cache.begin(), end = concept_cache.end();
 			 it != end; ++it) {
-			WDict::wdict_t::iterator map_value_it = m_wdict.insert(make_pair(it->first, wdict_rhs_t())).first;
-			fill_wdict_hw(map_value_it->second, it->second.V);
+			b.add_hw(it->first);
+			b.add_concepts(it->second.V);
+			b.close_hw();
 		}
+		swap_arrays(b);
 	}
 
 	void WDict::read_alternate_file(const string & fname) {
 
 		map<string, ccache_map_t> concept_cache;
-		bool insertedP;
 
 		read_dictfile_1pass(fname, concept_cache);
 
-		for (map<string, ccache_map_t>::iterator it = concept_cache.begin(), end = concept_cache.end();
-			 it != end; ++it) {
-			wdict_t::iterator mit;
-			wdict_rhs_t empty_rhs;
-			tie (mit, insertedP) = m_wdict.insert(make_pair(it->first, empty_rhs));
-			if (!insertedP) {
-				// already in map, so empty existing concepts (will be replaced by alternate dict)
-				mit->second.swap(empty_rhs);
+		// The arrays are built again. Headwords in the alternate file replace
+		// the existing ones, and new headwords go after them.
+
+		wdict_builder_t b;
+		for(size_t h = 0, H = size(); h < H; ++h) {
+			string hw(headword(h));
+			b.add_hw(hw);
+			map<string, ccache_map_t>::iterator it = concept_cache.find(hw);
+			if (it != concept_cache.end()) {
+				b.add_concepts(it->second.V);
+				concept_cache.erase(it);
 			} else {
-				m_N++; // New headword
+				const wdict_item_t * items = m_items + m_item_ofs[h];
+				b.items.insert(b.items.end(), items, m_items + m_item_ofs[h + 1]);
+				for(const wdict_range_t * r = m_ranges + m_range_ofs[h], * rend = m_ranges + m_range_ofs[h + 1];
+					r != rend; ++r) {
+					b.ranges.push_back(wdict_range_t(b.pos_code(pos_name(r->pos)), r->left, r->right));
+				}
 			}
-			fill_wdict_hw(mit->second, it->second.V);
+			b.close_hw();
 		}
+		for (map<string, ccache_map_t>::iterator it = concept_cache.begin(), end = concept_cache.end();
+			 it != end; ++it) {
+			b.add_hw(it->first);
+			b.add_concepts(it->second.V);
+			b.close_hw();
+		}
+		swap_arrays(b);
 	}
 
-	WDict::WDict() : m_N(0) {
+	void WDict::swap_arrays(wdict_builder_t & b) {
+		m_hws.swap(b.hws);
+		m_pos.swap(b.pos);
+		m_item_ofs_buf.swap(b.item_ofs);
+		m_items_buf.swap(b.items);
+		m_range_ofs_buf.swap(b.range_ofs);
+		m_ranges_buf.swap(b.ranges);
+		sync();
+		clear_inverse_dict();
+		m_mapped.reset();
+		m_variants.clear();
+	}
+
+	// point to the owned arrays. Unused POS codes are empty strings.
+
+	void WDict::sync() {
+		m_pos.resize(256);
+		m_item_ofs = &m_item_ofs_buf[0];
+		m_items = m_items_buf.size() ? &m_items_buf[0] : NULL;
+		m_range_ofs = &m_range_ofs_buf[0];
+		m_ranges = m_ranges_buf.size() ? &m_ranges_buf[0] : NULL;
+	}
+
+	WDict::WDict() : m_item_ofs_buf(1, 0), m_range_ofs_buf(1, 0),
+					 m_inv_mapped(false), m_inv_n(0), m_inv_ofs(NULL), m_inv_items(NULL) {
+		sync();
 		if(glVars::dict::text_fname.size() == 0 and glVars::dict::bin_fname.size() == 0)
 			throw std::runtime_error("[E] WDict: no dict file\n");
 		if (glVars::dict::text_fname.size()) read_wdict_file(glVars::dict::text_fname);
@@ -359,62 +428,40 @@ namespace ukb {
 	}
 
 	size_t WDict::size() const {
-		return m_N;
+		return m_hws.size();
 	}
 
 	size_t WDict::size_inv() const {
-		if (!m_wdict_inv.size()) create_inverse_dict();
-		return m_wdict_inv.size();
+		ensure_inverse_dict();
+		size_t n = 0;
+		for(size_t u = 0; u < m_inv_n; ++u) {
+			if (m_inv_ofs[u + 1] != m_inv_ofs[u]) ++n;
+		}
+		return n;
 	}
 
 	void WDict::size_bytes() {
-		long D = 0;
-		long C = 0;
-		long O_str = 0; // overhead
-		long O_rhs = 0; // overhead
-		long O_items = 0; // overhead
-		long O_ranges = 0; // overhead
-		long O_hash = 0; // overhead
+		size_t H = size();
+		size_t ofs_bytes = (H + 1) * sizeof(boost::uint64_t);
+		size_t hw_bytes = ofs_bytes + m_hws.arena_size() + m_hws.hash_size() * sizeof(boost::uint32_t);
+		size_t item_bytes = ofs_bytes + m_item_ofs[H] * sizeof(wdict_item_t);
+		size_t range_bytes = ofs_bytes + m_range_ofs[H] * sizeof(wdict_range_t);
 		long V = 0;
-		O_hash += sizeof(m_wdict);
-		for (WDict::wdict_t::const_iterator it = m_wdict.begin(), end = m_wdict.end();
-			 it != end; ++it) {
-			O_hash += sizeof(*it);
-			O_str += sizeof(it->first);
-			D += it->first.size();
-			C += it->first.capacity();
-			const wdict_rhs_t & rhs = it->second;
-			O_rhs += sizeof(rhs);
-			D += rhs.m_items.size() * sizeof(Kb::vertex_descriptor);
-			C += rhs.m_items.capacity() * sizeof(Kb::vertex_descriptor);
-			O_items += sizeof(rhs.m_items);
-			O_ranges += sizeof(rhs.m_pos_ranges);
-			for(const wdict_range_t * pit = rhs.m_pos_ranges.begin();
-				pit != rhs.m_pos_ranges.end(); ++pit) {
-				O_ranges += sizeof(*pit);
-				D += pit->pos.size();
-				C += pit->pos.capacity();
-				D += sizeof(pit->left);
-				D += sizeof(pit->right);
-			}
-		}
 		for(map<std::string, std::string>::const_iterator it = m_variants.begin(), end = m_variants.end();
 			it != end; ++it) {
 			V += it->first.size();
 			V += it->second.size();
 		}
-		cout << "Dict: " << D << " " << "Capacity: " << C << " Overhead: " << O_hash + O_str + O_rhs + O_items + O_ranges << "\n";
-		cout << "O_hash " << O_hash << " ";
-		cout << "O_rhs " << O_rhs << " ";
-		cout << "O_str " << O_rhs << " ";
-		cout << "O_items " << O_items << " ";
-		cout << "O_ranges " << O_ranges << "\n";
-
+		cout << "Dict: " << hw_bytes + item_bytes + range_bytes << (m_mapped.get() ? " (mapped)" : "") << "\n";
+		cout << "Headwords " << hw_bytes << " ";
+		cout << "Items " << item_bytes << " ";
+		cout << "Ranges " << range_bytes << " ";
+		cout << "Variants " << V << "\n";
 	}
 
 
 	static void add_variant_pos(const string & hw,
-								const wdict_vector<wdict_item_t> & items,
+								const wdict_item_t * items,
 								const string & pos,
 								size_t left,
 								size_t right,
@@ -435,24 +482,23 @@ namespace ukb {
 		}
 	}
 
-	void WDict::create_variant_map() {
+	void WDict::create_variant_map() const {
 
-		for(wdict_t::const_iterator it = m_wdict.begin(), end = m_wdict.end();
-			it != end; ++it) {
-			const string & hw = it->first;
-			const wdict_rhs_t & rhs(it->second);
-			const wdict_range_t * rit = rhs.m_pos_ranges.begin();
-			const wdict_range_t * rend = rhs.m_pos_ranges.end();
+		for(size_t h = 0, H = size(); h < H; ++h) {
+			string hw(headword(h));
+			const wdict_item_t * items = m_items + m_item_ofs[h];
+			const wdict_range_t * rit = m_ranges + m_range_ofs[h];
+			const wdict_range_t * rend = m_ranges + m_range_ofs[h + 1];
 			if(rit == rend) {
 				// no pos
-				add_variant_pos(hw, rhs.m_items,
+				add_variant_pos(hw, items,
 								string(""),
-								0, rhs.m_items.size(),
+								0, m_item_ofs[h + 1] - m_item_ofs[h],
 								m_variants);
 			} else
 				for(;rit != rend; ++rit) {
-					add_variant_pos(hw, rhs.m_items,
-									rit->pos,
+					add_variant_pos(hw, items,
+									pos_name(rit->pos),
 									rit->left, rit->right,
 									m_variants);
 				}
@@ -466,75 +512,97 @@ namespace ukb {
 		}
 	};
 
+	// Build the inverse dictionary, with one row per concept up to the
+	// largest concept in the dictionary.
+
 	void WDict::create_inverse_dict() const {
 
-		bool P;
-		for(wdict_t::const_iterator it = m_wdict.begin(), end = m_wdict.end();
-			it != end; ++it) {
-			const string & hw = it->first;
-			const wdict_rhs_t & rhs(it->second);
-
-			// no pos
-			for(wdict_vector<wdict_item_t>::const_iterator rhs_it = rhs.m_items.begin(), rhs_end = rhs.m_items.end();
-				rhs_it < rhs_end; ++rhs_it) {
-				winvdict_t::iterator winv_it;
-				tie(winv_it, P) = m_wdict_inv.insert(make_pair(rhs_it->m_syn, vector<winvdict_item_t>()));
-				winv_it->second.push_back(winvdict_item_t(hw, rhs_it->m_count));
+		size_t H = size();
+		size_t item_n = m_item_ofs[H];
+		size_t V = 0;
+		for(size_t i = 0; i < item_n; ++i) {
+			if (size_t(m_items[i].m_syn) >= V) V = m_items[i].m_syn + 1;
+		}
+
+		vector<boost::uint64_t> ofs(V + 1, 0);
+		for(size_t i = 0; i < item_n; ++i) ++ofs[m_items[i].m_syn + 1];
+		for(size_t u = 0; u < V; ++u) ofs[u + 1] += ofs[u];
+
+		// headwords in id order
+		vector<winvdict_item_t> items(item_n);
+		vector<boost::uint64_t> fill(ofs.begin(), ofs.end() - 1);
+		for(size_t h = 0; h < H; ++h) {
+			for(size_t i = m_item_ofs[h]; i < m_item_ofs[h + 1]; ++i) {
+				items[fill[m_items[i].m_syn]++] = winvdict_item_t(h, m_items[i].m_count);
 			}
 		}
+
 		// normalize probabilities
-		for(winvdict_t::iterator it = m_wdict_inv.begin(), end = m_wdict_inv.end();
-			it != end; ++it) {
+		for(size_t u = 0; u < V; ++u) {
+			vector<winvdict_item_t>::iterator it = items.begin() + ofs[u];
+			vector<winvdict_item_t>::iterator end = items.begin() + ofs[u + 1];
 			float sum = 0.0f;
-			for(winvdict_rhs_t::iterator rhs_it = it->second.begin(), rhs_end = it->second.end();
-				rhs_it != rhs_end; ++rhs_it) {
+			for(vector<winvdict_item_t>::iterator rhs_it = it; rhs_it != end; ++rhs_it) {
 				sum += rhs_it->m_count;
 			}
 			if (sum == 0.0f) continue;
 			float factor = 1.0f / sum;
-			for(winvdict_rhs_t::iterator rhs_it = it->second.begin(), rhs_end = it->second.end();
-				rhs_it != rhs_end; ++rhs_it) {
+			for(vector<winvdict_item_t>::iterator rhs_it = it; rhs_it != end; ++rhs_it) {
 				rhs_it->m_count *= factor;
 			}
 			// sort according to prob
-			sort(it->second.begin(), it->second.end(), functor_invdict_prob());
+			stable_sort(it, end, functor_invdict_prob());
 		}
+
+		m_inv_ofs_buf.swap(ofs);
+		m_inv_items_buf.swap(items);
+		m_inv_n = V;
+		m_inv_ofs = &m_inv_ofs_buf[0];
+		m_inv_items = m_inv_items_buf.size() ? &m_inv_items_buf[0] : NULL;
 	}
 
+	void WDict::clear_inverse_dict() {
+		m_inv_mapped = false;
+		m_inv_n = 0;
+		m_inv_ofs = NULL;
+		m_inv_items = NULL;
+		vector<boost::uint64_t>().swap(m_inv_ofs_buf);
+		vector<winvdict_item_t>().swap(m_inv_items_buf);
+	}
+
+	void WDict::ensure_inverse_dict() const {
+		if (m_inv_mapped) return;
+		thr::scoped_lock lock(m_lazy_mutex);
+		if (!m_inv_ofs) create_inverse_dict();
+	}
+
+	void WDict::ensure_variant_map() const {
+		thr::scoped_lock lock(m_lazy_mutex);
+		if (!m_variants.size()) create_variant_map();
+	}
 
 	WInvdict_entries WDict::words(Kb::vertex_descriptor u) const {
-		static winvdict_rhs_t null_entry;
-		if (!m_wdict_inv.size()) create_inverse_dict();
-		winvdict_t::const_iterator it = m_wdict_inv.find(u);
-		if (it == m_wdict_inv.end()) return WInvdict_entries(null_entry);
-		return WInvdict_entries(it->second);
+		ensure_inverse_dict();
+		if (size_t(u) >= m_inv_n) return WInvdict_entries(*this, NULL, NULL);
+		return WInvdict_entries(*this, m_inv_items + m_inv_ofs[u], m_inv_items + m_inv_ofs[u + 1]);
 	}
 
 	WInvdict_entries WDict::words(const std::string & ustr) const {
-		static winvdict_rhs_t null_entry;
 		Kb::vertex_descriptor u;
 		bool aux;
 		tie(u, aux) = Kb::instance().get_vertex_by_name(ustr);
-		if (!aux) return WInvdict_entries(null_entry);
+		if (!aux) return WInvdict_entries(*this, NULL, NULL);
 		return words(u);
 	}
 
-	const winvdict_rhs_t::const_iterator WInvdict_entries::begin() const {
-		return m_rhs.begin();
-	};
-
-	const winvdict_rhs_t::const_iterator WInvdict_entries::end() const {
-		return m_rhs.end();
-	};
+	std::string WInvdict_entries::get_word(size_t i) const {
+		return m_wdict.headword(m_beg[i].m_hw);
+	}
 
 	std::string WDict::variant(std::string & concept_id) const {
 
 		static string res("Not in Dictionary");
-		if (m_variants.size() == 0) {
-			// Remove const'ness
-			WDict & me = const_cast<WDict &>(*this);
-			me.create_variant_map();
-		}
+		ensure_variant_map();
 		map<string, string>::const_iterator it = m_variants.find(concept_id);
 		if (it == m_variants.end())
 			return res;
@@ -542,56 +610,45 @@ namespace ukb {
 	}
 
 	WDict_entries WDict::get_entries(const std::string & word, const string & pos) const {
-		static wdict_rhs_t null_entry;
-		wdict_t::const_iterator map_value_it = m_wdict.find(word);
-		if (map_value_it == m_wdict.end()) return WDict_entries(null_entry);
-		if (!pos.size() || pos == "#") return WDict_entries(map_value_it->second); // if word has no pos, consider all RHS as possible synsets
-		return WDict_entries(map_value_it->second, pos);
-		//return WDict_entries(m_wdict[&word]);
+		size_t h;
+		if (!m_hws.find(word, h)) return WDict_entries();
+		if (!pos.size() || pos == "#") return hw_entries(h); // if word has no pos, consider all RHS as possible synsets
+		return hw_entries(h, pos);
 	}
 
-	//////////////////////////////////////////////////////////////
-	// WDict_entries
-
-	WDict_entries::WDict_entries(const wdict_rhs_t & rhs)
-		: m_rhs(rhs), m_pos(std::string()), m_left(0), m_right(rhs.m_items.size()) {}
-
-
-	struct wdict_range_pos_P {
-		bool operator() (const wdict_range_t & a) {
-			return a.pos == m_p;
-		}
-		wdict_range_pos_P(const string & p) : m_p(p) {}
-		const string & m_p;
-	};
+	WDict_entries WDict::hw_entries(size_t h) const {
+		return WDict_entries(m_items + m_item_ofs[h], 0, m_item_ofs[h + 1] - m_item_ofs[h], std::string());
+	}
 
-	WDict_entries::WDict_entries(const wdict_rhs_t & rhs, const std::string & pos)
-		: m_rhs(rhs), m_pos(pos), m_left(0), m_right(0) {
-		const wdict_range_t * end = rhs.m_pos_ranges.end();
-		const wdict_range_t * it = std::find_if(rhs.m_pos_ranges.begin(), end, wdict_range_pos_P(pos));
-		if (it != end) {
-			m_left = it->left;
-			m_right = it->right;
+	WDict_entries WDict::hw_entries(size_t h, const std::string & pos) const {
+		const wdict_item_t * items = m_items + m_item_ofs[h];
+		for(const wdict_range_t * it = m_ranges + m_range_ofs[h], * end = m_ranges + m_range_ofs[h + 1];
+			it != end; ++it) {
+			if (pos_name(it->pos) == pos) return WDict_entries(items, it->left, it->right, pos);
 		}
+		return WDict_entries(items, 0, 0, pos);
 	}
 
+	//////////////////////////////////////////////////////////////
+	// WDict_entries
+
 	size_t WDict_entries::size() const {
 		return m_right - m_left;
 	}
 
 	const wdict_item_t *WDict_entries::begin() const {
-		return m_rhs.m_items.begin() + m_left;
+		return m_items + m_left;
 	};
 
 	const wdict_item_t *WDict_entries::end() const {
-		return m_rhs.m_items.begin() + m_right;
+		return m_items + m_right;
 	};
 
 	Kb::vertex_descriptor WDict_entries::get_entry(size_t i) const {
-		return m_rhs.m_items[i + m_left].m_syn;
+		return m_items[i + m_left].m_syn;
 	}
 
-	const std::string & WDict_entries::get_entry_str(size_t i) const {
+	std::string WDict_entries::get_entry_str(size_t i) const {
 		return Kb::instance().get_vertex_name(this->get_entry(i));
 	}
 
@@ -601,14 +658,13 @@ namespace ukb {
 
 	float WDict_entries::get_freq(size_t i) const {
 		if (!glVars::dict::use_weight) return 1.0;
-		return m_rhs.m_items[i + m_left].m_count;
+		return m_items[i + m_left].m_count;
 	}
 
 	std::ostream & operator<<(std::ostream & o, const WDict & dict) {
 
-		for (WDict::wdict_t::const_iterator it = dict.m_wdict.begin(), end = dict.m_wdict.end();
-			 it != end; ++it) {
-			o << it->first << it->second << "\n";
+		for(size_t h = 0, H = dict.size(); h < H; ++h) {
+			o << dict.headword(h) << dict.hw_entries(h) << "\n";
 		}
 		return o;
 	};
@@ -617,10 +673,51 @@ namespace ukb {
 	// Streaming
 
 	static const size_t magic_id_dict_v0 = 0x130926;
+	static const boost::uint64_t magic_id_dict_map = 0x261102;
 
+	// Memory mappable dictionary binfiles (magic_id_dict_map, see
+	// ukbMmap.h)
+	//
+	// The header holds these boost::uint64_t values:
+	//
+	//   magic_id_dict_map, dict_map_version, number of headwords, number of
+	//   items, number of POS ranges, number of sections
+	//
+	// The inverse dictionary sections are optional (it is built on demand
+	// when missing).
+	//
+	// Concepts are vertex ids, so the file is only valid for the KB which
+	// was used when compiling it.
+
+	static const boost::uint64_t dict_map_version = 1;
+	static const size_t dict_map_header_n = 6;
+
+	enum dict_section_id {
+		dsec_meta = 1,      // POS of each code (stream format)
+		dsec_hw_offset,     // uint64_t[H + 1]
+		dsec_hw_arena,      // char[]
+		dsec_hw_hash,       // uint32_t[2^k], headword hash table (see vertex_names_t)
+		dsec_item_offset,   // uint64_t[H + 1]
+		dsec_items,         // wdict_item_t[items]
+		dsec_range_offset,  // uint64_t[H + 1]
+		dsec_ranges,        // wdict_range_t[ranges]
+		dsec_inv_offset,    // uint64_t[V + 1], V concepts
+		dsec_inv_items      // winvdict_item_t[items]
+	};
 
 	void WDict::read_wdict_binfile(const string & fname) {
 
+		std::auto_ptr<mmap_file> mf;
+		try {
+			mf.reset(new mmap_file(fname));
+		} catch (std::exception & e) {
+			throw runtime_error("[E] reading serialized dictionary: Can not open " + fname);
+		}
+		if (is_map_file(mf->data(), mf->size(), magic_id_dict_map)) {
+			read_from_mapped(mf);
+			return;
+		}
+		mf.reset();
 		ifstream fi(fname.c_str(), ifstream::binary|ifstream::in);
 		if (!fi) {
 			throw runtime_error("[E] reading serialized dictionary: Can not open " + fname);
@@ -635,96 +732,132 @@ namespace ukb {
 			throw runtime_error("[E] writing serialized dict: Can not create " + fname);
 		}
 		write_dict_to_stream(fo);
-	}
-
-	ostream & write_posRangeM_to_stream (std::ostream & os, const wdict_vector<wdict_range_t> & pr) {
-
-		size_t m = pr.size();
-		os.write(reinterpret_cast<const char *>(&m), sizeof(m));
-		if(m) {
-			for(const wdict_range_t * it = pr.begin(), * end = pr.end();
-				it != end; ++it) {
-				write_atom_to_stream(os, it->pos);
-				write_atom_to_stream(os, it->left);
-				write_atom_to_stream(os, it->right);
-			}
-		}
-		return os;
-	}
-
-	void read_posRangeM_from_stream (std::istream & is, wdict_vector<wdict_range_t> & pr) {
-		string hw;
-		size_t m;
-		vector<wdict_range_t> auxV;
-
-		read_atom_from_stream(is, m);
-		if (!is) return;
-		for (size_t i = 0; i < m; ++i) {
-			wdict_range_t r;
-			read_atom_from_stream(is, r.pos);
-			read_atom_from_stream(is, r.left);
-			read_atom_from_stream(is, r.right);
-			auxV.push_back(r);
-		}
-		pr.assign(auxV);
-	}
-
-	ostream & write_itemV_to_stream (std::ostream & os, const wdict_vector<wdict_item_t> & vi) {
-		size_t m = vi.size();
-		os.write(reinterpret_cast<const char *>(&m), sizeof(m));
-		if(m) {
-			for(const wdict_item_t * it = vi.begin(), * end = vi.end();
-				it != end; ++it) {
-				write_atom_to_stream(os, it->m_syn);
-				write_atom_to_stream(os, it->m_count);
-			}
+		fo.close();
+		if (!fo) {
+			throw runtime_error("[E] writing serialized dict: Can not write " + fname + " (disk full?)");
 		}
-		return os;
 	}
 
-	void read_itemV_from_stream (std::istream & is, wdict_vector<wdict_item_t> & vi) {
+	void WDict::read_from_mapped(std::auto_ptr<mmap_file> & mf) {
 
-		size_t m;
-		vector<wdict_item_t> auxV;
+		typedef boost::uint64_t u64;
+		const char *base = mf->data();
+		size_t fsize = mf->size();
 
-		read_atom_from_stream(is, m);
-		if (!is) return;
-		for (size_t i = 0; i < m; ++i) {
-			wdict_item_t it;
-			read_atom_from_stream(is, it.m_syn);
-			read_atom_from_stream(is, it.m_count);
-			auxV.push_back(it);
+		try {
+			u64 h[dict_map_header_n];
+			vector<map_section_t> secs;
+			read_map_sections(base, fsize, h, dict_map_header_n, secs);
+			if (h[1] != dict_map_version)
+				throw runtime_error("Unknown version " + lexical_cast<string>(h[1]) + " (newer ukb?)");
+			size_t hw_n = h[2];
+			size_t item_n = h[3];
+			size_t range_n = h[4];
+			if (hw_n >= vertex_names_t::no_vertex)
+				throw runtime_error("too many headwords");
+
+			size_t meta_n = map_section_size(secs, dsec_meta);
+			const char *meta_p = map_section_data<char>(base, fsize, secs, dsec_meta, meta_n);
+			std::istringstream meta(string(meta_p, meta_n));
+			vector<string> pos;
+			read_vector_from_stream(meta, pos);
+			if (pos.size() > 256)
+				throw runtime_error("bad POS table");
+
+			const u64 *hw_offset = map_section_data<u64>(base, fsize, secs, dsec_hw_offset, hw_n + 1);
+			size_t arena_n = map_section_size(secs, dsec_hw_arena);
+			const char *hw_arena = map_section_data<char>(base, fsize, secs, dsec_hw_arena, arena_n);
+			if (hw_offset[hw_n] != arena_n)
+				throw runtime_error("bad headwords");
+			size_t hash_n = map_section_size(secs, dsec_hw_hash) / sizeof(boost::uint32_t);
+			if ((hash_n & (hash_n - 1)) || hash_n <= hw_n)
+				throw runtime_error("bad headword hash table");
+			const boost::uint32_t *hw_hash = map_section_data<boost::uint32_t>(base, fsize, secs, dsec_hw_hash, hash_n);
+
+			const u64 *item_ofs = map_section_data<u64>(base, fsize, secs, dsec_item_offset, hw_n + 1);
+			const wdict_item_t *items = map_section_data<wdict_item_t>(base, fsize, secs, dsec_items, item_n);
+			const u64 *range_ofs = map_section_data<u64>(base, fsize, secs, dsec_range_offset, hw_n + 1);
+			const wdict_range_t *ranges = map_section_data<wdict_range_t>(base, fsize, secs, dsec_ranges, range_n);
+			if (item_ofs[hw_n] != item_n || range_ofs[hw_n] != range_n)
+				throw runtime_error("bad offsets");
+
+			m_hws.attach(hw_n, hw_offset, hw_arena, hw_hash, hash_n);
+			m_pos.swap(pos);
+			m_pos.resize(256);
+			vector<u64>().swap(m_item_ofs_buf);
+			vector<wdict_item_t>().swap(m_items_buf);
+			vector<u64>().swap(m_range_ofs_buf);
+			vector<wdict_range_t>().swap(m_ranges_buf);
+			m_item_ofs = item_ofs;
+			m_items = items;
+			m_range_ofs = range_ofs;
+			m_ranges = ranges;
+
+			clear_inverse_dict();
+			size_t inv_ofs_n = map_section_size(secs, dsec_inv_offset) / sizeof(u64);
+			if (inv_ofs_n) {
+				const u64 *inv_ofs = map_section_data<u64>(base, fsize, secs, dsec_inv_offset, inv_ofs_n);
+				if (inv_ofs[inv_ofs_n - 1] != item_n)
+					throw runtime_error("bad inverse dictionary");
+				m_inv_items = map_section_data<winvdict_item_t>(base, fsize, secs, dsec_inv_items, item_n);
+				m_inv_ofs = inv_ofs;
+				m_inv_n = inv_ofs_n - 1;
+				m_inv_mapped = true;
+			}
+		} catch (std::exception & e) {
+			throw runtime_error(string("[E] reading serialized dictionary: ") + e.what());
 		}
-		vi.assign(auxV);
+		m_mapped = mf;
 	}
 
-	ostream & write_rhs_to_stream (std::ostream & os, const wdict_rhs_t & rhs) {
-
-		write_itemV_to_stream(os, rhs.m_items);
-		write_posRangeM_to_stream(os, rhs.m_pos_ranges);
-
-		return os;
-	}
+	ostream & WDict::write_dict_to_stream (std::ostream & os) const {
 
-	void read_rhs_from_stream (std::istream & is, wdict_rhs_t & rhs) {
+		size_t H = size();
+		size_t ofs_bytes = (H + 1) * sizeof(boost::uint64_t);
+		ensure_inverse_dict();
+
+		// POS names, without the trailing unused codes
+		vector<string> pos(m_pos);
+		while (pos.size() && pos.back().empty()) pos.pop_back();
+		std::ostringstream meta;
+		write_vector_to_stream(meta, pos);
+		string meta_str(meta.str());
+
+		vector<map_section_t> secs;
+		secs.push_back(map_section_t(dsec_meta, meta_str.data(), meta_str.size()));
+		secs.push_back(map_section_t(dsec_hw_offset, m_hws.offsets(), ofs_bytes));
+		secs.push_back(map_section_t(dsec_hw_arena, m_hws.arena(), m_hws.arena_size()));
+		secs.push_back(map_section_t(dsec_hw_hash, m_hws.hash_table(), m_hws.hash_size() * sizeof(boost::uint32_t)));
+		secs.push_back(map_section_t(dsec_item_offset, m_item_ofs, ofs_bytes));
+		secs.push_back(map_section_t(dsec_items, m_items, m_item_ofs[H] * sizeof(wdict_item_t)));
+		secs.push_back(map_section_t(dsec_range_offset, m_range_ofs, ofs_bytes));
+		secs.push_back(map_section_t(dsec_ranges, m_ranges, m_range_ofs[H] * sizeof(wdict_range_t)));
+		secs.push_back(map_section_t(dsec_inv_offset, m_inv_ofs, (m_inv_n + 1) * sizeof(boost::uint64_t)));
+		secs.push_back(map_section_t(dsec_inv_items, m_inv_items, m_item_ofs[H] * sizeof(winvdict_item_t)));
+
+		boost::uint64_t h[dict_map_header_n] = { magic_id_dict_map, dict_map_version, H,
+												 m_item_ofs[H], m_range_ofs[H], 0 };
+		return write_map_sections(os, h, dict_map_header_n, secs);
+	}
+
+	// Old (stream) format
+	//
+	// The counts and string lengths of these files are checked against the
+	// file size, so that a corrupt file raises an error instead of
+	// allocating without bound.
 
-		read_itemV_from_stream(is, rhs.m_items);
-		read_posRangeM_from_stream(is, rhs.m_pos_ranges);
+	static size_t read_legacy_count(std::istream & is, size_t max_n, const char *what) {
+		size_t n;
+		read_atom_from_stream(is, n);
+		if (!is || n > max_n)
+			throw runtime_error(string("[E] reading serialized dictionary: bad ") + what + " (corrupt file?)");
+		return n;
 	}
 
-	ostream & WDict::write_dict_to_stream (std::ostream & os) const {
-
-		write_atom_to_stream(os, magic_id_dict_v0);
-		// Write map
-		os.write(reinterpret_cast<const char *>(&m_N), sizeof(m_N));
-		if(m_N) {
-			for(wdict_t::const_iterator it = m_wdict.begin(), end = m_wdict.end();
-				it != end; ++it) {
-				write_atom_to_stream(os, it->first);
-				write_rhs_to_stream(os, it->second);
-			}
-		}
-		return os;
+	static void read_legacy_string(std::istream & is, size_t max_n, string & str) {
+		size_t len = read_legacy_count(is, max_n, "string length");
+		str.resize(len);
+		if (len) is.read(&str[0], len);
 	}
 
 	void WDict::read_dict_from_stream (std::istream & is) {
@@ -734,38 +867,72 @@ namespace ukb {
 		if (id != magic_id_dict_v0) {
 			throw runtime_error("[E] reading serialized dictionary: invalid id (same platform used to compile the KB?)");
 		}
-		string hw;
-		read_atom_from_stream(is, m_N);
+		std::streampos cur = is.tellg();
+		is.seekg(0, std::ios::end);
+		size_t fsize = is.tellg() - cur;
+		is.seekg(cur);
+		// minimum sizes of a headword (string length and two counts), an item
+		// (64 bit concept id and float count) and a range (string length and
+		// two indices)
+		const size_t hw_bytes = 3 * sizeof(size_t);
+		const size_t item_bytes = sizeof(boost::uint64_t) + sizeof(float);
+		const size_t range_bytes = 3 * sizeof(size_t);
+		size_t N;
+		read_atom_from_stream(is, N);
 		if (!is) return;
-		for (size_t i = 0; i < m_N; ++i) {
-			read_atom_from_stream(is, hw);
-			wdict_rhs_t e;
-			read_rhs_from_stream(is, e);
-			m_wdict.insert(make_pair(hw, e));
+		if (N > fsize / hw_bytes)
+			throw runtime_error("[E] reading serialized dictionary: bad number of headwords (corrupt file?)");
+		wdict_builder_t b;
+		for (size_t i = 0; i < N; ++i) {
+			string hw;
+			read_legacy_string(is, fsize, hw);
+			b.add_hw(hw);
+			size_t m = read_legacy_count(is, fsize / item_bytes, "number of concepts");
+			for (size_t j = 0; j < m; ++j) {
+				wdict_item_t it;
+				// concept ids were written as 64 bit size_t
+				boost::uint64_t syn;
+				read_atom_from_stream(is, syn);
+				if (syn >= std::numeric_limits<kb_index_t>::max())
+					throw runtime_error("[E] reading serialized dictionary: concept index too big for " +
+										lexical_cast<string>(8 * sizeof(kb_index_t)) +
+										" bit indices (compile ukb with UKB_CSR64)");
+				it.m_syn = syn;
+				read_atom_from_stream(is, it.m_count);
+				b.items.push_back(it);
+			}
+			size_t items_n = m;
+			m = read_legacy_count(is, fsize / range_bytes, "number of POS ranges");
+			for (size_t j = 0; j < m; ++j) {
+				string pos;
+				size_t left, right;
+				read_legacy_string(is, fsize, pos);
+				read_atom_from_stream(is, left);
+				read_atom_from_stream(is, right);
+				if (!is || left > right || right > items_n)
+					throw runtime_error("[E] reading serialized dictionary: bad POS range (corrupt file?)");
+				b.ranges.push_back(wdict_range_t(b.pos_code(pos), left, right));
+			}
+			b.close_hw();
 		}
+		if (!is)
+			throw runtime_error("[E] reading serialized dictionary: unexpected end of file");
+		swap_arrays(b);
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
 	// WDictHeadwords
 
-	WDictHeadwords::WDictHeadwords(const WDict & wdict) {
-		for(WDict::wdict_t::const_iterator it = wdict.m_wdict.begin(),
-				end = wdict.m_wdict.end();
-			it != end; ++it) {
-			m_V.push_back(&(*it));
-		}
-	}
-
-	const std::string & WDictHeadwords::hw(size_t i) const {
-		return m_V[i]->first;
+	std::string WDictHeadwords::hw(size_t i) const {
+		return m_wdict.headword(i);
 	}
 
 	WDict_entries WDictHeadwords::rhs(size_t i) const {
-		return WDict_entries(m_V[i]->second);
+		return m_wdict.hw_entries(i);
 	}
 
 	size_t WDictHeadwords::size() const {
-		return m_V.size();
+		return m_wdict.size();
 	}
 
 
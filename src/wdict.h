@@ -4,7 +4,6 @@
 #define WDICT_H
 
 #include "globalVars.h"
-#include "wdict_vector.h"
 
 #include <string>
 #include <iterator>
@@ -19,6 +18,8 @@
 ////////////////////////////////////////
 
 #include "kbGraph.h"
+#include "ukbThreads.h"
+#include "ukbMmap.h"
 
 namespace ukb {
 
@@ -28,13 +29,15 @@ namespace ukb {
 	};
 
 
-	// specicies a range [left, right)
+	// specicies the range [left, right) of the concepts of a headword with
+	// a given POS. The POS is stored as a one byte code (see WDict::pos_name).
 	struct wdict_range_t {
-		std::string pos;
-		size_t left;
-		size_t right;
-		wdict_range_t() : pos(), left(0), right(0) {}
-		wdict_range_t(std::string p, size_t a, size_t b) : pos(p), left(a), right(b) {}
+		boost::uint32_t left;
+		boost::uint32_t right;
+		boost::uint8_t pos;
+		boost::uint8_t pad[3];
+		wdict_range_t() : left(0), right(0), pos(0) { pad[0] = pad[1] = pad[2] = 0; }
+		wdict_range_t(boost::uint8_t p, size_t a, size_t b) : left(a), right(b), pos(p) { pad[0] = pad[1] = pad[2] = 0; }
 	};
 
 	struct wdict_item_t {
@@ -50,20 +53,6 @@ namespace ukb {
 		}
 	};
 
-	// type of dict items
-	struct wdict_rhs_t {
-		wdict_vector<wdict_item_t> m_items;
-		wdict_vector<wdict_range_t> m_pos_ranges;
-
-		wdict_rhs_t() {}
-
-		void swap(wdict_rhs_t & o) {
-			m_items.swap(o.m_items);
-			m_pos_ranges.swap(o.m_pos_ranges);
-		}
-
-	};
-
 	// Accessor class for WDict entries associated to a word
 
 	class WDict_entries {
@@ -78,7 +67,7 @@ namespace ukb {
 		const wdict_item_t *end() const;
 		size_t size() const;
 		Kb::vertex_descriptor get_entry(size_t i) const;
-		const std::string & get_entry_str(size_t i) const;
+		std::string get_entry_str(size_t i) const;
 		float get_freq(size_t i) const;
 		const std::string & get_pos(size_t i) const;
 		size_t dist_pos() const;
@@ -122,11 +111,11 @@ namespace ukb {
 
 	private:
 
-		WDict_entries(const wdict_rhs_t & item);
-		WDict_entries(const wdict_rhs_t & item, const std::string & pos);
-
+		WDict_entries() : m_items(NULL), m_pos(), m_left(0), m_right(0) {}
+		WDict_entries(const wdict_item_t * items, size_t left, size_t right, const std::string & pos)
+			: m_items(items), m_pos(pos), m_left(left), m_right(right) {}
 
-		const wdict_rhs_t & m_rhs;
+		const wdict_item_t * m_items; // concepts of the headword
 		std::string m_pos;
 		size_t m_left;
 		size_t m_right;
@@ -134,36 +123,36 @@ namespace ukb {
 	};
 
 	// inverse dictionary
+	//
+	// The headwords of concept u are items [inv_ofs[u], inv_ofs[u+1]) of the
+	// inverse dictionary (see WDict::words), sorted by decreasing
+	// probability. Words are headword ids, so that the strings are those of
+	// the dictionary.
 
 	struct winvdict_item_t {
-		std::string m_word;
+		boost::uint32_t m_hw;
 		float m_count;
 
 		winvdict_item_t() {}
-		winvdict_item_t(std::string word, float count) : m_word(word), m_count(count) {}
-
-		void swap(winvdict_item_t & o) {
-			std::swap(m_word, o.m_word);
-			std::swap(m_count, o.m_count);
-		}
+		winvdict_item_t(size_t hw, float count) : m_hw(hw), m_count(count) {}
 	};
 
-	// type of inverse dict items
-	typedef std::vector<winvdict_item_t> winvdict_rhs_t;
+	class WDict;
 
 	class WInvdict_entries {
 
 	public:
 
-		WInvdict_entries(const winvdict_rhs_t & item) : m_rhs(item) {};
+		WInvdict_entries(const WDict & wdict, const winvdict_item_t * beg, const winvdict_item_t * end)
+			: m_wdict(wdict), m_beg(beg), m_end(end) {};
 		~WInvdict_entries() {}
 
-		size_t size() const { return m_rhs.size(); }
-		const std::string & get_word(size_t i) const { return m_rhs[i].m_word; }
-		float get_prob(size_t i) const { return m_rhs[i].m_count; };
+		size_t size() const { return m_end - m_beg; }
+		std::string get_word(size_t i) const;
+		float get_prob(size_t i) const { return m_beg[i].m_count; };
 
-		const winvdict_rhs_t::const_iterator begin() const;
-		const winvdict_rhs_t::const_iterator end() const;
+		const winvdict_item_t * begin() const { return m_beg; }
+		const winvdict_item_t * end() const { return m_end; }
 
 		//friend std::ostream & operator<<(std::ostream & o, const WInvdict_entries & item);
 		class freq_const_iterator:
@@ -174,7 +163,7 @@ namespace ukb {
 			const float &> {
 
 		public:
-			typedef winvdict_rhs_t::const_iterator value_type;
+			typedef const winvdict_item_t * value_type;
 
 			freq_const_iterator() : m_current() {}
 			explicit freq_const_iterator(value_type p) : m_current(p) {}
@@ -201,16 +190,30 @@ namespace ukb {
 		};
 
 	private:
-		const winvdict_rhs_t & m_rhs;
+		const WDict & m_wdict;
+		const winvdict_item_t * m_beg;
+		const winvdict_item_t * m_end;
 	};
 
-	std::ostream & operator<<(std::ostream & o, const wdict_rhs_t & item);
+	struct wdict_builder_t; // see wdict.cc
+
+	// Dictionary.
+	//
+	// The dictionary is stored in flat arrays. Headwords are numbered, and
+	// their strings are kept in a vertex_names_t (an arena with a hash
+	// index). The concepts of headword h are items [item_ofs[h],
+	// item_ofs[h+1]), and its POS ranges are ranges [range_ofs[h],
+	// range_ofs[h+1]), with positions relative to the first concept of the
+	// headword.
+	//
+	// The arrays are either owned, or point into a memory mapped
+	// dictionary binfile (see write_wdict_binfile), which is then used in
+	// place, without reading it at all. The binfile also holds the inverse
+	// dictionary, which is otherwise built the first time it is needed.
 
 	class WDict {
 
 	public:
-		typedef boost::unordered_map<std::string, wdict_rhs_t > wdict_t;
-		typedef boost::unordered_map<Kb::vertex_descriptor, winvdict_rhs_t > winvdict_t;
 
 		// Singleton
 		static WDict & instance();
@@ -219,7 +222,6 @@ namespace ukb {
 		size_t size_inv() const;
 
 		WDict_entries get_entries(const std::string & word, const std::string & pos = std::string()) const;
-		const wdict_t & wdict() const  { return m_wdict; };
 
 		//const std::vector<std::string> & headwords() const { return m_words; }
 
@@ -238,6 +240,7 @@ namespace ukb {
 		void  size_bytes();
 
 		friend class WDictHeadwords;
+		friend class WInvdict_entries;
 
 	private:
 
@@ -247,28 +250,71 @@ namespace ukb {
 
 		void read_wdict_file(const std::string & fname);
 
-		void create_variant_map();
+		// headword h
+		std::string headword(size_t h) const { return m_hws.name(h); }
+		WDict_entries hw_entries(size_t h) const;
+		WDict_entries hw_entries(size_t h, const std::string & pos) const;
+		const std::string & pos_name(boost::uint8_t code) const { return m_pos[code]; }
+
+		// use the arrays of b (see wdict_builder_t)
+		void swap_arrays(wdict_builder_t & b);
+		void sync();
+
+		void create_variant_map() const;
 		void create_inverse_dict() const;
 
+		// The variant map and the inverse dictionary are created the first
+		// time they are needed. These functions do it in a thread-safe way.
+
+		void ensure_variant_map() const;
+		void ensure_inverse_dict() const;
+		void clear_inverse_dict();
+
 		// Streaming
 		void read_dict_from_stream (std::istream & is);
+		void read_from_mapped(std::auto_ptr<mmap_file> & mf);
 		void read_wdict_binfile(const std::string & fname);
 		std::ostream & write_dict_to_stream (std::ostream & os) const;
 
 	private:
-		wdict_t m_wdict;
-		mutable winvdict_t m_wdict_inv;
-		size_t m_N; // number of headwords
-		std::map<std::string, std::string> m_variants;
+
+		vertex_names_t m_hws;                    // headwords
+		std::vector<std::string> m_pos;          // POS of each code
+
+		const boost::uint64_t * m_item_ofs;      // [H + 1]
+		const wdict_item_t * m_items;
+		const boost::uint64_t * m_range_ofs;     // [H + 1]
+		const wdict_range_t * m_ranges;
+
+		// storage when owned
+		std::vector<boost::uint64_t> m_item_ofs_buf;
+		std::vector<wdict_item_t> m_items_buf;
+		std::vector<boost::uint64_t> m_range_ofs_buf;
+		std::vector<wdict_range_t> m_ranges_buf;
+
+		std::auto_ptr<mmap_file> m_mapped;       // mapped binfile, if any
+
+		// inverse dictionary. m_inv_mapped is set (when loading) if it
+		// points into the mapped binfile, and then it is used without
+		// locking.
+		bool m_inv_mapped;
+		mutable size_t m_inv_n;                  // concepts
+		mutable const boost::uint64_t * m_inv_ofs; // [m_inv_n + 1]
+		mutable const winvdict_item_t * m_inv_items;
+		mutable std::vector<boost::uint64_t> m_inv_ofs_buf;
+		mutable std::vector<winvdict_item_t> m_inv_items_buf;
+
+		mutable std::map<std::string, std::string> m_variants;
+		mutable thr::mutex m_lazy_mutex; // for the inverse dict and m_variants
 	};
 
 	class WDictHeadwords {
 
 	public:
 
-		WDictHeadwords(const WDict & wdict);
+		WDictHeadwords(const WDict & wdict) : m_wdict(wdict) {}
 
-		const std::string & hw(size_t i) const;
+		std::string hw(size_t i) const;
 		WDict_entries rhs(size_t i) const;
 		size_t size() const;
 
@@ -277,8 +323,7 @@ namespace ukb {
 		WDictHeadwords(const WDictHeadwords &);
 		WDictHeadwords & operator=(const WDictHeadwords &);
 
-		typedef const std::pair<const std::string, wdict_rhs_t> * pair_ptr_t;
-		std::vector<pair_ptr_t> m_V;
+		const WDict & m_wdict;
 	};
 
 	// return concept priors: